@@ -18,6 +18,14 @@
 #ifndef ESFILE_H__
 #define ESFILE_H__
 
+/*
+ * Encryption: the drives create plain files until a key is set with
+ * esFile_SetCryptKey or a provider is selected with esFile_SetCryptoProvider,
+ * then new files are encrypted unless esFile_SetDefaultEncryption or
+ * ESFILE_MODE_PLAIN says otherwise. esFile_Open returns -2 for an encrypted
+ * file, or for a create with ESFILE_MODE_ENCRYPTED, while no key is set.
+ */
+
 #include "esFile_definitions.h"
 #include "esFile_system.h"
 #include "esFile_cache.h"
@@ -32,5 +40,12 @@
 #include "esFile_remove.h"
 #include "esFile_rename.h"
 #include "esFile_dir.h"
+#include "esFile_sync.h"
+#include "esFile_cryption.h"
+#include "esFile_ring.h"
+#include "esFile_record.h"
+#include "esFile_kv.h"
+#include "esFile_async.h"
+#include "esFile_reclaim.h"
 
 #endif
@@ -0,0 +1,420 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_open.h"
+#include "esFile_read.h"
+#include "esFile_write.h"
+#include "esFile_lock.h"
+#include "esFile_async.h"
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+#include <pthread.h>
+
+static pthread_mutex_t asyncLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t asyncQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t asyncDone = PTHREAD_COND_INITIALIZER;
+static uint8_t asyncStarted = 0;
+
+static void *AsyncWorker(void *arg);
+#endif
+
+static esFile_AsyncRequest *asyncHead = NULL, *asyncTail = NULL;
+static uint8_t asyncServicing = 0;
+static uint8_t mergeBuffer[ESFILE_ASYNC_MERGE > 0 ? ESFILE_ASYNC_MERGE : 1];
+
+static int AsyncSubmit(esFile_AsyncRequest *req);
+static void AsyncLock(uint8_t lock);
+static esFile_AsyncRequest *AsyncTake(uint32_t *merged);
+static void AsyncComplete(esFile_AsyncRequest *req);
+static void AsyncWriteMerged(esFile_AsyncRequest *req);
+
+/*
+ * @brief Queue the opening of a file.
+ *  The request is carried out by the file system worker like esFile_Open and
+    its result is left in req->rv. The request, the descriptor and the path
+    must stay valid until it is done. req->context is left for the callback.
+ * @param req 
+ * @param fp 
+ * @param path 
+ * @param mode 
+ * @param callback called by the worker when the request is done, may be NULL
+ * @return 0 if the request is queued
+ */
+int esFile_OpenAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, const char *path, uint16_t mode, funcAsyncDone callback)
+{
+    if (req == NULL || fp == NULL || path == NULL)
+    {
+        return -1;
+    }
+
+    req->op = ESFILE_ASYNC_OPEN;
+    req->fp = fp;
+    req->path = path;
+    req->mode = mode;
+    req->data = NULL;
+    req->len = 0;
+    req->callback = callback;
+
+    return AsyncSubmit(req);
+}
+
+/*
+ * @brief Queue a read from a file.
+ *  The request is carried out by the file system worker like esFile_Read. The
+    number of bytes read is left in req->count and the result in req->rv. The
+    descriptor must not be used by the caller until the request is done.
+ * @param req 
+ * @param fp 
+ * @param buff 
+ * @param btr 
+ * @param callback called by the worker when the request is done, may be NULL
+ * @return 0 if the request is queued
+ */
+int esFile_ReadAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, void *buff, uint32_t btr, funcAsyncDone callback)
+{
+    if (req == NULL || fp == NULL)
+    {
+        return -1;
+    }
+
+    req->op = ESFILE_ASYNC_READ;
+    req->fp = fp;
+    req->path = NULL;
+    req->data = (uint8_t *)buff;
+    req->len = btr;
+    req->callback = callback;
+
+    return AsyncSubmit(req);
+}
+
+/*
+ * @brief Queue a write to a file.
+ *  The request is carried out by the file system worker like esFile_Write, so
+    the caller goes on while the sectors are programmed. Small writes queued
+    back to back on the same descriptor are merged by the worker into one
+    esFile_Write of up to ESFILE_ASYNC_MERGE bytes, which programs a partly
+    filled sector once instead of once per request. The data must stay valid
+    until the request is done.
+ * @param req 
+ * @param fp 
+ * @param buff 
+ * @param btw 
+ * @param callback called by the worker when the request is done, may be NULL
+ * @return 0 if the request is queued
+ */
+int esFile_WriteAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, const void *buff, uint32_t btw, funcAsyncDone callback)
+{
+    if (req == NULL || fp == NULL || buff == NULL)
+    {
+        return -1;
+    }
+
+    req->op = ESFILE_ASYNC_WRITE;
+    req->fp = fp;
+    req->path = NULL;
+    req->data = (uint8_t *)buff;
+    req->len = btw;
+    req->callback = callback;
+
+    return AsyncSubmit(req);
+}
+
+/*
+ * @brief Wait until a request is done.
+ *  On the host the worker thread is waited for. Elsewhere the queue is
+    serviced by the caller while the file system task is busy with other
+    requests, so waiting works even without a file system task.
+ * @param req 
+ * @return The result of the request
+ */
+int esFile_AsyncWait(esFile_AsyncRequest *req)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_mutex_lock(&asyncLock);
+    while (!req->done)
+    {
+        pthread_cond_wait(&asyncDone, &asyncLock);
+    }
+    pthread_mutex_unlock(&asyncLock);
+#else
+    while (!req->done)
+    {
+        if (esFile_AsyncService() == 0)
+        {
+#if ESFILE_LOCK == ESFILE_LOCK_PORT
+            TaskYield();
+#endif
+        }
+    }
+#endif
+
+    return req->rv;
+}
+
+/*
+ * @brief Carry out the queued requests.
+ *  The requests are done in the order they were queued, by one caller at a
+    time. On the host a worker thread calls this function. Elsewhere it is
+    called by the file system task, for example each time it is woken up by a
+    task which queued a request.
+ * @return The number of requests done, 0 if there were none or another task is servicing the queue
+ */
+int esFile_AsyncService(void)
+{
+    esFile_AsyncRequest *req = NULL;
+    uint32_t merged = 0;
+    int count = 0;
+
+    AsyncLock(1);
+    if (asyncServicing)
+    {
+        AsyncLock(0);
+        return 0;
+    }
+    asyncServicing = 1;
+    AsyncLock(0);
+
+    while ((req = AsyncTake(&merged)) != NULL)
+    {
+        if (merged)
+        {
+            AsyncWriteMerged(req);
+            count += merged;
+            continue;
+        }
+
+        if (req->op == ESFILE_ASYNC_OPEN)
+        {
+            req->rv = esFile_Open(req->fp, req->path, req->mode);
+        }
+        else if (req->op == ESFILE_ASYNC_READ)
+        {
+            req->rv = esFile_Read(req->fp, req->data, req->len, &req->count);
+        }
+        else
+        {
+            req->rv = esFile_Write(req->fp, req->data, req->len, &req->count);
+        }
+
+        AsyncComplete(req);
+        count++;
+    }
+
+    AsyncLock(1);
+    asyncServicing = 0;
+    AsyncLock(0);
+
+    return count;
+}
+
+/*
+ * @brief Append a request to the queue.
+ *  On the host the worker thread is started with the first request.
+ * @param req 
+ * @return 0 if it is successful
+ */
+static int AsyncSubmit(esFile_AsyncRequest *req)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_t worker;
+#endif
+    int rv = 0;
+
+    req->count = 0;
+    req->rv = 0;
+    req->next = NULL;
+    req->done = 0;
+
+    AsyncLock(1);
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    if (!asyncStarted)
+    {
+        if (pthread_create(&worker, NULL, AsyncWorker, NULL) == 0)
+        {
+            pthread_detach(worker);
+            asyncStarted = 1;
+        }
+        else
+        {
+            ESFILE_LOG("AsyncWorker error: %s %d \n", __FILE__, __LINE__);
+            rv = -1;
+        }
+    }
+#endif
+
+    if (rv == 0)
+    {
+        if (asyncTail)
+            asyncTail->next = req;
+        else
+            asyncHead = req;
+        asyncTail = req;
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+        pthread_cond_signal(&asyncQueued);
+#endif
+    }
+
+    AsyncLock(0);
+    return rv;
+}
+
+/*
+ * @brief Take or release the lock of the queue.
+ *  The queue is only touched for a few instructions, so besides the host it
+    is kept under the shared lock of the file system.
+ * @param lock 1 to take it, 0 to release it
+ */
+static void AsyncLock(uint8_t lock)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    if (lock)
+        pthread_mutex_lock(&asyncLock);
+    else
+        pthread_mutex_unlock(&asyncLock);
+#else
+    if (lock)
+        esFile_Lock(ESFILE_LOCK_SHARED);
+    else
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+#endif
+}
+
+/*
+ * @brief Take the next request from the queue.
+ *  A small write is taken together with the writes queued right after it on
+    the same descriptor while they fit in the merge buffer. They stay linked
+    through their next pointers.
+ * @param merged receives the number of requests taken if they are merged writes, 0 otherwise
+ * @return The first request taken or NULL if the queue is empty
+ */
+static esFile_AsyncRequest *AsyncTake(uint32_t *merged)
+{
+    esFile_AsyncRequest *req = NULL, *last = NULL;
+    uint32_t total = 0, count = 0;
+
+    AsyncLock(1);
+
+    req = asyncHead;
+    *merged = 0;
+    if (req)
+    {
+        last = req;
+        if (req->op == ESFILE_ASYNC_WRITE && req->len < ESFILE_ASYNC_MERGE)
+        {
+            total = req->len;
+            count = 1;
+            while (last->next && last->next->op == ESFILE_ASYNC_WRITE && last->next->fp == req->fp &&
+                   total + last->next->len <= ESFILE_ASYNC_MERGE)
+            {
+                last = last->next;
+                total += last->len;
+                count++;
+            }
+
+            if (count > 1)
+                *merged = count;
+        }
+
+        asyncHead = last->next;
+        if (asyncHead == NULL)
+            asyncTail = NULL;
+        last->next = NULL;
+    }
+
+    AsyncLock(0);
+    return req;
+}
+
+/*
+ * @brief Mark a request as done and report it.
+ * @param req 
+ */
+static void AsyncComplete(esFile_AsyncRequest *req)
+{
+    if (req->callback)
+    {
+        req->callback(req);
+    }
+
+    AsyncLock(1);
+    req->done = 1;
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_cond_broadcast(&asyncDone);
+#endif
+    AsyncLock(0);
+}
+
+/*
+ * @brief Carry out a chain of merged writes with one esFile_Write.
+ *  The bytes written are handed out to the requests in order, so after a
+    short write the requests beyond it report what they got.
+ * @param req first request of the chain
+ */
+static void AsyncWriteMerged(esFile_AsyncRequest *req)
+{
+    esFile_AsyncRequest *next = NULL;
+    uint32_t total = 0, written = 0;
+    int rv = 0;
+
+    for (next = req; next; next = next->next)
+    {
+        memcpy(&mergeBuffer[total], next->data, next->len);
+        total += next->len;
+    }
+
+    rv = esFile_Write(req->fp, mergeBuffer, total, &written);
+
+    while (req)
+    {
+        next = req->next;
+        req->count = written < req->len ? written : req->len;
+        req->rv = rv;
+        written -= req->count;
+        AsyncComplete(req);
+        req = next;
+    }
+}
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+/*
+ * @brief Worker thread of the host, services the queue when it is not empty.
+ * @param arg 
+ * @return NULL
+ */
+static void *AsyncWorker(void *arg)
+{
+    (void)arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&asyncLock);
+        while (asyncHead == NULL)
+        {
+            pthread_cond_wait(&asyncQueued, &asyncLock);
+        }
+        pthread_mutex_unlock(&asyncLock);
+
+        esFile_AsyncService();
+    }
+
+    return NULL;
+}
+#endif
\ No newline at end of file
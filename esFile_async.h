@@ -0,0 +1,49 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_ASYNC_H__
+#define ESFILE_ASYNC_H__
+
+#define ESFILE_ASYNC_OPEN 1
+#define ESFILE_ASYNC_READ 2
+#define ESFILE_ASYNC_WRITE 3
+
+typedef struct esFile_AsyncRequest esFile_AsyncRequest;
+typedef void (*funcAsyncDone)(esFile_AsyncRequest *);
+
+struct esFile_AsyncRequest {
+    uint8_t op;
+    esFile_FileDescriptor *fp;
+    const char *path;
+    uint16_t mode;
+    uint8_t *data;
+    uint32_t len;
+    uint32_t count;
+    int rv;
+    funcAsyncDone callback;
+    void *context;
+    esFile_AsyncRequest *next;
+    volatile uint8_t done;
+};
+
+int esFile_OpenAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, const char *path, uint16_t mode, funcAsyncDone callback);
+int esFile_ReadAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, void *buff, uint32_t btr, funcAsyncDone callback);
+int esFile_WriteAsync(esFile_AsyncRequest *req, esFile_FileDescriptor *fp, const void *buff, uint32_t btw, funcAsyncDone callback);
+int esFile_AsyncWait(esFile_AsyncRequest *req);
+int esFile_AsyncService(void);
+
+#endif
\ No newline at end of file
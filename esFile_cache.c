@@ -20,201 +20,1426 @@
 #include "esFile_system.h"
 #include "esFile_disk.h"
 #include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_open.h"
+#include "esFile_pack.h"
+#include "esFile_crc.h"
 
-static uint8_t diskBuffer[ESFILE_BUFFERSIZE + 1];
-static uint8_t nandSectorTable[(ESFTL_NANDNUMBLOCKS * ESFTL_NANDNUMPAGEBLOCK) / 8];
-static uint8_t simSectorTable[256 / 8];
-static esFile_System fs[2];
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+#include <time.h>
+#endif
+
+#if ESFILE_CACHE_ENTRIES < 1
+#error "ESFILE_CACHE_ENTRIES must be at least 1"
+#endif
+
+#if ESFILE_CACHE_SETS < 1 || ESFILE_CACHE_SETS > ESFILE_MAX_DRIVES
+#error "ESFILE_CACHE_SETS must be between 1 and ESFILE_MAX_DRIVES"
+#endif
+
+typedef struct {
+    uint8_t valid;
+    uint8_t did;
+    uint16_t sector;
+    uint8_t dirty;
+    uint8_t verified;
+    uint8_t loading;
+    uint8_t busy;
+    uint32_t stamp;
+    uint32_t dirtySince;
+    uint8_t data[ESFILE_BUFFERSIZE];
+} esFile_CacheEntry;
+
+static uint32_t diskBuffers[ESFILE_DISK_BUFFERS][ESFILE_BUFFERSIZE / 4 + 1];
+static esFile_Volume volumes[ESFILE_MAX_DRIVES];
+static esFile_CacheEntry cacheEntries[ESFILE_CACHE_SETS][ESFILE_CACHE_ENTRIES];
+static esFile_CacheStats cacheStats;
+static uint32_t cacheClock;
+static uint8_t cacheWriteBack = ESFILE_CACHE_WRITEBACK;
+
+#define CACHE_READ 0
+#define CACHE_LOAD 1
+#define CACHE_CLAIM 2
+
+static int IsMetaSector(uint8_t did, int sector);
+static int MetaLoad(uint8_t did, int sector, int mode);
+static int MetaRead(uint8_t did, int sector, uint8_t *buff, int idx, int count);
+static int MetaWrite(uint8_t did, int sector, uint8_t *buff, int idx, int count);
+static int MetaPersist(uint8_t did, int sector);
+static esFile_CacheEntry *CacheLookup(uint8_t did, int sector);
+static esFile_CacheEntry *CacheGet(uint8_t did, int sector, int mode);
+static esFile_CacheEntry *CacheVictim(uint8_t did);
+static void CacheTouch(esFile_CacheEntry *entry);
+static int CachePersist(esFile_CacheEntry *entry);
+static int CacheWriteOne(esFile_CacheEntry *entry);
+static esFile_CacheEntry *CachePrior(esFile_CacheEntry *entry);
+static void CacheUnlockIo(void);
+static void CacheLockIo(void);
+static uint32_t CacheTick(void);
 
 /*
  * @brief Initialize the cache structures and buffers
  *  This function is responsible for setting up the necessary data structures
     and memory buffers for caching data. It prepares the cache for subsequent
-    read and write operations.
+    read and write operations. The shared lock only guards the entries and the
+    state of the volumes, the disks are accessed without it: an entry being
+    read from or written to the disk is marked loading or busy, and the other
+    tasks wait for it on the shared lock.
+    Every drive has a set of ESFILE_CACHE_ENTRIES entries, so the traffic of
+    one drive does not evict the sectors of another one and a drive whose
+    entries are all busy does not hold up the others. This takes
+    ESFILE_CACHE_SETS times the RAM of a single set; a port short of RAM can
+    lower ESFILE_CACHE_SETS and let the drives share the sets.
  */
 void esFile_CacheInit(void)
 {
-    memset(nandSectorTable, 0, sizeof(nandSectorTable));
-    memset(simSectorTable, 0, sizeof(simSectorTable));
-    memset(fs, 0, sizeof(fs));
-    esFile_ClearDiskBuffer();
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+    for (int i = 0; i < esFile_GetDriveCount(); i++)
+    {
+        if (dInfos[i].chainTable)
+        {
+            memset(dInfos[i].chainTable, 0, dInfos[i].dataSectorEnd * sizeof(uint16_t));
+        }
+
+        memset(dInfos[i].sectorTable, 0, (dInfos[i].dataSectorEnd + 31) / 32 * sizeof(uint32_t));
+    }
+
+    for (int i = 0; i < ESFILE_MAX_DRIVES; i++)
+    {
+        // The options are kept, they may be set before mounting
+        memset(&volumes[i].fs, 0, sizeof(esFile_System));
+        volumes[i].metaValid = 0;
+        volumes[i].metaDirty = 0;
+        volumes[i].metaDirtySince = 0;
+        volumes[i].metaLoading = 0;
+        volumes[i].metaBusy = 0;
+        volumes[i].usedSectors = 0;
+        volumes[i].releasedSectors = 0;
+        volumes[i].allocCursor = 0;
+        volumes[i].wearPending = 0;
+        volumes[i].discardCount = 0;
+        volumes[i].discardPending = 0;
+        volumes[i].discardBusy = 0;
+        volumes[i].sealCount = 0;
+    }
+
+    memset(cacheEntries, 0, sizeof(cacheEntries));
+    memset(&cacheStats, 0, sizeof(cacheStats));
+    cacheClock = 0;
+    memset(diskBuffers, 0, sizeof(diskBuffers));
 }
 
 /*
- * @brief Retrieve the disk read-write buffer.
- *  This function returns the buffer used for reading and writing data to/from the
-    disk.
- * @return The disk read-write buffer
+ * @brief Read sector data through the sector cache.
+ *  This function serves the requested byte range of a sector from the sector
+    cache. On a miss the whole sector is fetched from the disk into the least
+    recently used cache entry, so subsequent accesses to the same sector do not
+    touch the device again.
+ * @param did 
+ * @param sector 
+ * @param buff 
+ * @param idx 
+ * @param count 
+ * @return 0 if it is successful
  */
-uint8_t *esFile_GetDiskBuffer(void)
+int esFile_CacheRead(uint8_t did, int sector, uint8_t *buff, int idx, int count)
 {
-    return diskBuffer;
+    esFile_CacheEntry *entry = NULL;
+    int rv = 0;
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    if (IsMetaSector(did, sector))
+    {
+        rv = MetaRead(did, sector, buff, idx, count);
+    }
+    else
+    {
+        entry = CacheGet(did, sector, CACHE_READ);
+        if (entry)
+        {
+            CacheTouch(entry);
+            memcpy(buff, &entry->data[idx], count);
+        }
+        else
+        {
+            rv = -1;
+        }
+    }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return rv;
 }
 
 /*
- * @brief Clear the disk read-write buffer.
- *  This function is responsible for clearing the buffer used for temporary storage
-    of data read from or written to the disk. It ensures that the buffer is emptied
-    and ready for new data operations.
+ * @brief Write sector data through the sector cache.
+ *  This function updates the cached copy of a sector and writes the whole sector
+    to the disk. A partial write (a byte range smaller than the sector) is merged
+    into the cached sector first, so the callers do not need to read the sector
+    back before patching a header or a file info record.
+ * @param did 
+ * @param sector 
+ * @param buff 
+ * @param idx 
+ * @param count 
+ * @return 0 if it is successful
+ */
+int esFile_CacheWrite(uint8_t did, int sector, uint8_t *buff, int idx, int count)
+{
+    esFile_CacheEntry *entry = NULL;
+    esFile_DriveInfo *dInfos = NULL;
+    int rv = 0;
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    if (IsMetaSector(did, sector))
+    {
+        rv = MetaWrite(did, sector, buff, idx, count);
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+        return rv;
+    }
+
+    dInfos = esFile_GetDriveInfos();
+
+    // The copy of a sector is not changed while it is on its way to the disk
+    for (;;)
+    {
+        entry = CacheGet(did, sector, (idx == 0 && count >= dInfos[did].sectorCapacity) ? CACHE_CLAIM : CACHE_LOAD);
+        if (entry == NULL || !entry->busy)
+        {
+            break;
+        }
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    if (entry == NULL)
+    {
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+        return -1;
+    }
+
+    CacheTouch(entry);
+    memcpy(&entry->data[idx], buff, count);
+    entry->verified = 0;
+
+    if (cacheWriteBack)
+    {
+        if (!entry->dirty)
+        {
+            entry->dirty = 1;
+            entry->dirtySince = CacheTick();
+        }
+    }
+    else
+    {
+        entry->busy = 1;
+        CacheUnlockIo();
+        rv = esFile_DiskWrite(did, sector, entry->data, 0, dInfos[did].sectorCapacity);
+        CacheLockIo();
+        entry->busy = 0;
+        if (rv != 0)
+        {
+            // The disk does not hold what the entry holds, it must not be read back
+            entry->valid = 0;
+        }
+        esFile_LockWake(ESFILE_LOCK_SHARED);
+    }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return rv;
+}
+
+/*
+ * @brief Release a sector and drop its cached copy.
+ *  This function invalidates the cache entry of a sector, if any, and queues
+    the release of the sector on the disk. The queued sectors are merged into
+    ranges and given to the disk together, when ESFILE_DISCARD_BATCH of them
+    are waiting, when the ranges are used up, or when the drive is flushed.
+ * @param did 
+ * @param sector 
+ * @return 0 if it is successful
  */
-void esFile_ClearDiskBuffer(void)
+int esFile_CacheRelease(uint8_t did, int sector)
 {
-    memset(diskBuffer, 0, sizeof(diskBuffer));
+    esFile_CacheEntry *entry = NULL;
+    esFile_DiscardRange *range = NULL;
+    esFile_Volume *vol = &volumes[did];
+    int rv = 0, queued = 0, flush = 0;
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    while ((entry = CacheLookup(did, sector)) != NULL && (entry->loading || entry->busy))
+    {
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    if (entry)
+    {
+        entry->valid = 0;
+        entry->dirty = 0;
+    }
+
+    for (;;)
+    {
+        for (int i = 0; i < vol->discardCount && !queued; i++)
+        {
+            range = &vol->discards[i];
+            if (sector >= range->first && sector < range->first + range->count)
+            {
+                queued = 2;
+            }
+            else if (sector + 1 == range->first)
+            {
+                range->first--;
+                range->count++;
+                queued = 1;
+            }
+            else if (sector == range->first + range->count)
+            {
+                range->count++;
+                queued = 1;
+            }
+        }
+
+        if (queued || vol->discardCount < ESFILE_DISCARD_RANGES)
+        {
+            break;
+        }
+
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+        rv = esFile_CacheDiscardFlush(did);
+        esFile_Lock(ESFILE_LOCK_SHARED);
+    }
+
+    if (!queued)
+    {
+        vol->discards[vol->discardCount].first = sector;
+        vol->discards[vol->discardCount].count = 1;
+        vol->discardCount++;
+    }
+
+    flush = queued != 2 && ++vol->discardPending >= ESFILE_DISCARD_BATCH;
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+
+    if (flush)
+    {
+        rv = esFile_CacheDiscardFlush(did);
+    }
+
+    return rv;
 }
 
 /*
- * @brief Retrieve the reference to the filesystems.
- *  This function returns the reference to the filesystems
-    object, allowing access to multiple filesystem instances for various operations.
- * @return A pointer or reference to the filesystems
+ * @brief Give the queued releases of a drive to the disk.
+ *  The queue is taken over under the shared lock and given to the disk without
+    it. Until that is done the sectors of the queue can not be claimed again.
+ * @param did 
+ * @return 0 if it is successful
  */
-esFile_System *esFile_GetFileSystems(void)
+int esFile_CacheDiscardFlush(uint8_t did)
 {
-    return fs;
+    esFile_DiscardRange ranges[ESFILE_DISCARD_RANGES];
+    esFile_Volume *vol = &volumes[did];
+    int rv = 0, count = 0;
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    while (vol->discardBusy)
+    {
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    count = vol->discardCount;
+    memcpy(ranges, vol->discards, count * sizeof(esFile_DiscardRange));
+    vol->discardCount = 0;
+    vol->discardPending = 0;
+    vol->discardBusy = 1;
+
+    CacheUnlockIo();
+    for (int i = 0; i < count; i++)
+    {
+        if (esFile_DiskDiscard(did, ranges[i].first, ranges[i].count) != 0)
+        {
+            ESFILE_LOG("DiskRelease error: %s %d \n", __FILE__, __LINE__);
+            rv = -1;
+        }
+    }
+    CacheLockIo();
+
+    vol->discardBusy = 0;
+    esFile_LockWake(ESFILE_LOCK_SHARED);
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return rv;
 }
 
 /*
- * @brief Populates the sector-page map table for a specific drive.
- *  Given a drive object, this function updates the sector-page map table with the
-    appropriate mapping information for that drive. The sector-page map table is
-    used for efficient data retrieval and storage on the drive.
+ * @brief Take sectors back from the queue of releases before they are reused.
+ *  A queued release must not reach the disk after the sector is written again,
+    so the queue of the drive is flushed when it holds one of the sectors.
+ * @param did 
+ * @param sector first sector
+ * @param count 
  */
-void esFile_EvaluateSectorTable(uint8_t did)
+void esFile_CacheDiscardClaim(uint8_t did, int sector, int count)
 {
-    int sno = 0;
-    esFile_FileInfo fi;
-    esFile_DataSectorHeader dsh;
-    uint8_t temp[ESFILE_BUFFERSIZE + 1];
+    esFile_Volume *vol = &volumes[did];
+    int claimed = 0;
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    // A release that is being given to the disk has to be done first
+    while (vol->discardBusy)
+    {
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    for (int i = 0; i < vol->discardCount && !claimed; i++)
+    {
+        claimed = sector < vol->discards[i].first + vol->discards[i].count && vol->discards[i].first < sector + count;
+    }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+
+    if (claimed)
+    {
+        esFile_CacheDiscardFlush(did);
+    }
+}
+
+/*
+ * @brief Write the dirty cached sectors of a drive to the disk.
+ *  This function persists the sectors that were modified in the write-back
+    sector cache and in the pinned metadata cache. The data sectors are written
+    before the file info sectors that describe them. It must be called before
+    the power is removed, otherwise the latest changes are lost.
+ * @param did 
+ * @return 0 if it is successful
+ */
+int esFile_CacheFlush(uint8_t did)
+{
+    esFile_CacheEntry *set = cacheEntries[did % ESFILE_CACHE_SETS];
     esFile_DriveInfo *dInfos = NULL;
+    int rv = 0;
 
     dInfos = esFile_GetDriveInfos();
 
-    for (int i = 1; i < dInfos[did].fiSectorCount; i++)
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES; i++)
     {
-        if (esFile_DiskRead(did, i, esFile_GetDiskBuffer(), 0, dInfos[did].sectorCapacity) == 0)
+        if (set[i].valid && set[i].did == did && set[i].sector >= dInfos[did].fiSectorCount)
         {
-            for (int j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
+            if (CachePersist(&set[i]) != 0)
             {
-                if (esFile_GetDiskBuffer()[j * ESFILE_FILENGTH] != 0)
-                {
-                    memcpy(&fi, &esFile_GetDiskBuffer()[j * ESFILE_FILENGTH], sizeof(esFile_FileInfo));
-                    sno = fi.startSector;
-                    while (1)
-                    {
-                        if (esFile_DiskRead(did, sno, temp, 0, sizeof(esFile_DataSectorHeader)) == 0)
-                        {
-                            memcpy(&dsh, temp, sizeof(esFile_DataSectorHeader));
-                            if (dsh.uid == fi.uid)
-                            {
-                                esFile_SetSectorFlag(did, sno, 1);
-                                if (dsh.nextsector > 0)
-                                    sno = dsh.nextsector;
-                                else
-                                    break;
-                            }
-                            else
-                            {
-                                ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
-                                break;
-                            }
-                        }
-                        else
-                        {
-                            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-                            break;
-                        }
-                    }
-                }
+                rv = -1;
             }
         }
-        else
+    }
+
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES; i++)
+    {
+        if (set[i].valid && set[i].did == did)
         {
-            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-            break;
+            if (CachePersist(&set[i]) != 0)
+            {
+                rv = -1;
+            }
+        }
+    }
+
+    for (int i = 1; i < dInfos[did].fiSectorCount && (volumes[did].metaDirty | volumes[did].metaBusy); i++)
+    {
+        if (MetaPersist(did, i) != 0)
+        {
+            rv = -1;
         }
     }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+
+    if (esFile_WearStore(did) != 0 || esFile_CacheDiscardFlush(did) != 0)
+    {
+        rv = -1;
+    }
+
+    return rv;
 }
 
 /*
- * @brief Set the usage flag of a sector to mark it as used or unused.
- *  This function allows you to set the usage flag of a specific sector to mark it
-    as used (True) or unused (False). This flag helps track the status of sectors
-    for efficient data management.
- * @param did
- * @param sno
- * @param used
+ * @brief Enable or disable the write-back mode of the sector cache.
+ *  In write-back mode the modified sectors stay in RAM until they are evicted,
+    flushed by esFile_Sync or aged out by esFile_CacheService. Disabling the
+    mode writes all pending changes to the disks.
+ * @param enable 
  */
-void esFile_SetSectorFlag(int did, int sno, int used)
+void esFile_CacheSetWriteBack(uint8_t enable)
 {
-    if (did)
-    {
-        if (used)
-            simSectorTable[sno / 8] |= 1 << sno % 8;
-        else
-            simSectorTable[sno / 8] &= ~(1 << sno % 8);
-    }
-    else
+    esFile_Lock(ESFILE_LOCK_SHARED);
+    cacheWriteBack = enable;
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+
+    if (!enable)
     {
-        if (used)
-            nandSectorTable[sno / 8] |= 1 << sno % 8;
-        else
-            nandSectorTable[sno / 8] &= ~(1 << sno % 8);
+        for (int i = 0; i < esFile_GetDriveCount(); i++)
+        {
+            esFile_CacheFlush(i);
+        }
     }
 }
 
 /*
- * @brief Check the usage flag of a sector to determine if it is marked as used.
- *  This function allows you to check the usage flag of a specific sector to
-    determine whether it is marked as used (1) or unused (0). This flag
-    helps track the status of sectors for efficient data management.
- * @param did
- * @param sno
- * @return 1 if the sector is marked as used, 0 if it is unused (int)
+ * @brief Flush the cached changes that are older than the dirty age limit.
+ *  This function is meant to be called periodically, e.g. from a timer task.
+    A drive whose oldest pending change is older than ESFILE_CACHE_DIRTY_MS
+    milliseconds is flushed as a whole, however often the function is called.
+    The queued releases are given to the disks.
+ * @return 0 if it is successful
  */
-int esFile_GetSectorFlag(int did, int sno)
+int esFile_CacheService(void)
 {
-    if (did)
-        return simSectorTable[sno / 8] & (1 << sno % 8);
-    else
-        return nandSectorTable[sno / 8] & (1 << sno % 8);
+    uint32_t now = 0;
+    int rv = 0, expired = 0, discard = 0;
+
+    for (int did = 0; did < esFile_GetDriveCount(); did++)
+    {
+        esFile_CacheEntry *set = cacheEntries[did % ESFILE_CACHE_SETS];
+
+        esFile_Lock(ESFILE_LOCK_SHARED);
+
+        now = CacheTick();
+        expired = volumes[did].metaDirty && (now - volumes[did].metaDirtySince) >= ESFILE_CACHE_DIRTY_MS;
+        for (int i = 0; i < ESFILE_CACHE_ENTRIES && !expired; i++)
+        {
+            if (set[i].valid && set[i].dirty && set[i].did == did &&
+                (now - set[i].dirtySince) >= ESFILE_CACHE_DIRTY_MS)
+            {
+                expired = 1;
+            }
+        }
+        discard = volumes[did].discardCount != 0;
+
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+
+        if (expired && esFile_CacheFlush(did) != 0)
+        {
+            rv = -1;
+        }
+        else if (!expired && discard && esFile_CacheDiscardFlush(did) != 0)
+        {
+            rv = -1;
+        }
+    }
+
+    return rv;
 }
 
 /*
- * @brief Evaluate the number of used files and the latest unique ID associated with a file.
- *  This function performs an evaluation to determine the count of used files and the latest unique ID associated with a file. It stores valuable
-    information about the state of the file system to the cache.
- * @param did
+ * @brief Read a whole sector without allocating a cache entry.
+ *  This function copies the sector from its cache entry when it is cached and
+    reads it from the disk straight into the caller's buffer otherwise. It is
+    used by bulk transfers that would only evict the working set.
+ * @param did 
+ * @param sector 
+ * @param buff 
+ * @return 0 if it is successful
  */
-void esFile_CalculateFileCountAndUid(uint8_t did)
+int esFile_CacheReadSector(uint8_t did, int sector, uint8_t *buff)
 {
+    esFile_CacheEntry *entry = NULL;
     esFile_DriveInfo *dInfos = NULL;
-    esFile_FileInfo fi;
-    int i, j;
+    int rv = 0;
 
     dInfos = esFile_GetDriveInfos();
 
-    fs[did].filecount = 0;
-    fs[did].lastuid = 0;
+    esFile_Lock(ESFILE_LOCK_SHARED);
 
-    for (i = 1; i < dInfos[did].fiSectorCount; i++)
+    if (IsMetaSector(did, sector))
+    {
+        rv = MetaRead(did, sector, buff, 0, dInfos[did].sectorCapacity);
+    }
+    else
     {
-        if (esFile_DiskRead(did, i, esFile_GetDiskBuffer(), 0, dInfos[did].sectorCapacity) == 0)
+        while ((entry = CacheLookup(did, sector)) != NULL && entry->loading)
         {
-            for (j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
-            {
-                if (esFile_GetDiskBuffer()[j * ESFILE_FILENGTH] != 0)
-                {
-                    fs[did].filecount++;
-                    memcpy(&fi, &esFile_GetDiskBuffer()[j * ESFILE_FILENGTH], sizeof(esFile_FileInfo));
-                    if (fi.uid > fs[did].lastuid)
-                        fs[did].lastuid = fi.uid;
-                }
-            }
+            esFile_LockWait(ESFILE_LOCK_SHARED);
+        }
+
+        if (entry)
+        {
+            cacheStats.readHits++;
+            CacheTouch(entry);
+            memcpy(buff, entry->data, dInfos[did].sectorCapacity);
         }
         else
         {
-            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            cacheStats.readMisses++;
+            CacheUnlockIo();
+            rv = esFile_DiskRead(did, sector, buff, 0, dInfos[did].sectorCapacity);
+            CacheLockIo();
+        }
+    }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return rv;
+}
+
+/*
+ * @brief Check the payload of a cached sector against its header checksum.
+ *  The sector is brought into the cache and its copy is kept from changing
+    while the checksum is computed without the shared lock. The result is kept
+    until the sector is modified or leaves the cache, so the payload of a
+    sector is only verified once while it is being read in pieces. A sector
+    without a checksum passes.
+ * @param did 
+ * @param sector 
+ * @return 0 if the payload matches
+ */
+int esFile_CacheVerify(uint8_t did, int sector)
+{
+    esFile_CacheEntry *entry = NULL;
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t len = 0, rfu = 0;
+    int rv = 0, match = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    len = dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    for (;;)
+    {
+        entry = CacheGet(did, sector, CACHE_LOAD);
+        if (entry == NULL || entry->verified || !entry->busy)
+        {
             break;
         }
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    if (entry == NULL)
+    {
+        rv = -1;
     }
+    else if (!entry->verified)
+    {
+        entry->busy = 1;
+        CacheUnlockIo();
+        rfu = ((esFile_DataSectorHeader *)entry->data)->rfu;
+        match = rfu == 0 || esFile_PayloadChecksum(&entry->data[sizeof(esFile_DataSectorHeader)], len) == rfu;
+        CacheLockIo();
+        entry->busy = 0;
+        if (match)
+            entry->verified = 1;
+        else
+            rv = -1;
+        esFile_LockWake(ESFILE_LOCK_SHARED);
+    }
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return rv;
+}
+
+/*
+ * @brief Retrieve the sector cache statistics.
+ * @param stats 
+ */
+void esFile_GetCacheStats(esFile_CacheStats *stats)
+{
+    if (stats)
+    {
+        esFile_Lock(ESFILE_LOCK_SHARED);
+        memcpy(stats, &cacheStats, sizeof(esFile_CacheStats));
+        esFile_Unlock(ESFILE_LOCK_SHARED);
+    }
+}
+
+/*
+ * @brief Reset the sector cache statistics.
+ */
+void esFile_ResetCacheStats(void)
+{
+    esFile_Lock(ESFILE_LOCK_SHARED);
+    memset(&cacheStats, 0, sizeof(cacheStats));
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+}
+
+/*
+ * @brief Retrieve the disk read-write buffer.
+ *  This function returns the buffer used for reading and writing data to/from the
+    disk. Each drive has its own buffer, so it is only used under the lock of
+    the drive, unless the interrupts are the lock and a single buffer is shared.
+ * @param did 
+ * @return The disk read-write buffer
+ */
+uint8_t *esFile_GetDiskBuffer(uint8_t did)
+{
+    return (uint8_t *)diskBuffers[did % ESFILE_DISK_BUFFERS];
+}
+
+/*
+ * @brief Clear the disk read-write buffer.
+ *  This function is responsible for clearing the buffer used for temporary storage
+    of data read from or written to the disk. It ensures that the buffer is emptied
+    and ready for new data operations.
+ * @param did 
+ */
+void esFile_ClearDiskBuffer(uint8_t did)
+{
+    memset(esFile_GetDiskBuffer(did), 0, sizeof(diskBuffers[0]));
+}
+
+/*
+ * @brief Retrieve the reference to the volumes.
+ *  This function returns the run-time context of the drives, indexed by the
+    drive ID: the file system header, the options and the state of the metadata
+    cache. All the state of a mounted drive is kept in its volume and its own
+    set of sector cache entries, so the operations on different drives only
+    share the shared lock for their bookkeeping. The
+    options are kept across esFile_Init calls, so they can be set before
+    mounting.
+ * @return A pointer or reference to the volumes
+ */
+esFile_Volume *esFile_GetVolumes(void)
+{
+    return volumes;
+}
+
+/*
+ * @brief Populates the sector-page map table for a specific drive.
+ *  Given a drive object, this function updates the sector-page map table with the
+    appropriate mapping information for that drive. The sector-page map table is
+    used for efficient data retrieval and storage on the drive.
+ */
+void esFile_EvaluateSectorTable(uint8_t did)
+{
+    esFile_ScanCursor cursor;
+    uint32_t budget = UINT32_MAX;
+
+    memset(&cursor, 0, sizeof(cursor));
+    esFile_EvaluateSectorTableStep(did, &cursor, &budget);
+}
+
+/*
+ * @brief Run a step of the evaluation of the sector table of a drive.
+ *  The file infos are scanned in order and the chain of every file is walked
+    to mark its sectors as used. The cursor keeps the position of the scan
+    between the steps, down to the sector of the chain being walked. Every
+    data sector header and every file info sector read costs one unit of the
+    budget.
+ * @param did 
+ * @param cursor position of the scan, zeroed before the first step
+ * @param budget number of sectors that may be read, decreased by the step
+ * @return 1 if the scan is not finished, 0 if it is, negative on error
+ */
+int esFile_EvaluateSectorTableStep(uint8_t did, esFile_ScanCursor *cursor, uint32_t *budget)
+{
+    esFile_FileInfo fi;
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+
+    if (cursor->infoSector == 0)
+    {
+        cursor->infoSector = 1;
+    }
+
+    while (cursor->infoSector < dInfos[did].fiSectorCount)
+    {
+        if (*budget == 0)
+        {
+            return 1;
+        }
+
+        if (cursor->sno == 0)
+        {
+            if (cursor->slot >= dInfos[did].sectorCapacity / ESFILE_FILENGTH)
+            {
+                cursor->infoSector++;
+                cursor->slot = 0;
+                continue;
+            }
+
+            if (cursor->slot == 0)
+            {
+                (*budget)--;
+            }
+
+            if (esFile_CacheRead(did, cursor->infoSector, (uint8_t *)&fi, cursor->slot * ESFILE_FILENGTH, sizeof(esFile_FileInfo)) != 0)
+            {
+                ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+                return -3;
+            }
+            cursor->slot++;
+
+            if (fi.name[0] != 0)
+            {
+                if (fi.flags & ESFILE_FLAG_PACKED)
+                {
+                    if (esFile_PackMount(did, &fi) != 0)
+                    {
+                        return -3;
+                    }
+                }
+                else
+                {
+                    cursor->sno = fi.startSector;
+                    cursor->uid = fi.uid;
+                }
+            }
+            continue;
+        }
+
+        (*budget)--;
+        if (esFile_CacheRead(did, cursor->sno, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) != 0)
+        {
+            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            cursor->sno = 0;
+        }
+        else if (dsh.uid != cursor->uid)
+        {
+            ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+            cursor->sno = 0;
+        }
+        else
+        {
+            esFile_SetSectorFlag(did, cursor->sno, 1);
+            esFile_SetChainLink(did, cursor->sno, dsh.nextsector);
+            cursor->sno = dsh.nextsector;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Set the usage flag of a sector to mark it as used or unused.
+ *  This function allows you to set the usage flag of a specific sector to mark it
+    as used (True) or unused (False). This flag helps track the status of sectors
+    for efficient data management.
+ * @param did
+ * @param sno
+ * @param used
+ */
+void esFile_SetSectorFlag(int did, int sno, int used)
+{
+    uint32_t *table = esFile_GetDriveInfos()[did].sectorTable;
+    uint32_t mask = 1u << sno % 32;
+
+    // The counters follow the transitions, a sector set twice is counted once
+    if (used && !(table[sno / 32] & mask))
+    {
+        table[sno / 32] |= mask;
+        volumes[did].usedSectors++;
+    }
+    else if (!used && (table[sno / 32] & mask))
+    {
+        table[sno / 32] &= ~mask;
+        volumes[did].usedSectors--;
+        volumes[did].releasedSectors++;
+    }
+}
+
+/*
+ * @brief Check the usage flag of a sector to determine if it is marked as used.
+ *  This function allows you to check the usage flag of a specific sector to
+    determine whether it is marked as used (1) or unused (0). This flag
+    helps track the status of sectors for efficient data management.
+ * @param did
+ * @param sno
+ * @return 1 if the sector is marked as used, 0 if it is unused (int)
+ */
+int esFile_GetSectorFlag(int did, int sno)
+{
+    return (esFile_GetDriveInfos()[did].sectorTable[sno / 32] >> sno % 32) & 1;
+}
+
+/*
+ * @brief Store the next sector link of a sector in the RAM chain table.
+ *  The chain table mirrors the nextsector field of the data sector headers so
+    that chains can be traversed without reading the headers from the disk. It
+    is only maintained for the drives that provide one.
+ * @param did 
+ * @param sno 
+ * @param next 
+ */
+void esFile_SetChainLink(uint8_t did, int sno, uint16_t next)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+    if (dInfos[did].chainTable && sno < dInfos[did].dataSectorEnd)
+    {
+        dInfos[did].chainTable[sno] = next;
+    }
+}
+
+/*
+ * @brief Retrieve the next sector link of a sector from the RAM chain table.
+ * @param did 
+ * @param sno 
+ * @return The next sector, 0 at the end of the chain or -1 if the drive has no chain table (int)
+ */
+int esFile_GetChainLink(uint8_t did, int sno)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+    if (dInfos[did].chainTable && sno < dInfos[did].dataSectorEnd)
+    {
+        return dInfos[did].chainTable[sno];
+    }
+
+    return -1;
+}
+
+/*
+ * @brief Evaluate the number of used files and the latest unique ID associated with a file.
+ *  This function performs an evaluation to determine the count of used files and the latest unique ID associated with a file. It stores valuable
+    information about the state of the file system to the cache.
+ * @param did
+ */
+void esFile_CalculateFileCountAndUid(uint8_t did)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    int i, j;
+
+    dInfos = esFile_GetDriveInfos();
+
+    volumes[did].fs.filecount = 0;
+    volumes[did].fs.lastuid = 0;
+
+    for (i = 1; i < dInfos[did].fiSectorCount; i++)
+    {
+        if (esFile_CacheRead(did, i, esFile_GetDiskBuffer(did), 0, dInfos[did].sectorCapacity) == 0)
+        {
+            for (j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
+            {
+                if (esFile_GetDiskBuffer(did)[j * ESFILE_FILENGTH] != 0)
+                {
+                    volumes[did].fs.filecount++;
+                    memcpy(&fi, &esFile_GetDiskBuffer(did)[j * ESFILE_FILENGTH], sizeof(esFile_FileInfo));
+                    if (fi.uid > volumes[did].fs.lastuid)
+                        volumes[did].fs.lastuid = fi.uid;
+                }
+            }
+        }
+        else
+        {
+            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            break;
+        }
+    }
+}
+
+/*
+ * @brief Check if a sector is held by the pinned metadata cache.
+ * @param did 
+ * @param sector 
+ * @return 1 if the sector is a pinned file info sector
+ */
+static int IsMetaSector(uint8_t did, int sector)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+
+    return dInfos[did].metaPolicy != ESFILE_META_NONE && dInfos[did].metaCache &&
+           sector >= 1 && sector < dInfos[did].fiSectorCount;
+}
+
+/*
+ * @brief Bring a file info sector into the pinned metadata cache.
+ *  The sector is fetched from the disk only on its first access, afterwards it
+    stays resident in RAM. The shared lock is released during the read and the
+    other tasks wait for the sector until it is loaded.
+ * @param did 
+ * @param sector 
+ * @param mode CACHE_READ to count the access in the statistics, CACHE_LOAD otherwise
+ * @return 0 if it is successful
+ */
+static int MetaLoad(uint8_t did, int sector, int mode)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vol = &volumes[did];
+    uint32_t bit = 1UL << (sector - 1);
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    while (vol->metaLoading & bit)
+    {
+        esFile_LockWait(ESFILE_LOCK_SHARED);
+    }
+
+    if (vol->metaValid & bit)
+    {
+        if (mode == CACHE_READ)
+            cacheStats.readHits++;
+        return 0;
+    }
+
+    if (mode == CACHE_READ)
+        cacheStats.readMisses++;
+
+    vol->metaLoading |= bit;
+    CacheUnlockIo();
+    rv = esFile_DiskRead(did, sector, &dInfos[did].metaCache[(sector - 1) * dInfos[did].sectorCapacity], 0, dInfos[did].sectorCapacity);
+    CacheLockIo();
+    vol->metaLoading &= ~bit;
+    if (rv == 0)
+    {
+        vol->metaValid |= bit;
+    }
+    esFile_LockWake(ESFILE_LOCK_SHARED);
+
+    return rv == 0 ? 0 : -1;
+}
+
+/*
+ * @brief Read a file info sector from the pinned metadata cache.
+ * @param did 
+ * @param sector 
+ * @param buff 
+ * @param idx 
+ * @param count 
+ * @return 0 if it is successful
+ */
+static int MetaRead(uint8_t did, int sector, uint8_t *buff, int idx, int count)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+
+    if (MetaLoad(did, sector, CACHE_READ) != 0)
+    {
+        return -1;
+    }
+
+    memcpy(buff, &dInfos[did].metaCache[(sector - 1) * dInfos[did].sectorCapacity + idx], count);
+    return 0;
+}
+
+/*
+ * @brief Write a file info sector through the pinned metadata cache.
+ *  A write-through drive programs the sector immediately, a write-back drive
+    only marks it dirty until esFile_CacheFlush is called. While the sector cache
+    is in write-back mode the file info sectors are deferred as well, so they
+    never reach the disk before the data they describe.
+ * @param did 
+ * @param sector 
+ * @param buff 
+ * @param idx 
+ * @param count 
+ * @return 0 if it is successful
+ */
+static int MetaWrite(uint8_t did, int sector, uint8_t *buff, int idx, int count)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vol = &volumes[did];
+    uint32_t bit = 1UL << (sector - 1);
+    uint8_t *data = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+    data = &dInfos[did].metaCache[(sector - 1) * dInfos[did].sectorCapacity];
+
+    // The copy is not changed while it is read from or written to the disk
+    for (;;)
+    {
+        if ((vol->metaLoading | vol->metaBusy) & bit)
+        {
+            esFile_LockWait(ESFILE_LOCK_SHARED);
+        }
+        else if (!(vol->metaValid & bit) && (idx != 0 || count < dInfos[did].sectorCapacity))
+        {
+            if (MetaLoad(did, sector, CACHE_LOAD) != 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    memcpy(&data[idx], buff, count);
+    vol->metaValid |= bit;
+
+    if (!vol->metaDirty)
+    {
+        vol->metaDirtySince = CacheTick();
+    }
+    vol->metaDirty |= bit;
+
+    if (dInfos[did].metaPolicy == ESFILE_META_WRITEBACK || cacheWriteBack)
+    {
+        return 0;
+    }
+
+    if (MetaPersist(did, sector) != 0)
+    {
+        vol->metaValid &= ~bit;
+        vol->metaDirty &= ~bit;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Write a dirty file info sector of the pinned metadata cache to the disk.
+ *  The sector is marked busy and written without the shared lock. A write of
+    the sector that is already on its way is waited for, so the sector is on
+    the disk when the function returns.
+ * @param did 
+ * @param sector 
+ * @return 0 if it is successful
+ */
+static int MetaPersist(uint8_t did, int sector)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vol = &volumes[did];
+    uint32_t bit = 1UL << (sector - 1);
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    while ((vol->metaDirty | vol->metaBusy) & bit)
+    {
+        if (vol->metaBusy & bit)
+        {
+            esFile_LockWait(ESFILE_LOCK_SHARED);
+            continue;
+        }
+
+        vol->metaBusy |= bit;
+        vol->metaDirty &= ~bit;
+        CacheUnlockIo();
+        rv = esFile_DiskWrite(did, sector, &dInfos[did].metaCache[(sector - 1) * dInfos[did].sectorCapacity], 0, dInfos[did].sectorCapacity);
+        CacheLockIo();
+        vol->metaBusy &= ~bit;
+        esFile_LockWake(ESFILE_LOCK_SHARED);
+
+        if (rv != 0)
+        {
+            ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
+            vol->metaDirty |= bit;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Find the cache entry holding a sector.
+ * @param did 
+ * @param sector 
+ * @return The cache entry or NULL if the sector is not cached
+ */
+static esFile_CacheEntry *CacheLookup(uint8_t did, int sector)
+{
+    esFile_CacheEntry *set = cacheEntries[did % ESFILE_CACHE_SETS];
+
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES; i++)
+    {
+        if (set[i].valid && set[i].did == did && set[i].sector == sector)
+        {
+            return &set[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Find the cache entry of a sector or bring the sector into the cache.
+ *  On a miss the least recently used entry is claimed, after its pending
+    change is written back. The claimed entry is filled from the disk without
+    the shared lock, marked as loading, so the other tasks wait for it instead
+    of reading the sector a second time.
+ * @param did 
+ * @param sector 
+ * @param mode CACHE_READ to count the access in the statistics, CACHE_LOAD to
+    load the sector silently, CACHE_CLAIM to only claim the entry of a sector
+    that is about to be overwritten as a whole
+ * @return The cache entry or NULL if the disk access fails
+ */
+static esFile_CacheEntry *CacheGet(uint8_t did, int sector, int mode)
+{
+    esFile_CacheEntry *entry = NULL;
+    esFile_DriveInfo *dInfos = NULL;
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    for (;;)
+    {
+        entry = CacheLookup(did, sector);
+        if (entry && !entry->loading)
+        {
+            if (mode == CACHE_READ)
+                cacheStats.readHits++;
+            return entry;
+        }
+
+        if (entry == NULL)
+        {
+            entry = CacheVictim(did);
+        }
+
+        if (entry == NULL || entry->loading)
+        {
+            esFile_LockWait(ESFILE_LOCK_SHARED);
+        }
+        else if (entry->valid && entry->dirty)
+        {
+            if (CachePersist(entry) != 0)
+            {
+                return NULL;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (mode == CACHE_READ)
+        cacheStats.readMisses++;
+
+    entry->did = did;
+    entry->sector = sector;
+    entry->valid = 1;
+    entry->dirty = 0;
+    entry->verified = 0;
+    CacheTouch(entry);
+
+    if (mode == CACHE_CLAIM)
+    {
+        return entry;
+    }
+
+    entry->loading = 1;
+    CacheUnlockIo();
+    rv = esFile_DiskRead(did, sector, entry->data, 0, dInfos[did].sectorCapacity);
+    CacheLockIo();
+    entry->loading = 0;
+    if (rv != 0)
+    {
+        entry->valid = 0;
+    }
+    esFile_LockWake(ESFILE_LOCK_SHARED);
+
+    return rv == 0 ? entry : NULL;
+}
+
+/*
+ * @brief Pick the cache entry to be reused for another sector.
+ *  A free entry of the set of the drive is taken first, otherwise the least
+    recently used one. The entries that are being read or written are skipped.
+ * @param did 
+ * @return The cache entry or NULL if all entries are in use
+ */
+static esFile_CacheEntry *CacheVictim(uint8_t did)
+{
+    esFile_CacheEntry *set = cacheEntries[did % ESFILE_CACHE_SETS];
+    esFile_CacheEntry *entry = NULL;
+
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES; i++)
+    {
+        if (set[i].loading || set[i].busy)
+        {
+            continue;
+        }
+
+        if (!set[i].valid)
+        {
+            return &set[i];
+        }
+
+        if (entry == NULL || set[i].stamp < entry->stamp)
+        {
+            entry = &set[i];
+        }
+    }
+
+    return entry;
+}
+
+/*
+ * @brief Mark a cache entry as the most recently used one.
+ * @param entry 
+ */
+static void CacheTouch(esFile_CacheEntry *entry)
+{
+    if (++cacheClock == 0)
+    {
+        for (int i = 0; i < ESFILE_CACHE_SETS; i++)
+        {
+            for (int j = 0; j < ESFILE_CACHE_ENTRIES; j++)
+            {
+                cacheEntries[i][j].stamp = 0;
+            }
+        }
+        cacheClock = 1;
+    }
+
+    entry->stamp = cacheClock;
+}
+
+/*
+ * @brief Write a dirty cache entry back to the disk.
+ *  Every dirty entry that has to reach the disk before this one is written
+    first, starting from the end of the dependencies. The walk is bounded by
+    the number of entries, so a damaged chain linking back to the entry can
+    not loop forever: the entry where it stops is written and the loop is
+    broken. A write of the entry that is already on its way is waited for.
+ * @param entry 
+ * @return 0 if it is successful
+ */
+static int CachePersist(esFile_CacheEntry *entry)
+{
+    esFile_CacheEntry *target = NULL, *prior = NULL;
+    uint8_t did = entry->did;
+    uint16_t sector = entry->sector;
+
+    while (entry->valid && entry->did == did && entry->sector == sector && (entry->dirty || entry->busy))
+    {
+        target = entry;
+        for (int i = 0; i < ESFILE_CACHE_ENTRIES && (prior = CachePrior(target)) != NULL; i++)
+        {
+            target = prior;
+        }
+
+        if (target->busy)
+        {
+            esFile_LockWait(ESFILE_LOCK_SHARED);
+        }
+        else if (CacheWriteOne(target) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Write a single dirty cache entry to the disk.
+ *  The entry is marked busy and written without the shared lock, its copy
+    is not changed or reused meanwhile.
+ * @param entry 
+ * @return 0 if it is successful
+ */
+static int CacheWriteOne(esFile_CacheEntry *entry)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    entry->busy = 1;
+    entry->dirty = 0;
+    CacheUnlockIo();
+    rv = esFile_DiskWrite(entry->did, entry->sector, entry->data, 0, dInfos[entry->did].sectorCapacity);
+    CacheLockIo();
+    entry->busy = 0;
+
+    if (rv != 0)
+    {
+        ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
+        entry->dirty = 1;
+    }
+    else
+    {
+        cacheStats.writeBacks++;
+    }
+    esFile_LockWake(ESFILE_LOCK_SHARED);
+
+    return rv == 0 ? 0 : -1;
+}
+
+/*
+ * @brief Find a dirty entry that must be persisted before an entry.
+ *  A data sector has to be on the disk before the sector whose header links
+    it into a chain, and the file info sectors only after all data sectors of
+    the drive, since their sizes describe the data. An entry that is being
+    written counts until it is done. The other dirty entries do not depend on
+    each other and stay in the cache.
+ * @param entry 
+ * @return The dirty entry to write first or NULL if there is none
+ */
+static esFile_CacheEntry *CachePrior(esFile_CacheEntry *entry)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    int isMeta = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    isMeta = entry->sector < dInfos[entry->did].fiSectorCount;
+    memcpy(&dsh, entry->data, sizeof(esFile_DataSectorHeader));
+
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES; i++)
+    {
+        esFile_CacheEntry *e = &cacheEntries[entry->did % ESFILE_CACHE_SETS][i];
+
+        if (e == entry || !e->valid || !(e->dirty || e->busy) || e->did != entry->did ||
+            e->sector < dInfos[e->did].fiSectorCount)
+        {
+            continue;
+        }
+
+        if (isMeta || dsh.nextsector == e->sector)
+        {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Release the shared lock around a device access.
+ *  When the interrupts are the lock the access stays in the critical section,
+    nothing else could run meanwhile anyway.
+ */
+static void CacheUnlockIo(void)
+{
+#if ESFILE_LOCK != ESFILE_LOCK_INTERRUPTS
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+#endif
+}
+
+/*
+ * @brief Take the shared lock again after a device access.
+ */
+static void CacheLockIo(void)
+{
+#if ESFILE_LOCK != ESFILE_LOCK_INTERRUPTS
+    esFile_Lock(ESFILE_LOCK_SHARED);
+#endif
+}
+
+/*
+ * @brief Read the time used to age the dirty cache entries.
+ *  A port provides it with TickGetMs, a host build uses the monotonic clock.
+ * @return The time in milliseconds
+ */
+static uint32_t CacheTick(void)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    return TickGetMs();
+#endif
 }
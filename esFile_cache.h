@@ -18,14 +18,42 @@
 #ifndef ESFILE_CACHE_H__
 #define ESFILE_CACHE_H__
 
+typedef struct {
+    uint32_t readHits;
+    uint32_t readMisses;
+    uint32_t writeBacks;
+} esFile_CacheStats;
+
+typedef struct {
+    uint16_t infoSector;
+    uint16_t slot;
+    uint16_t sno;
+    uint32_t uid;
+} esFile_ScanCursor;
+
 void esFile_CacheInit(void);
-uint8_t *esFile_GetDiskBuffer(void);
-void esFile_ClearDiskBuffer(void);
-esFile_System *esFile_GetFileSystems(void);
+int esFile_CacheRead(uint8_t did, int sector, uint8_t *buff, int idx, int count);
+int esFile_CacheWrite(uint8_t did, int sector, uint8_t *buff, int idx, int count);
+int esFile_CacheReadSector(uint8_t did, int sector, uint8_t *buff);
+int esFile_CacheRelease(uint8_t did, int sector);
+int esFile_CacheDiscardFlush(uint8_t did);
+void esFile_CacheDiscardClaim(uint8_t did, int sector, int count);
+int esFile_CacheFlush(uint8_t did);
+void esFile_CacheSetWriteBack(uint8_t enable);
+int esFile_CacheService(void);
+int esFile_CacheVerify(uint8_t did, int sector);
+void esFile_GetCacheStats(esFile_CacheStats *stats);
+void esFile_ResetCacheStats(void);
+uint8_t *esFile_GetDiskBuffer(uint8_t did);
+void esFile_ClearDiskBuffer(uint8_t did);
+esFile_Volume *esFile_GetVolumes(void);
 
 void esFile_EvaluateSectorTable(uint8_t did);
+int esFile_EvaluateSectorTableStep(uint8_t did, esFile_ScanCursor *cursor, uint32_t *budget);
 void esFile_SetSectorFlag(int did, int sno, int used);
 int esFile_GetSectorFlag(int did, int sno);
+void esFile_SetChainLink(uint8_t did, int sno, uint16_t next);
+int esFile_GetChainLink(uint8_t did, int sno);
 
 void esFile_CalculateFileCountAndUid(uint8_t did);
 
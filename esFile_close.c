@@ -18,12 +18,15 @@
 #include "esFile_definitions.h"
 #include "esFile_system.h"
 #include "esFile_open.h"
+#include "esFile_lock.h"
+#include "esFile_write.h"
 #include "esFile_close.h"
 
 /*
  * @brief Close the currently open file.
  *  This function closes the file that is currently open for reading or writing.
     It ensures that all changes are saved and the file resources are released.
+    The sector the file was last written in is sealed with its checksum.
  * @param fp 
  * @return 0 if it is successfull 
  */
@@ -34,5 +37,9 @@ int esFile_Close(esFile_FileDescriptor *fp)
         return -1;
     }
 
+    esFile_Lock(fp->did);
+    esFile_SealFlush(fp->did, fp->uid);
+    esFile_Unlock(fp->did);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,694 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFtl.h"
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_disk.h"
+#include "esFile_open.h"
+#include "esFile_cryption.h"
+#include "esFile_crc.h"
+#include "esFile_compress.h"
+
+/*
+ * The payload of every data sector of a compressed file holds one independent
+ * frame: the raw (uncompressed) length and the compressed length as 16-bit
+ * little endian values followed by the LZ tokens. A token byte below 0x80 is a
+ * run of (byte + 1) literals; otherwise it is a match of ((byte & 0x7F) + 3)
+ * bytes at the 16-bit distance that follows it.
+ *
+ * For a compressed file the sectorIndex of the descriptor is the raw offset
+ * within the current sector and block is the ordinal of the sector in the file.
+ * A sector that starts at or beyond the file size has an empty frame.
+ */
+
+#define FRAME_HEADER                        4
+#define LZ_MIN_MATCH                        3
+#define LZ_MAX_MATCH                        (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS                     0x80
+#define LZ_HASHSIZE                         (1 << ESFILE_COMPRESS_HASHBITS)
+
+#if ESFILE_COMPRESS_RAWSIZE >= 0xFFFF
+#error "ESFILE_COMPRESS_RAWSIZE must be less than 65535"
+#endif
+
+#if ESFILE_COMPRESS_SETS < 1 || ESFILE_COMPRESS_SETS > ESFILE_MAX_DRIVES
+#error "ESFILE_COMPRESS_SETS must be between 1 and ESFILE_MAX_DRIVES"
+#endif
+
+typedef struct {
+    uint8_t rawBuffer[ESFILE_COMPRESS_RAWSIZE];
+    uint32_t frameBuffer[ESFILE_BUFFERSIZE / 4];
+    uint16_t hashTable[LZ_HASHSIZE];
+    uint8_t rawValid;
+    uint8_t rawDid;
+    uint16_t rawSector;
+    uint32_t rawUid;
+    uint16_t rawLength;
+} esFile_CompressState;
+
+static esFile_CompressState compressStates[ESFILE_COMPRESS_SETS];
+
+static esFile_CompressState *CompressState(uint8_t did);
+static int LoadFrame(esFile_FileDescriptor *fp, uint32_t base, uint8_t *sector);
+static int FrameLength(esFile_FileDescriptor *fp, uint32_t base);
+static int AppendFrame(esFile_FileDescriptor *fp, uint8_t *sector, const uint8_t *data, uint32_t len);
+static uint32_t LzCompress(uint16_t *hashTable, const uint8_t *src, uint32_t start, uint32_t end, uint8_t *dst, uint32_t *out, uint32_t cap);
+static int LzEmitLiterals(const uint8_t *src, uint32_t *lit, uint32_t to, uint8_t *dst, uint32_t *out, uint32_t cap);
+static int LzDecompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen);
+static uint32_t LzHash(const uint8_t *p);
+
+/*
+ * @brief Forget the decompressed sector kept in memory.
+ *  It is called when the drives are mounted, since the file uids of a drive
+    start over after a format.
+ */
+void esFile_CompressInit(void)
+{
+    for (int i = 0; i < ESFILE_COMPRESS_SETS; i++)
+    {
+        compressStates[i].rawValid = 0;
+    }
+}
+
+/*
+ * @brief Read data from a compressed file.
+ *  The frame of the current sector is decompressed once and kept in memory, so
+    sequential reads in small pieces decompress every sector only once. Every
+    drive has its own copy, used under the compression lock of the drive, so
+    compressed files of different drives are read and written in parallel.
+    When the interrupts are the lock, or ESFILE_COMPRESS_SETS is lowered to
+    save RAM, the drives share it.
+ * @param fp 
+ * @param buff 
+ * @param btr 
+ * @param br 
+ * @return 0 if it is successful
+ */
+int esFile_CompressedRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br)
+{
+    uint8_t *tmpBuff = NULL;
+    uint32_t idx = 0, chunk = 0;
+    esFile_CompressState *st = NULL;
+    int rv = 0, next = 0;
+
+    esFile_Lock(ESFILE_LOCK_COMPRESS(fp->did));
+
+    st = CompressState(fp->did);
+    tmpBuff = (uint8_t *)buff;
+    while ((btr > 0) && (fp->index < fp->size))
+    {
+        rv = LoadFrame(fp, fp->index - fp->sectorIndex, NULL);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        if (fp->sectorIndex >= st->rawLength)
+        {
+            next = esFile_GetNextSector(fp->did, fp->currentSector);
+            if (next <= 0)
+            {
+                ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+                rv = -2;
+                break;
+            }
+
+            fp->currentSector = next;
+            fp->sectorIndex = 0;
+            fp->block++;
+            continue;
+        }
+
+        chunk = st->rawLength - fp->sectorIndex;
+        if (chunk > btr)
+            chunk = btr;
+        if (chunk > fp->size - fp->index)
+            chunk = fp->size - fp->index;
+
+        if (tmpBuff)
+            memcpy(&tmpBuff[idx], &st->rawBuffer[fp->sectorIndex], chunk);
+
+        fp->sectorIndex += chunk;
+        fp->index += chunk;
+        idx += chunk;
+        btr -= chunk;
+    }
+
+    if (br)
+        *br = idx;
+
+    esFile_Unlock(ESFILE_LOCK_COMPRESS(fp->did));
+    return rv;
+}
+
+/*
+ * @brief Append data to a compressed file.
+ *  The data is compressed into the frame of the last sector, using the data
+    already in the sector as history, until the frame is full. Then a new sector
+    is linked to the file. Compressed files can only be written at their end.
+ * @param fp 
+ * @param buff 
+ * @param btw 
+ * @param bw 
+ * @return 0 if it is successful
+ */
+int esFile_CompressedWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_FileInfo fi;
+    uint8_t *buffer = NULL;
+    const uint8_t *tmpBuff = NULL;
+    uint32_t idx = 0;
+    int rv = 0, count = 0, newSector = 0;
+
+    if (fp->index != fp->size)
+    {
+        ESFILE_LOG("Compressed files can only be appended: %s %d\n", __FILE__, __LINE__);
+        return -4;
+    }
+
+    esFile_Lock(ESFILE_LOCK_COMPRESS(fp->did));
+
+    buffer = esFile_GetDiskBuffer(fp->did);
+    tmpBuff = (const uint8_t *)buff;
+
+    while (btw > idx)
+    {
+        rv = LoadFrame(fp, fp->index - fp->sectorIndex, buffer);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        count = AppendFrame(fp, buffer, tmpBuff ? &tmpBuff[idx] : NULL, btw - idx);
+        if (count < 0)
+        {
+            ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+            rv = -2;
+            break;
+        }
+
+        fp->sectorIndex += count;
+        fp->index += count;
+        idx += count;
+
+        if (btw > idx)
+        {
+            newSector = esFile_GetFreeSector(fp->did);
+            if (newSector <= 0)
+            {
+                ESFILE_LOG("Unable to write Disk Full: %s %d\n", __FILE__, __LINE__);
+                rv = -3;
+                break;
+            }
+
+            memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
+            dsh.nextsector = newSector;
+            esFile_UpdateDataSectorHeader(fp->did, fp->currentSector, &dsh);
+
+            dsh.presector = fp->currentSector;
+            dsh.nextsector = 0;
+            dsh.rfu = 0;
+            fp->currentSector = newSector;
+            fp->sectorIndex = 0;
+            fp->block++;
+
+            esFile_UpdateDataSectorHeader(fp->did, fp->currentSector, &dsh);
+        }
+    }
+
+    if (bw)
+    {
+        *bw = idx;
+    }
+
+    if (fp->index > fp->size)
+    {
+        fp->size = fp->index;
+
+        esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+        fi.size = fp->size;
+        esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc);
+    }
+
+    esFile_Unlock(ESFILE_LOCK_COMPRESS(fp->did));
+    return rv;
+}
+
+/*
+ * @brief Seek the cursor position within a compressed file.
+ *  Only the frame headers of the sectors are read to find the sector holding
+    the position. A forward seek continues from the current sector, a backward
+    one starts over from the first sector.
+ * @param fp 
+ * @param ofs 
+ * @return 0 if it is successful
+ */
+int esFile_CompressedSeek(esFile_FileDescriptor *fp, uint32_t ofs)
+{
+    uint32_t base = 0;
+    int rv = 0, rawLen = 0, next = 0;
+
+    if (ofs > fp->size)
+    {
+        ofs = fp->size;
+    }
+
+    esFile_Lock(ESFILE_LOCK_COMPRESS(fp->did));
+
+    base = fp->index - fp->sectorIndex;
+    if (ofs < base)
+    {
+        fp->currentSector = fp->sector;
+        fp->block = 0;
+        base = 0;
+    }
+
+    for (;;)
+    {
+        rawLen = FrameLength(fp, base);
+        if (rawLen < 0)
+        {
+            rv = -2;
+            break;
+        }
+
+        if (ofs - base <= (uint32_t)rawLen)
+        {
+            break;
+        }
+
+        next = esFile_GetNextSector(fp->did, fp->currentSector);
+        if (next <= 0)
+        {
+            ESFILE_LOG("FATAL ERROR: %s %d \n", __FILE__, __LINE__);
+            rv = -2;
+            break;
+        }
+
+        base += rawLen;
+        fp->currentSector = next;
+        fp->block++;
+    }
+
+    if (rv == 0)
+    {
+        fp->index = ofs;
+        fp->sectorIndex = ofs - base;
+    }
+
+    esFile_Unlock(ESFILE_LOCK_COMPRESS(fp->did));
+    return rv;
+}
+
+/*
+ * @brief Get the compression state used for a drive.
+ * @param did 
+ * @return The state, kept under ESFILE_LOCK_COMPRESS(did)
+ */
+static esFile_CompressState *CompressState(uint8_t did)
+{
+    return &compressStates[did % ESFILE_COMPRESS_SETS];
+}
+
+/*
+ * @brief Bring the frame of the current sector into memory.
+ *  The decompressed data is kept in the raw buffer. When a sector buffer is
+    given, the sector is read into it with its frame decrypted, which is what
+    an append needs to extend the frame.
+ * @param fp 
+ * @param base file offset of the first byte of the sector
+ * @param sector sector buffer or NULL
+ * @return 0 if it is successful
+ */
+static int LoadFrame(esFile_FileDescriptor *fp, uint32_t base, uint8_t *sector)
+{
+    esFile_CompressState *st = CompressState(fp->did);
+    esFile_DataSectorHeader *dsh = NULL;
+    esFile_DriveInfo *dInfos = NULL;
+    uint8_t *frame = NULL;
+    uint32_t payload = 0, rawLen = 0, compLen = 0;
+    uint8_t cached = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    cached = st->rawValid && st->rawDid == fp->did && st->rawSector == fp->currentSector && st->rawUid == fp->uid && base < fp->size;
+    if (cached && sector == NULL)
+    {
+        return 0;
+    }
+
+    if (sector == NULL)
+    {
+        // Readers do not hold the lock of the drive, so not its disk buffer
+        sector = (uint8_t *)st->frameBuffer;
+    }
+
+    if (esFile_CacheReadSector(fp->did, fp->currentSector, sector) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    dsh = (esFile_DataSectorHeader *)sector;
+    frame = &sector[sizeof(esFile_DataSectorHeader)];
+    if (dsh->uid != fp->uid)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (base >= fp->size)
+    {
+        memset(frame, 0, FRAME_HEADER);
+    }
+    else
+    {
+        if (esFile_GetVolumes()[fp->did].options.verifyCrc && dsh->rfu != 0 &&
+            esFile_PayloadChecksum(frame, payload) != dsh->rfu)
+        {
+            ESFILE_LOG("Checksum error %d %d: %s %d\n", fp->did, fp->currentSector, __FILE__, __LINE__);
+            return -5;
+        }
+
+        if (fp->encrypted)
+        {
+            esFile_Decypt(fp->uid, fp->block, 0, frame, FRAME_HEADER);
+        }
+    }
+
+    rawLen = frame[0] | (frame[1] << 8);
+    compLen = frame[2] | (frame[3] << 8);
+    if (compLen > payload - FRAME_HEADER || rawLen > ESFILE_COMPRESS_RAWSIZE)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (fp->encrypted && compLen > 0)
+    {
+        esFile_Decypt(fp->uid, fp->block, FRAME_HEADER, &frame[FRAME_HEADER], compLen);
+    }
+
+    if (!cached)
+    {
+        st->rawValid = 0;
+        if (LzDecompress(&frame[FRAME_HEADER], compLen, st->rawBuffer, rawLen) != 0)
+        {
+            ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+            return -2;
+        }
+
+        st->rawValid = 1;
+        st->rawDid = fp->did;
+        st->rawSector = fp->currentSector;
+        st->rawUid = fp->uid;
+        st->rawLength = rawLen;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Get the raw length of the frame of the current sector.
+ * @param fp 
+ * @param base file offset of the first byte of the sector
+ * @return raw length, negative on error
+ */
+static int FrameLength(esFile_FileDescriptor *fp, uint32_t base)
+{
+    esFile_CompressState *st = CompressState(fp->did);
+    uint8_t frame[FRAME_HEADER];
+
+    if (base >= fp->size)
+    {
+        return 0;
+    }
+
+    if (st->rawValid && st->rawDid == fp->did && st->rawSector == fp->currentSector && st->rawUid == fp->uid)
+    {
+        return st->rawLength;
+    }
+
+    if (esFile_CacheRead(fp->did, fp->currentSector, frame, sizeof(esFile_DataSectorHeader), FRAME_HEADER) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    if (fp->encrypted)
+    {
+        esFile_Decypt(fp->uid, fp->block, 0, frame, FRAME_HEADER);
+    }
+
+    return frame[0] | (frame[1] << 8);
+}
+
+/*
+ * @brief Compress data into the frame of the sector in the buffer and write it.
+ *  The sector buffer must hold the sector with its frame decrypted, and the raw
+    buffer its decompressed data. The whole frame is encrypted again with the
+    same key stream, see esFile_Encypt for what this reveals.
+ * @param fp 
+ * @param sector 
+ * @param data data to append, NULL appends zeros
+ * @param len 
+ * @return number of bytes appended, negative on error
+ */
+static int AppendFrame(esFile_FileDescriptor *fp, uint8_t *sector, const uint8_t *data, uint32_t len)
+{
+    esFile_CompressState *st = CompressState(fp->did);
+    esFile_DataSectorHeader *dsh = NULL;
+    esFile_DriveInfo *dInfos = NULL;
+    uint8_t *frame = NULL;
+    uint32_t payload = 0, rawLen = 0, compLen = 0, end = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+    dsh = (esFile_DataSectorHeader *)sector;
+    frame = &sector[sizeof(esFile_DataSectorHeader)];
+
+    rawLen = st->rawLength;
+    compLen = frame[2] | (frame[3] << 8);
+    if (len > ESFILE_COMPRESS_RAWSIZE - rawLen)
+        len = ESFILE_COMPRESS_RAWSIZE - rawLen;
+
+    if (data)
+        memcpy(&st->rawBuffer[rawLen], data, len);
+    else
+        memset(&st->rawBuffer[rawLen], 0, len);
+
+    end = LzCompress(st->hashTable, st->rawBuffer, rawLen, rawLen + len, &frame[FRAME_HEADER], &compLen, payload - FRAME_HEADER);
+    if (end == rawLen)
+    {
+        return 0;
+    }
+
+    frame[0] = end & 0xFF;
+    frame[1] = end >> 8;
+    frame[2] = compLen & 0xFF;
+    frame[3] = compLen >> 8;
+    st->rawLength = end;
+
+    if (fp->encrypted)
+    {
+        esFile_Encypt(fp->uid, fp->block, 0, frame, FRAME_HEADER + compLen);
+    }
+
+    dsh->rfu = esFile_GetVolumes()[fp->did].options.verifyCrc ? esFile_PayloadChecksum(frame, payload) : 0;
+    if (esFile_CacheWrite(fp->did, fp->currentSector, sector, 0, dInfos[fp->did].sectorCapacity) != 0)
+    {
+        st->rawValid = 0;
+        return -1;
+    }
+
+    return end - rawLen;
+}
+
+/*
+ * @brief Compress a range of the source into the token stream.
+ *  The bytes before the start are only used as history. Compression stops when
+    the output is full.
+ * @param hashTable LZ_HASHSIZE entries
+ * @param src 
+ * @param start 
+ * @param end 
+ * @param dst 
+ * @param out current length of the token stream, updated
+ * @param cap capacity of the token stream
+ * @return end of the compressed part of the source
+ */
+static uint32_t LzCompress(uint16_t *hashTable, const uint8_t *src, uint32_t start, uint32_t end, uint8_t *dst, uint32_t *out, uint32_t cap)
+{
+    uint32_t p = 0, lit = 0, cand = 0, len = 0, h = 0, dist = 0;
+
+    memset(hashTable, 0, LZ_HASHSIZE * sizeof(uint16_t));
+    for (p = 0; p < start && p + LZ_MIN_MATCH <= end; p++)
+    {
+        hashTable[LzHash(&src[p])] = p + 1;
+    }
+
+    lit = start;
+    p = start;
+    while (p < end)
+    {
+        len = 0;
+        if (p + LZ_MIN_MATCH <= end)
+        {
+            h = LzHash(&src[p]);
+            cand = hashTable[h];
+            hashTable[h] = p + 1;
+
+            if (cand > 0 && memcmp(&src[cand - 1], &src[p], LZ_MIN_MATCH) == 0)
+            {
+                cand--;
+                len = LZ_MIN_MATCH;
+                while (p + len < end && len < LZ_MAX_MATCH && src[cand + len] == src[p + len])
+                {
+                    len++;
+                }
+            }
+        }
+
+        if (len == 0)
+        {
+            p++;
+            continue;
+        }
+
+        if (!LzEmitLiterals(src, &lit, p, dst, out, cap) || *out + 3 > cap)
+        {
+            return lit;
+        }
+
+        dist = p - cand;
+        dst[(*out)++] = 0x80 | (len - LZ_MIN_MATCH);
+        dst[(*out)++] = dist & 0xFF;
+        dst[(*out)++] = dist >> 8;
+
+        for (uint32_t k = 1; k < len && p + k + LZ_MIN_MATCH <= end; k++)
+        {
+            hashTable[LzHash(&src[p + k])] = p + k + 1;
+        }
+
+        p += len;
+        lit = p;
+    }
+
+    LzEmitLiterals(src, &lit, end, dst, out, cap);
+    return lit;
+}
+
+/*
+ * @brief Emit the pending literals up to a source position.
+ * @param src 
+ * @param lit first pending literal, updated
+ * @param to 
+ * @param dst 
+ * @param out 
+ * @param cap 
+ * @return 1 if all literals were emitted, 0 if the output is full
+ */
+static int LzEmitLiterals(const uint8_t *src, uint32_t *lit, uint32_t to, uint8_t *dst, uint32_t *out, uint32_t cap)
+{
+    uint32_t n = 0;
+
+    while (*lit < to)
+    {
+        n = to - *lit;
+        if (n > LZ_MAX_LITERALS)
+            n = LZ_MAX_LITERALS;
+        if (*out + 1 + n > cap)
+            n = (*out + 1 < cap) ? cap - *out - 1 : 0;
+        if (n == 0)
+            return 0;
+
+        dst[(*out)++] = n - 1;
+        memcpy(&dst[*out], &src[*lit], n);
+        *out += n;
+        *lit += n;
+    }
+
+    return 1;
+}
+
+/*
+ * @brief Decompress a token stream.
+ * @param src 
+ * @param srcLen 
+ * @param dst 
+ * @param dstLen expected raw length
+ * @return 0 if it is successful
+ */
+static int LzDecompress(const uint8_t *src, uint32_t srcLen, uint8_t *dst, uint32_t dstLen)
+{
+    uint32_t i = 0, o = 0, n = 0, dist = 0;
+
+    while (i < srcLen)
+    {
+        if (src[i] < LZ_MAX_LITERALS)
+        {
+            n = src[i++] + 1;
+            if (i + n > srcLen || o + n > dstLen)
+            {
+                return -1;
+            }
+
+            memcpy(&dst[o], &src[i], n);
+            i += n;
+            o += n;
+        }
+        else
+        {
+            n = (src[i++] & 0x7F) + LZ_MIN_MATCH;
+            if (i + 2 > srcLen)
+            {
+                return -1;
+            }
+
+            dist = src[i] | (src[i + 1] << 8);
+            i += 2;
+            if (dist == 0 || dist > o || o + n > dstLen)
+            {
+                return -1;
+            }
+
+            for (; n > 0; n--, o++)
+            {
+                dst[o] = dst[o - dist];
+            }
+        }
+    }
+
+    return o == dstLen ? 0 : -1;
+}
+
+/*
+ * @brief Hash the next three bytes.
+ * @param p 
+ * @return hash table index
+ */
+static uint32_t LzHash(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+
+    return (v * 2654435761u) >> (32 - ESFILE_COMPRESS_HASHBITS);
+}
\ No newline at end of file
@@ -0,0 +1,154 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_crc.h"
+
+#if defined(__SSE4_2__) && defined(__x86_64__) && !defined(ESFILE_CRC_NO_SIMD)
+#include <nmmintrin.h>
+#define ESFILE_CRC_SSE42
+#endif
+
+#define CRC32C_POLY                         0x82F63B78
+
+#ifndef ESFILE_CRC_SSE42
+static uint32_t crcTable[8][256];
+static uint8_t crcReady = 0;
+
+static void CrcSetup(void);
+#endif
+
+/*
+ * @brief Calculate the CRC32C (Castagnoli) of a buffer.
+ *  The portable version processes eight bytes per step with the slicing-by-8
+    tables, which are generated by esFile_CrcInit or on the first call. On
+    x86-64 hosts built with SSE4.2 the CRC32 instruction is used instead, which
+    computes the same polynomial.
+ * @param crc initial value, 0 for a new calculation
+ * @param data 
+ * @param len 
+ * @return crc
+ */
+uint32_t esFile_Crc32c(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+#ifdef ESFILE_CRC_SSE42
+    uint64_t crc64 = ~crc;
+    uint64_t word = 0;
+
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t)crc64;
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return ~crc;
+#else
+    uint32_t lo = 0, hi = 0;
+
+    if (!crcReady)
+    {
+        CrcSetup();
+    }
+
+    crc = ~crc;
+    for (; len >= 8; len -= 8, data += 8)
+    {
+        lo = crc ^ ((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+        hi = (uint32_t)data[4] | ((uint32_t)data[5] << 8) | ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24);
+
+        crc = crcTable[7][lo & 0xFF] ^ crcTable[6][(lo >> 8) & 0xFF] ^
+              crcTable[5][(lo >> 16) & 0xFF] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xFF] ^ crcTable[2][(hi >> 8) & 0xFF] ^
+              crcTable[1][(hi >> 16) & 0xFF] ^ crcTable[0][hi >> 24];
+    }
+
+    while (len--)
+    {
+        crc = crcTable[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+#endif
+}
+
+/*
+ * @brief Generate the CRC tables.
+ *  This is done by esFile_Init, so the tables are ready before the file system
+    is used by several tasks.
+ */
+void esFile_CrcInit(void)
+{
+#ifndef ESFILE_CRC_SSE42
+    if (!crcReady)
+    {
+        CrcSetup();
+    }
+#endif
+}
+
+/*
+ * @brief Calculate the checksum stored in a data sector header.
+ *  A stored checksum of 0 marks a sector whose payload is not sealed yet, so a
+    payload whose CRC happens to be 0 is stored as 0xFFFFFFFF.
+ * @param data 
+ * @param len 
+ * @return checksum, never 0
+ */
+uint32_t esFile_PayloadChecksum(const uint8_t *data, uint32_t len)
+{
+    uint32_t crc = esFile_Crc32c(0, data, len);
+
+    return crc ? crc : 0xFFFFFFFF;
+}
+
+#ifndef ESFILE_CRC_SSE42
+/*
+ * @brief Generate the slicing-by-8 tables.
+ */
+static void CrcSetup(void)
+{
+    uint32_t crc = 0;
+
+    for (int n = 0; n < 256; n++)
+    {
+        crc = n;
+        for (int k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crcTable[0][n] = crc;
+    }
+
+    for (int n = 0; n < 256; n++)
+    {
+        crc = crcTable[0][n];
+        for (int k = 1; k < 8; k++)
+        {
+            crc = crcTable[0][crc & 0xFF] ^ (crc >> 8);
+            crcTable[k][n] = crc;
+        }
+    }
+
+    crcReady = 1;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,25 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_CRC_H__
+#define ESFILE_CRC_H__
+
+void esFile_CrcInit(void);
+uint32_t esFile_Crc32c(uint32_t crc, const uint8_t *data, uint32_t len);
+uint32_t esFile_PayloadChecksum(const uint8_t *data, uint32_t len);
+
+#endif
\ No newline at end of file
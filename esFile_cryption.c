@@ -17,29 +17,373 @@
 
 #include "esFile_definitions.h"
 #include "esFile_cryption.h"
+#include "esFile_disk.h"
+#include "esFile_open.h"
+
+#if defined(__SSE2__) && !defined(ESFILE_CRYPT_NO_SIMD)
+#include <emmintrin.h>
+#define ESFILE_CRYPT_SSE2
+#endif
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d)               \
+    a += b; d ^= a; d = ROTL32(d, 16);         \
+    c += d; b ^= c; b = ROTL32(b, 12);         \
+    a += b; d ^= a; d = ROTL32(d, 8);          \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+static uint32_t cryptKey[8];
+static uint8_t cryptKeySet;
+
+static int SoftSubmit(esFile_CryptJob *jobs, int count);
+static int SoftWait(esFile_CryptJob *job);
+
+static const esFile_CryptoProvider softProvider = {
+    SoftSubmit,
+    SoftWait
+};
+static const esFile_CryptoProvider *cryptProvider = &softProvider;
+
+static void CryptSetup(uint32_t *state, uint32_t uid, uint32_t block, uint32_t counter);
+static void CryptBlock(const uint32_t *state, uint8_t *out);
+#ifdef ESFILE_CRYPT_SSE2
+static void CryptBlock4(const uint32_t *state, uint8_t *out);
+#endif
+static void CryptRange(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len);
+
+/*
+ * @brief Set the key of the file encryption.
+ *  This function sets the 256-bit volume key that is used to derive the key
+    stream of every encrypted file. Encrypted files can not be opened before it
+    is set. Passing NULL clears the key.
+    The drives create plain files until a key is set. Setting one makes
+    encryption the default of every drive and clearing it makes plain files
+    the default again; esFile_SetDefaultEncryption overrides it afterwards.
+ * @param key 
+ */
+void esFile_SetCryptKey(const uint8_t *key)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        cryptKey[i] = key ? (uint32_t)key[i * 4] | ((uint32_t)key[i * 4 + 1] << 8) |
+                            ((uint32_t)key[i * 4 + 2] << 16) | ((uint32_t)key[i * 4 + 3] << 24) : 0;
+    }
+    cryptKeySet = key ? 1 : 0;
+
+    for (int i = 0; i < esFile_GetDriveCount(); i++)
+    {
+        esFile_SetDefaultEncryption(i, esFile_CryptReady());
+    }
+}
+
+/*
+ * @brief Check whether encrypted files can be accessed.
+ *  A provider other than the built-in one holds its own key, e.g. in a
+    hardware engine, so it is always ready.
+ * @return 1 if a key is available, 0 otherwise
+ */
+int esFile_CryptReady(void)
+{
+    return cryptKeySet || cryptProvider != &softProvider;
+}
+
+/*
+ * @brief Select the provider that performs the cipher work.
+ *  A provider accepts batches of jobs and may complete them asynchronously,
+    e.g. on a hardware crypto engine. The provider defines the key stream, so a
+    volume must always be accessed with the same provider. Passing NULL
+    restores the built-in software provider. Like a key, a provider makes
+    encryption the default of every drive.
+ * @param provider 
+ */
+void esFile_SetCryptoProvider(const esFile_CryptoProvider *provider)
+{
+    cryptProvider = provider ? provider : &softProvider;
+
+    for (int i = 0; i < esFile_GetDriveCount(); i++)
+    {
+        esFile_SetDefaultEncryption(i, esFile_CryptReady());
+    }
+}
+
+/*
+ * @brief Submit a batch of cipher jobs to the active provider.
+ * @param jobs 
+ * @param count 
+ * @return 0 if it is successful
+ */
+int esFile_CryptSubmit(esFile_CryptJob *jobs, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        jobs[i].done = 0;
+    }
+
+    return cryptProvider->submit(jobs, count);
+}
+
+/*
+ * @brief Wait until a submitted cipher job is completed.
+ * @param job 
+ * @return 0 if it is successful
+ */
+int esFile_CryptWait(esFile_CryptJob *job)
+{
+    return cryptProvider->wait(job);
+}
+
+/*
+ * @brief Apply the software key stream to the range of a job.
+ *  This function is the cipher used by the built-in provider and is exported
+    for providers that emulate an engine in software.
+ * @param job 
+ */
+void esFile_CryptProcess(esFile_CryptJob *job)
+{
+    CryptRange(job->uid, job->block, job->offset, job->data, job->len);
+}
 
 /*
  * @brief Encrypt data before storing it in storage.
- *  This function takes a piece of data as input and encrypts it to enhance
-    security before storing it in a storage medium. Encryption helps protect
-    sensitive information from unauthorized access.
+ *  This function encrypts a byte range of a data sector payload in place with
+    the ChaCha20 stream cipher. The key stream is selected by the file uid and
+    the sector ordinal within the file, and positioned by the offset of the
+    range within the sector payload, so only the bytes that are actually
+    written have to be processed.
+    There is no nonce per write: bytes written again at the same position of
+    the same file reuse their key stream. Anyone holding an old and a new copy
+    of the sector learns the XOR of the old and new plain text. This
+    includes the frames of a compressed file, which are rewritten on every
+    append. Recreating the file gives it a new uid and a fresh key stream.
+    The cipher only protects data at rest against a single look at the
+    media, it does not authenticate the data.
+ * @param uid 
+ * @param block 
+ * @param offset 
  * @param data 
  * @param len 
  * @return len 
  */
-int esFile_Encypt(uint8_t *data, uint32_t len){
+int esFile_Encypt(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len){
+    esFile_CryptJob job = {data, len, uid, block, offset, 0};
+
+    if (esFile_CryptSubmit(&job, 1) != 0 || esFile_CryptWait(&job) != 0)
+    {
+        return -1;
+    }
+
     return len;
 }
 
 /*
  * @brief Decrypt data that is stored in storage.
- *  This function takes encrypted data as input and decrypts it, allowing access to
-    the original information that was stored securely. Decryption is necessary to
-    retrieve and use the stored data.
+ *  This function decrypts a byte range of a data sector payload in place. The
+    cipher is a stream cipher, so decryption applies the same key stream that
+    was used by esFile_Encypt for the same uid, block and offset.
+ * @param uid 
+ * @param block 
+ * @param offset 
  * @param data 
  * @param len 
  * @return len 
  */
-int esFile_Decypt(uint8_t *data, uint32_t len){
-    return len;
+int esFile_Decypt(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len){
+    return esFile_Encypt(uid, block, offset, data, len);
+}
+
+/*
+ * @brief Run a batch of jobs on the CPU.
+ * @param jobs 
+ * @param count 
+ * @return 0 
+ */
+static int SoftSubmit(esFile_CryptJob *jobs, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        esFile_CryptProcess(&jobs[i]);
+        jobs[i].done = 1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Wait for a job of the software provider.
+ *  The software provider completes every job during submission.
+ * @param job 
+ * @return 0 
+ */
+static int SoftWait(esFile_CryptJob *job)
+{
+    (void)job;
+    return 0;
+}
+
+/*
+ * @brief Prepare the ChaCha20 state of a key stream position.
+ * @param state 
+ * @param uid 
+ * @param block 
+ * @param counter 
+ */
+static void CryptSetup(uint32_t *state, uint32_t uid, uint32_t block, uint32_t counter)
+{
+    state[0] = 0x61707865;
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(&state[4], cryptKey, sizeof(cryptKey));
+    state[12] = counter;
+    state[13] = uid;
+    state[14] = block;
+    state[15] = 0;
+}
+
+/*
+ * @brief Generate one 64-byte key stream block.
+ * @param state 
+ * @param out 
+ */
+static void CryptBlock(const uint32_t *state, uint8_t *out)
+{
+    uint32_t x[16];
+
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++)
+    {
+        x[i] += state[i];
+        out[i * 4] = (uint8_t)x[i];
+        out[i * 4 + 1] = (uint8_t)(x[i] >> 8);
+        out[i * 4 + 2] = (uint8_t)(x[i] >> 16);
+        out[i * 4 + 3] = (uint8_t)(x[i] >> 24);
+    }
+}
+
+#ifdef ESFILE_CRYPT_SSE2
+#define ROTL128(v, n) _mm_or_si128(_mm_slli_epi32((v), (n)), _mm_srli_epi32((v), 32 - (n)))
+#define QUARTERROUND4(a, b, c, d)                                                       \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 16);               \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 12);               \
+    a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = ROTL128(d, 8);                \
+    c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = ROTL128(b, 7);
+
+/*
+ * @brief Generate four consecutive 64-byte key stream blocks with SSE2.
+ *  Each vector register holds the same state word of the four blocks, so the
+    rounds run on four blocks at once and the result is transposed back into
+    the serial key stream layout.
+ * @param state 
+ * @param out 
+ */
+static void CryptBlock4(const uint32_t *state, uint8_t *out)
+{
+    __m128i x[16], in[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        in[i] = _mm_set1_epi32((int)state[i]);
+    }
+    in[12] = _mm_add_epi32(in[12], _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++)
+    {
+        QUARTERROUND4(x[0], x[4], x[8], x[12]);
+        QUARTERROUND4(x[1], x[5], x[9], x[13]);
+        QUARTERROUND4(x[2], x[6], x[10], x[14]);
+        QUARTERROUND4(x[3], x[7], x[11], x[15]);
+        QUARTERROUND4(x[0], x[5], x[10], x[15]);
+        QUARTERROUND4(x[1], x[6], x[11], x[12]);
+        QUARTERROUND4(x[2], x[7], x[8], x[13]);
+        QUARTERROUND4(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i += 4)
+    {
+        __m128i a = _mm_add_epi32(x[i], in[i]);
+        __m128i b = _mm_add_epi32(x[i + 1], in[i + 1]);
+        __m128i c = _mm_add_epi32(x[i + 2], in[i + 2]);
+        __m128i d = _mm_add_epi32(x[i + 3], in[i + 3]);
+        __m128i ab0 = _mm_unpacklo_epi32(a, b);
+        __m128i ab1 = _mm_unpackhi_epi32(a, b);
+        __m128i cd0 = _mm_unpacklo_epi32(c, d);
+        __m128i cd1 = _mm_unpackhi_epi32(c, d);
+
+        _mm_storeu_si128((__m128i *)&out[0 * 64 + i * 4], _mm_unpacklo_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i *)&out[1 * 64 + i * 4], _mm_unpackhi_epi64(ab0, cd0));
+        _mm_storeu_si128((__m128i *)&out[2 * 64 + i * 4], _mm_unpacklo_epi64(ab1, cd1));
+        _mm_storeu_si128((__m128i *)&out[3 * 64 + i * 4], _mm_unpackhi_epi64(ab1, cd1));
+    }
+}
+#endif
+
+/*
+ * @brief Apply the key stream to a byte range.
+ * @param uid 
+ * @param block 
+ * @param offset 
+ * @param data 
+ * @param len 
+ */
+static void CryptRange(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len)
+{
+    uint32_t state[16];
+    uint8_t stream[256];
+    uint32_t skip = 0, count = 0, n = 0, i = 0;
+
+    CryptSetup(state, uid, block, offset / 64);
+    skip = offset % 64;
+
+    while (len > 0)
+    {
+#ifdef ESFILE_CRYPT_SSE2
+        if (skip + len > 64)
+        {
+            CryptBlock4(state, stream);
+            n = 4;
+        }
+        else
+#endif
+        {
+            CryptBlock(state, stream);
+            n = 1;
+        }
+
+        count = n * 64 - skip;
+        if (count > len)
+        {
+            count = len;
+        }
+
+        i = 0;
+#ifdef ESFILE_CRYPT_SSE2
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&data[i]), _mm_loadu_si128((const __m128i *)&stream[skip + i]));
+            _mm_storeu_si128((__m128i *)&data[i], v);
+        }
+#endif
+        for (; i < count; i++)
+        {
+            data[i] ^= stream[skip + i];
+        }
+
+        state[12] += n;
+        data += count;
+        len -= count;
+        skip = 0;
+    }
 }
\ No newline at end of file
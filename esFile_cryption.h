@@ -18,7 +18,30 @@
 #ifndef ESFILE_CRYPTION_H__
 #define ESFILE_CRYPTION_H__
 
-int esFile_Encypt(uint8_t *data, uint32_t len);
-int esFile_Decypt(uint8_t *data, uint32_t len);
+typedef struct {
+    uint8_t *data;
+    uint32_t len;
+    uint32_t uid;
+    uint32_t block;
+    uint32_t offset;
+    volatile uint8_t done;
+} esFile_CryptJob;
+
+typedef int (*funcCryptSubmit)(esFile_CryptJob *, int);
+typedef int (*funcCryptWait)(esFile_CryptJob *);
+
+typedef struct {
+    funcCryptSubmit submit;
+    funcCryptWait wait;
+} esFile_CryptoProvider;
+
+void esFile_SetCryptKey(const uint8_t *key);
+int esFile_CryptReady(void);
+void esFile_SetCryptoProvider(const esFile_CryptoProvider *provider);
+int esFile_CryptSubmit(esFile_CryptJob *jobs, int count);
+int esFile_CryptWait(esFile_CryptJob *job);
+void esFile_CryptProcess(esFile_CryptJob *job);
+int esFile_Encypt(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len);
+int esFile_Decypt(uint32_t uid, uint32_t block, uint32_t offset, uint8_t *data, uint32_t len);
 
 #endif
\ No newline at end of file
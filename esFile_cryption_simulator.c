@@ -0,0 +1,151 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_cryption.h"
+#include "esFile_cryption_simulator.h"
+
+#ifdef ESFILE_CRYPT_SIMULATOR
+
+#include <pthread.h>
+
+#ifndef ESFILE_CRYPT_SIM_QUEUE
+#define ESFILE_CRYPT_SIM_QUEUE              16
+#endif
+
+static int SimSubmit(esFile_CryptJob *jobs, int count);
+static int SimWait(esFile_CryptJob *job);
+static void *SimWorker(void *arg);
+
+static const esFile_CryptoProvider simProvider = {
+    SimSubmit,
+    SimWait
+};
+
+static pthread_mutex_t simLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t simQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t simDone = PTHREAD_COND_INITIALIZER;
+static esFile_CryptJob *simQueue[ESFILE_CRYPT_SIM_QUEUE];
+static uint32_t simHead = 0, simTail = 0;
+static uint8_t simStarted = 0;
+
+/*
+ * @brief Get the simulated crypto engine.
+ *  The simulator models an engine with a job queue that completes jobs on its
+    own thread, so the asynchronous paths of the file layer can be exercised on
+    a host. It produces the same key stream as the software provider.
+ * @return provider, NULL if the worker could not be started
+ */
+const esFile_CryptoProvider *esFile_GetCryptSimulator(void)
+{
+    pthread_t worker;
+    const esFile_CryptoProvider *rv = &simProvider;
+
+    pthread_mutex_lock(&simLock);
+    if (!simStarted)
+    {
+        if (pthread_create(&worker, NULL, SimWorker, NULL) == 0)
+        {
+            pthread_detach(worker);
+            simStarted = 1;
+        }
+        else
+        {
+            ESFILE_LOG("CryptSimulator error: %s %d \n", __FILE__, __LINE__);
+            rv = NULL;
+        }
+    }
+    pthread_mutex_unlock(&simLock);
+
+    return rv;
+}
+
+/*
+ * @brief Queue a batch of jobs on the engine.
+ *  Submission blocks while the queue is full, like a hardware descriptor ring.
+ * @param jobs 
+ * @param count 
+ * @return 0 
+ */
+static int SimSubmit(esFile_CryptJob *jobs, int count)
+{
+    pthread_mutex_lock(&simLock);
+    for (int i = 0; i < count; i++)
+    {
+        while (simTail - simHead >= ESFILE_CRYPT_SIM_QUEUE)
+        {
+            pthread_cond_wait(&simDone, &simLock);
+        }
+        simQueue[simTail++ % ESFILE_CRYPT_SIM_QUEUE] = &jobs[i];
+    }
+    pthread_cond_signal(&simQueued);
+    pthread_mutex_unlock(&simLock);
+
+    return 0;
+}
+
+/*
+ * @brief Wait until the engine completes a job.
+ * @param job 
+ * @return 0 
+ */
+static int SimWait(esFile_CryptJob *job)
+{
+    pthread_mutex_lock(&simLock);
+    while (!job->done)
+    {
+        pthread_cond_wait(&simDone, &simLock);
+    }
+    pthread_mutex_unlock(&simLock);
+
+    return 0;
+}
+
+/*
+ * @brief Engine thread, completes the queued jobs in order.
+ * @param arg 
+ * @return NULL
+ */
+static void *SimWorker(void *arg)
+{
+    esFile_CryptJob *job = NULL;
+
+    (void)arg;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&simLock);
+        while (simHead == simTail)
+        {
+            pthread_cond_wait(&simQueued, &simLock);
+        }
+        job = simQueue[simHead % ESFILE_CRYPT_SIM_QUEUE];
+        pthread_mutex_unlock(&simLock);
+
+        esFile_CryptProcess(job);
+
+        pthread_mutex_lock(&simLock);
+        job->done = 1;
+        simHead++;
+        pthread_cond_broadcast(&simDone);
+        pthread_mutex_unlock(&simLock);
+    }
+
+    return NULL;
+}
+
+#endif
\ No newline at end of file
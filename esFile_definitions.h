@@ -25,10 +25,161 @@
 extern void PrintUart(char *fmt, ...);
 extern void DisableInterrupts(void);
 extern void EnableInterrupts(void);
+extern void *MutexCreate(void);
+extern void MutexLock(void *mutex);
+extern void MutexUnlock(void *mutex);
+extern void TaskYield(void);
+extern uint32_t TickGetMs(void);
 
-#define ESFILE_VERSION                      2023
+#define ESFILE_VERSION                      2024
 #define ESFILE_BUFFERSIZE                   ESFTL_NANDPAGESIZE
 
+#ifndef ESFILE_MAX_DRIVES
+#define ESFILE_MAX_DRIVES                   4
+#endif
+
+#define ESFILE_LOCK_INTERRUPTS              0
+#define ESFILE_LOCK_PTHREAD                 1
+#define ESFILE_LOCK_PORT                    2
+
+#ifndef ESFILE_LOCK
+#if defined(__unix__) || defined(__APPLE__)
+#define ESFILE_LOCK                         ESFILE_LOCK_PTHREAD
+#else
+#define ESFILE_LOCK                         ESFILE_LOCK_INTERRUPTS
+#endif
+#endif
+
+#if ESFILE_LOCK == ESFILE_LOCK_INTERRUPTS
+#define ESFILE_DISK_BUFFERS                 1
+#else
+#define ESFILE_DISK_BUFFERS                 ESFILE_MAX_DRIVES
+#endif
+
+#ifndef ESFILE_FILE_LOCKS
+#define ESFILE_FILE_LOCKS                   8
+#endif
+
+#ifndef ESFILE_WEAR_WINDOW
+#define ESFILE_WEAR_WINDOW                  16
+#endif
+
+#ifndef ESFILE_WEAR_STORE_WRITES
+#define ESFILE_WEAR_STORE_WRITES            256
+#endif
+
+#ifndef ESFILE_DISCARD_RANGES
+#define ESFILE_DISCARD_RANGES               8
+#endif
+
+#ifndef ESFILE_DISCARD_BATCH
+#define ESFILE_DISCARD_BATCH                64
+#endif
+
+#ifndef ESFILE_SEAL_PENDING
+#define ESFILE_SEAL_PENDING                 4
+#endif
+
+#ifndef ESFILE_CACHE_ENTRIES
+#define ESFILE_CACHE_ENTRIES                4
+#endif
+
+#ifndef ESFILE_CACHE_SETS
+#define ESFILE_CACHE_SETS                   ESFILE_DISK_BUFFERS
+#endif
+
+#ifndef ESFILE_CACHE_WRITEBACK
+#define ESFILE_CACHE_WRITEBACK              0
+#endif
+
+#ifndef ESFILE_CACHE_DIRTY_MS
+#define ESFILE_CACHE_DIRTY_MS               2000
+#endif
+
+#ifndef ESFILE_CRYPT_PIPELINE
+#define ESFILE_CRYPT_PIPELINE               4
+#endif
+
+#ifndef ESFILE_ASYNC_MERGE
+#define ESFILE_ASYNC_MERGE                  1024
+#endif
+
+#ifndef ESFILE_REMOVE_QUEUE
+#define ESFILE_REMOVE_QUEUE                 8
+#endif
+
+#ifndef ESFILE_RECLAIM_WATERMARK
+#define ESFILE_RECLAIM_WATERMARK            512
+#endif
+
+#ifndef ESFILE_COMPRESS_RAWSIZE
+#define ESFILE_COMPRESS_RAWSIZE             8192
+#endif
+
+#ifndef ESFILE_COMPRESS_HASHBITS
+#define ESFILE_COMPRESS_HASHBITS            10
+#endif
+
+#ifndef ESFILE_COMPRESS_SETS
+#define ESFILE_COMPRESS_SETS                ESFILE_DISK_BUFFERS
+#endif
+
+#ifndef ESFILE_INLINE_FILES
+#define ESFILE_INLINE_FILES                 1
+#endif
+
+#ifndef ESFILE_PACK_MAX
+#define ESFILE_PACK_MAX                     512
+#endif
+
+#ifndef ESFILE_PACK_GRANULE
+#define ESFILE_PACK_GRANULE                 64
+#endif
+
+#ifndef ESFILE_PACK_SECTORS
+#define ESFILE_PACK_SECTORS                 8
+#endif
+
+#ifndef ESFILE_KV_SLOTS
+#define ESFILE_KV_SLOTS                     128
+#endif
+
+#ifndef ESFILE_KV_BATCH
+#define ESFILE_KV_BATCH                     512
+#endif
+
+#ifndef ESFILE_KV_MAXKEY
+#define ESFILE_KV_MAXKEY                    32
+#endif
+
+#ifndef ESFILE_KV_MAXVALUE
+#define ESFILE_KV_MAXVALUE                  256
+#endif
+
+#ifndef ESFILE_KV_COMPACT_MIN
+#define ESFILE_KV_COMPACT_MIN               4096
+#endif
+
+#define ESFILE_META_NONE                    0
+#define ESFILE_META_WRITETHROUGH            1
+#define ESFILE_META_WRITEBACK               2
+
+#ifndef ESFILE_NAND_METACACHE
+#define ESFILE_NAND_METACACHE               ESFILE_META_NONE
+#endif
+
+#ifndef ESFILE_SIM_METACACHE
+#define ESFILE_SIM_METACACHE                ESFILE_META_WRITETHROUGH
+#endif
+
+#ifndef ESFILE_NAND_CHAINTABLE
+#define ESFILE_NAND_CHAINTABLE              0
+#endif
+
+#ifndef ESFILE_SIM_CHAINTABLE
+#define ESFILE_SIM_CHAINTABLE               1
+#endif
+
 #define ESFILE_LOG(f_, ...)                 PrintUart((f_), ##__VA_ARGS__)
 #define ENTER_CRITICAL()                    DisableInterrupts()
 #define LEAVE_CRITICAL()                    EnableInterrupts()
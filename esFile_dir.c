@@ -19,6 +19,7 @@
 #include "esFile_system.h"
 #include "esFile_cache.h"
 #include "esFile_disk.h"
+#include "esFile_lock.h"
 #include "esFile_dir.h"
 
 /*
@@ -62,14 +63,14 @@ int esFile_ReadDir(esFile_DirDescriptor *dp, esFile_FileInfo *fiOut)
         return -1;
     }
 
-    ENTER_CRITICAL();
+    esFile_Lock(dp->did);
 
-    buffer = esFile_GetDiskBuffer();
+    buffer = esFile_GetDiskBuffer(dp->did);
     dInfos = esFile_GetDriveInfos();
         
     for (i = 1; i < dInfos[dp->did].fiSectorCount; i++)
     {
-        if (esFile_DiskRead(dp->did, i, buffer, 0, dInfos[dp->did].sectorCapacity) == 0)
+        if (esFile_CacheRead(dp->did, i, buffer, 0, dInfos[dp->did].sectorCapacity) == 0)
         {
             for (j = 0; j < dInfos[dp->did].sectorCapacity / ESFILE_FILENGTH; j++)
             {
@@ -97,7 +98,7 @@ int esFile_ReadDir(esFile_DirDescriptor *dp, esFile_FileInfo *fiOut)
         }
     }
 
-    LEAVE_CRITICAL();
+    esFile_Unlock(dp->did);
     return rv;
 }
 
@@ -19,9 +19,44 @@
 #include "esFile_definitions.h"
 #include "esFile_disk_nand.h"
 #include "esFile_disk_simulator.h"
+#include "esFile_system.h"
 #include "esFile_disk.h"
+#include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_cryption.h"
 
-const esFile_DriveInfo esFile_dInfos[] = {
+#define WEAR_MAGIC                          0x52414557
+
+#if ESFILE_NAND_METACACHE != ESFILE_META_NONE
+static uint8_t nandMetaCache[(32 - 1) * ESFTL_NANDPAGEDATASIZE];
+#else
+#define nandMetaCache NULL
+#endif
+
+#if ESFILE_SIM_METACACHE != ESFILE_META_NONE
+static uint8_t simMetaCache[(8 - 1) * 512];
+#else
+#define simMetaCache NULL
+#endif
+
+#if ESFILE_NAND_CHAINTABLE
+static uint16_t nandChainTable[ESFTL_NANDNUMBLOCKS * ESFTL_NANDNUMPAGEBLOCK];
+#else
+#define nandChainTable NULL
+#endif
+
+#if ESFILE_SIM_CHAINTABLE
+static uint16_t simChainTable[256];
+#else
+#define simChainTable NULL
+#endif
+
+static uint32_t nandSectorTable[(ESFTL_NANDNUMBLOCKS * ESFTL_NANDNUMPAGEBLOCK + 31) / 32];
+static uint32_t simSectorTable[256 / 32];
+static uint16_t simWearTable[256 - 9];
+static uint32_t wearBuffer[ESFILE_BUFFERSIZE / 4];
+
+static esFile_DriveInfo esFile_dInfos[ESFILE_MAX_DRIVES] = {
     {
         32, 
         32, 
@@ -30,20 +65,39 @@ const esFile_DriveInfo esFile_dInfos[] = {
         esFile_NandDiskInit,
         esFile_NandDiskRead,
         esFile_NandDiskWrite,
-        esFile_NandDiskRelease
+        esFile_NandDiskRelease,
+        ESFILE_NAND_METACACHE,
+        nandMetaCache,
+        nandChainTable,
+        nandSectorTable,
+        0,
+        NULL,
+        esFile_NandDiskDiscard
     },
     {
         8, 
-        8, 
+        9, 
         256, 
         512,
         esFile_SimDiskInit,
         esFile_SimDiskRead,
         esFile_SimDiskWrite,
-        esFile_SimDiskRelease
+        esFile_SimDiskRelease,
+        ESFILE_SIM_METACACHE,
+        simMetaCache,
+        simChainTable,
+        simSectorTable,
+        'e',
+        simWearTable,
+        NULL
     }
 };
 
+static int driveCount = 2;
+
+// Drive of each prefix letter plus one, 0 for the letters without a drive
+static uint8_t drivePrefixes[26] = {['e' - 'a'] = 2};
+
 /*
  * @brief Initialize disk devices.
  *  This function initializes one or more disk devices, preparing them for read
@@ -52,7 +106,7 @@ const esFile_DriveInfo esFile_dInfos[] = {
  * @param format 
  */
 void esFile_DiskInit(uint8_t format){
-    for(int i = 0; i < sizeof(esFile_dInfos) / sizeof(esFile_DriveInfo); i++){
+    for(int i = 0; i < driveCount; i++){
         esFile_dInfos[i].diskInit(format);
     }
 }
@@ -66,14 +120,73 @@ void esFile_DiskInit(uint8_t format){
  * @return The extracted disk ID (int) 
  */
 int esFile_DiskDriveIdFromPath(const char *path){
-    if (!memcmp(path, "e:", 2))
+    if (path[0] >= 'a' && path[0] <= 'z' && path[1] == ':' && drivePrefixes[path[0] - 'a'])
     {
-        return 1;
+        return drivePrefixes[path[0] - 'a'] - 1;
     }
 
     return 0;
 }
 
+/*
+ * @brief Register a drive at runtime.
+ *  This function adds a drive to the drive table, so it is formatted or
+    mounted by the next esFile_Init together with the built-in drives. Its
+    files are addressed with the "x:" prefix for a prefix letter x. The caller
+    provides the per-drive state sized from the geometry of the drive: a
+    sector table of dataSectorEnd bits and optionally a chain table and a
+    metadata cache, all of which must stay valid while the drive is in use.
+    The discard function is optional, it releases a range of sectors at once.
+    A drive without an FTL under it may provide a wear table with a counter
+    for each data sector, its allocation then prefers the least written
+    sectors. The counters are kept in the sector just before the first data
+    sector, which the geometry has to reserve.
+    The functions of a drive are never called at the same time, but they may
+    run in parallel with the functions of the other drives.
+ * @param info 
+ * @return The drive ID or a negative value if the drive can not be registered (int)
+ */
+int esFile_RegisterDrive(const esFile_DriveInfo *info)
+{
+    int did = 0;
+
+    if (info == NULL || info->prefix < 'a' || info->prefix > 'z' || drivePrefixes[info->prefix - 'a'])
+    {
+        ESFILE_LOG("Invalid drive prefix: %s %d\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    if (driveCount >= ESFILE_MAX_DRIVES)
+    {
+        ESFILE_LOG("Drive limit is reached: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (info->sectorCapacity > ESFILE_BUFFERSIZE || info->sectorCapacity < 2 * ESFILE_FILENGTH ||
+        info->fiSectorCount < 2 || info->fiSectorCount > 33 || info->dataSectorStart < info->fiSectorCount ||
+        info->dataSectorEnd <= info->dataSectorStart || info->sectorTable == NULL ||
+        (info->wearTable && (info->dataSectorStart <= info->fiSectorCount ||
+                             sizeof(uint32_t) + (info->dataSectorEnd - info->dataSectorStart) * sizeof(uint16_t) > info->sectorCapacity)) ||
+        (info->metaPolicy != ESFILE_META_NONE && info->metaCache == NULL) ||
+        !info->diskInit || !info->diskRead || !info->diskWrite || !info->diskRelease)
+    {
+        ESFILE_LOG("Invalid drive geometry: %s %d\n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    esFile_LockInit();
+    esFile_Lock(ESFILE_LOCK_SHARED);
+
+    did = driveCount++;
+    esFile_dInfos[did] = *info;
+    drivePrefixes[info->prefix - 'a'] = did + 1;
+    esFile_GetVolumes()[did].options.encrypt = esFile_CryptReady() ? 1 : 0;
+    esFile_GetVolumes()[did].options.verifyCrc = 0;
+
+    esFile_Unlock(ESFILE_LOCK_SHARED);
+    return did;
+}
+
 /*
  * @brief Read sector data from a specific disk.
  *  This function reads data from a specific sector on a particular disk identified
@@ -88,12 +201,17 @@ int esFile_DiskDriveIdFromPath(const char *path){
  */
 int esFile_DiskRead(int pdrv, int sector, uint8_t *buff, int idx, int count)
 {
+    int rv = 0;
+
     if(sector >= esFile_dInfos[pdrv].dataSectorEnd){
     	ESFILE_LOG("Sector No Error %d %d\n", pdrv, sector);
     	return -1;
     }
 
-    return esFile_dInfos[pdrv].diskRead(sector, buff, idx, count);
+    esFile_Lock(ESFILE_LOCK_DEVICE(pdrv));
+    rv = esFile_dInfos[pdrv].diskRead(sector, buff, idx, count);
+    esFile_Unlock(ESFILE_LOCK_DEVICE(pdrv));
+    return rv;
 }
 
 /*
@@ -110,7 +228,28 @@ int esFile_DiskRead(int pdrv, int sector, uint8_t *buff, int idx, int count)
  */
 int esFile_DiskWrite(int pdrv, int sector, uint8_t *buff, int idx, int count)
 {
-    return esFile_dInfos[pdrv].diskWrite(sector, buff, idx, count);
+    esFile_DriveInfo *info = &esFile_dInfos[pdrv];
+    esFile_Volume *vol = &esFile_GetVolumes()[pdrv];
+    uint16_t *counter = NULL;
+    int rv = 0;
+
+    esFile_Lock(ESFILE_LOCK_DEVICE(pdrv));
+
+    if (info->wearTable && sector >= info->dataSectorStart && sector < info->dataSectorEnd)
+    {
+        counter = &info->wearTable[sector - info->dataSectorStart];
+        if (*counter < 0xFFFF)
+        {
+            (*counter)++;
+            if (vol->wearPending < ESFILE_WEAR_STORE_WRITES)
+                vol->wearPending++;
+        }
+    }
+
+    rv = info->diskWrite(sector, buff, idx, count);
+
+    esFile_Unlock(ESFILE_LOCK_DEVICE(pdrv));
+    return rv;
 }
 
 /*
@@ -123,7 +262,129 @@ int esFile_DiskWrite(int pdrv, int sector, uint8_t *buff, int idx, int count)
  * @return int 
  */
 int esFile_DiskRelease(int pdrv, int sector){
-    return esFile_dInfos[pdrv].diskRelease(sector);
+    int rv = 0;
+
+    esFile_Lock(ESFILE_LOCK_DEVICE(pdrv));
+    rv = esFile_dInfos[pdrv].diskRelease(sector);
+    esFile_Unlock(ESFILE_LOCK_DEVICE(pdrv));
+    return rv;
+}
+
+/*
+ * @brief Release a range of consecutive sectors in a specific disk.
+ *  The range is given to the discard function of the drive in one call, a
+    drive without one releases the sectors one by one.
+ * @param pdrv 
+ * @param first 
+ * @param count 
+ * @return 0 if it is successful
+ */
+int esFile_DiskDiscard(int pdrv, int first, int count)
+{
+    int rv = 0;
+
+    esFile_Lock(ESFILE_LOCK_DEVICE(pdrv));
+
+    if (esFile_dInfos[pdrv].diskDiscard)
+    {
+        rv = esFile_dInfos[pdrv].diskDiscard(first, count);
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (esFile_dInfos[pdrv].diskRelease(first + i) != 0)
+                rv = -1;
+        }
+    }
+
+    esFile_Unlock(ESFILE_LOCK_DEVICE(pdrv));
+    return rv;
+}
+
+/*
+ * @brief Load the wear counters of a drive from its reserved sector.
+ *  The counters start from zero when the sector does not hold a wear table,
+    on a new device or one formatted before the drive had it.
+ * @param did 
+ * @return 0 if it is successful
+ */
+int esFile_WearLoad(uint8_t did)
+{
+    esFile_DriveInfo *info = &esFile_dInfos[did];
+    uint8_t *buffer = (uint8_t *)wearBuffer;
+    uint32_t count = 0;
+    int rv = 0;
+
+    if (info->wearTable == NULL)
+        return 0;
+
+    count = info->dataSectorEnd - info->dataSectorStart;
+
+    esFile_Lock(ESFILE_LOCK_WEAR);
+
+    if (esFile_DiskRead(did, info->dataSectorStart - 1, buffer, 0, info->sectorCapacity) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        rv = -1;
+    }
+
+    if (rv == 0 && wearBuffer[0] == WEAR_MAGIC)
+        memcpy(info->wearTable, &wearBuffer[1], count * sizeof(uint16_t));
+    else
+        memset(info->wearTable, 0, count * sizeof(uint16_t));
+    esFile_GetVolumes()[did].wearPending = 0;
+
+    esFile_Unlock(ESFILE_LOCK_WEAR);
+    return rv;
+}
+
+/*
+ * @brief Store the wear counters of a drive to its reserved sector.
+ *  It is done by the flush of the drive once ESFILE_WEAR_STORE_WRITES data
+    sector writes are counted since the last store, so the reserved sector is
+    written less often than the data sectors it keeps track of. The counts
+    since the last store are lost if the power is removed, the counters only
+    steer the allocation, so they do not have to be exact.
+ * @param did 
+ * @return 0 if it is successful
+ */
+int esFile_WearStore(uint8_t did)
+{
+    esFile_DriveInfo *info = &esFile_dInfos[did];
+    esFile_Volume *vol = &esFile_GetVolumes()[did];
+    int rv = 0;
+
+    if (info->wearTable == NULL || vol->wearPending < ESFILE_WEAR_STORE_WRITES)
+        return 0;
+
+    esFile_Lock(ESFILE_LOCK_WEAR);
+    esFile_Lock(ESFILE_LOCK_DEVICE(did));
+
+    memset(wearBuffer, 0, sizeof(wearBuffer));
+    wearBuffer[0] = WEAR_MAGIC;
+    memcpy(&wearBuffer[1], info->wearTable, (info->dataSectorEnd - info->dataSectorStart) * sizeof(uint16_t));
+    if (info->diskWrite(info->dataSectorStart - 1, (uint8_t *)wearBuffer, 0, info->sectorCapacity) == 0)
+    {
+        vol->wearPending = 0;
+    }
+    else
+    {
+        ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
+        rv = -1;
+    }
+
+    esFile_Unlock(ESFILE_LOCK_DEVICE(did));
+    esFile_Unlock(ESFILE_LOCK_WEAR);
+    return rv;
+}
+
+/*
+ * @brief Get the number of the drives.
+ * @return The number of the drives (int)
+ */
+int esFile_GetDriveCount(void){
+    return driveCount;
 }
 
 /*
@@ -134,5 +395,5 @@ int esFile_DiskRelease(int pdrv, int sector){
  * @return esFile_DriveInfo* 
  */
 esFile_DriveInfo *esFile_GetDriveInfos(void){
-    return (esFile_DriveInfo *)esFile_dInfos;
+    return esFile_dInfos;
 }
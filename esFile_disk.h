@@ -22,6 +22,7 @@ typedef int (*funcDiskInit)(uint8_t);
 typedef int (*funcDiskRead)(int, uint8_t *, int, int);
 typedef int (*funcDiskWrite)(int, uint8_t *, int, int);
 typedef int (*funcDiskRelease)(int);
+typedef int (*funcDiskDiscard)(int, int);
 
 typedef struct {
     uint16_t fiSectorCount;
@@ -32,13 +33,25 @@ typedef struct {
     funcDiskRead diskRead;
     funcDiskWrite diskWrite;
     funcDiskRelease diskRelease;
+    uint8_t metaPolicy;
+    uint8_t *metaCache;
+    uint16_t *chainTable;
+    uint32_t *sectorTable;
+    char prefix;
+    uint16_t *wearTable;
+    funcDiskDiscard diskDiscard;
 } esFile_DriveInfo;
 
 void esFile_DiskInit(uint8_t format);
+int esFile_RegisterDrive(const esFile_DriveInfo *info);
 int esFile_DiskRead(int pdrv, int sector, uint8_t *buff, int idx, int count);
 int esFile_DiskWrite(int pdrv, int sector, uint8_t *buff, int idx, int count);
 int esFile_DiskRelease(int pdrv, int sector);
+int esFile_DiskDiscard(int pdrv, int first, int count);
+int esFile_WearLoad(uint8_t did);
+int esFile_WearStore(uint8_t did);
 int esFile_DiskDriveIdFromPath(const char *path);
+int esFile_GetDriveCount(void);
 esFile_DriveInfo *esFile_GetDriveInfos(void);
 
 #endif
\ No newline at end of file
@@ -75,4 +75,25 @@ int esFile_NandDiskWrite(int sector, uint8_t *buff, int idx, int count)
 int esFile_NandDiskRelease(int sector)
 {
     return esFtl_FtlDriverRelease(sector);
+}
+
+/*
+ * @brief Release a range of consecutive sectors in the NAND disk.
+ *  The FTL releases its pages one at a time, the range is walked here so the
+    file system hands it over in a single call.
+ * @param first 
+ * @param count 
+ * @return 0 if it is successful
+ */
+int esFile_NandDiskDiscard(int first, int count)
+{
+    int rv = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (esFtl_FtlDriverRelease(first + i) != 0)
+            rv = -1;
+    }
+
+    return rv;
 }
\ No newline at end of file
@@ -22,5 +22,6 @@ int esFile_NandDiskInit(uint8_t format);
 int esFile_NandDiskRead(int sector, uint8_t *buff, int idx, int count);
 int esFile_NandDiskWrite(int sector, uint8_t *buff, int idx, int count);
 int esFile_NandDiskRelease(int sector);
+int esFile_NandDiskDiscard(int first, int count);
 
 #endif
\ No newline at end of file
@@ -20,8 +20,29 @@
 #include "esFile_disk.h"
 #include "esFile_system.h"
 #include "esFile_cache.h"
+#include "esFile_open.h"
+#include "esFile_crc.h"
+#include "esFile_compress.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
+#include "esFile_reclaim.h"
+#include "esFile_remove.h"
 #include "esFile_init.h"
 
+#define INIT_DONE                           0
+#define INIT_FORMAT                         1
+#define INIT_MOUNT                          2
+#define INIT_COUNT                          3
+
+typedef struct {
+    uint8_t phase;
+    uint8_t did;
+    uint16_t sector;
+    esFile_ScanCursor cursor;
+} esFile_InitJob;
+
+static esFile_InitJob initJob;
+
 /*
  * @brief Initialize the file system.
  *  This function performs the initialization of the file system, setting up data
@@ -32,77 +53,190 @@
  */
 int esFile_Init(uint8_t format)
 {
-    esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL;
-    esFile_System *fs = NULL;
-    int rv = 0, usedPages = 0;
-    ENTER_CRITICAL();
+    int rv = 0;
+
+    rv = esFile_InitStart(format);
+    while (rv == 1)
+    {
+        rv = esFile_InitStep(UINT32_MAX);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Start the initialization of the file system in steps.
+ *  The drives are reset and the formatting or mounting is left to
+    esFile_InitStep, so a superloop can interleave it with its real-time work.
+    No other function of the file system may be called until it is finished.
+ * @param format 
+ * @return 1 as the initialization is in progress
+ */
+int esFile_InitStart(uint8_t format)
+{
+    esFile_LockInit();
+    esFile_LockAll();
 
+    // The releases queued by a previous session are not lost by the reset
+    for (int did = 0; did < esFile_GetDriveCount(); did++)
+    {
+        esFile_CacheDiscardFlush(did);
+    }
+
+    esFile_CrcInit();
     esFile_CacheInit();
+    esFile_CompressInit();
+    esFile_PackInit();
+    esFile_ReclaimInit();
+    esFile_RemoveInit();
     esFile_DiskInit(format);
 
+    memset(&initJob, 0, sizeof(initJob));
+    initJob.phase = format ? INIT_FORMAT : INIT_MOUNT;
+
+    esFile_UnlockAll();
+    return 1;
+}
+
+/*
+ * @brief Run a step of the initialization of the file system.
+ *  A step formats or scans at most about budget sectors. The scan of the
+    chains of the files is the long part of a mount, it is resumed file by
+    file and sector by sector.
+ * @param budget number of sectors
+ * @return 1 if the initialization is in progress, 0 if it is finished, negative on error
+ */
+int esFile_InitStep(uint32_t budget)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vols = NULL;
+    int rv = 1, did = 0, step = 0;
+
+    esFile_LockAll();
+
     dInfos = esFile_GetDriveInfos();
-    buffer = esFile_GetDiskBuffer();
-    fs = esFile_GetFileSystems();
+    vols = esFile_GetVolumes();
 
-    if (format)
+    while (rv == 1 && budget > 0)
     {
-        ESFILE_LOG("Formating Nand Disk...\n");
-        esFile_ClearDiskBuffer();
-        for (int i = 0; i < dInfos[0].fiSectorCount; i++)
+        did = initJob.did;
+
+        if (initJob.phase == INIT_FORMAT)
         {
-            esFile_DiskWrite(0, i, buffer, 0, dInfos[0].sectorCapacity);
+            if (did >= esFile_GetDriveCount())
+            {
+                rv = 0;
+            }
+            else if (initJob.sector < dInfos[did].fiSectorCount)
+            {
+                if (initJob.sector == 0)
+                {
+                    ESFILE_LOG("Formating Disk %d...\n", did);
+                    // The wear counted since the drive was mounted outlives the formatting
+                    vols[did].wearPending = ESFILE_WEAR_STORE_WRITES;
+                    esFile_ClearDiskBuffer(did);
+                }
+                esFile_CacheWrite(did, initJob.sector++, esFile_GetDiskBuffer(did), 0, dInfos[did].sectorCapacity);
+                budget--;
+            }
+            else
+            {
+                vols[did].fs.version = ESFILE_VERSION;
+                vols[did].fs.lastuid = 0;
+                vols[did].fs.filecount = 0;
+                esFile_WriteFileSystem(did);
+                esFile_CacheFlush(did);
+                ESFILE_LOG("Formating Disk %d Finished\n", did);
+                initJob.did++;
+                initJob.sector = 0;
+                budget--;
+            }
         }
-        fs[0].version = ESFILE_VERSION;
-        fs[0].lastuid = 0;
-        fs[0].filecount = 0;
-        esFile_WriteFileSystem(0);
-        ESFILE_LOG("Formating Nand Finished\n");
-
-        ESFILE_LOG("Formating Ram Disk...\n");
-        esFile_ClearDiskBuffer();
-        for (int i = 0; i < dInfos[1].fiSectorCount; i++)
+        else if (initJob.phase == INIT_MOUNT)
         {
-            esFile_DiskWrite(1, i, buffer, 0, dInfos[1].sectorCapacity);
+            if (did >= esFile_GetDriveCount())
+            {
+                initJob.phase = INIT_COUNT;
+                initJob.did = 0;
+            }
+            else if (initJob.sector == 0)
+            {
+                esFile_ReadFileSystem(did);
+                if (vols[did].fs.version != ESFILE_VERSION)
+                {
+                    ESFILE_LOG("Versions are mismatch for disk %d. It should be reformatted\n", did);
+                    rv = -1;
+                }
+                else
+                {
+                    esFile_WearLoad(did);
+                }
+                memset(&initJob.cursor, 0, sizeof(initJob.cursor));
+                initJob.sector = 1;
+                budget--;
+            }
+            else
+            {
+                step = esFile_EvaluateSectorTableStep(did, &initJob.cursor, &budget);
+                if (step < 0)
+                {
+                    ESFILE_LOG("Sectors of disk %d can not be evaluated\n", did);
+                    rv = step;
+                }
+                else if (step == 0)
+                {
+                    initJob.did++;
+                    initJob.sector = 0;
+                }
+            }
         }
-        fs[1].version = ESFILE_VERSION;
-        fs[1].lastuid = 0;
-        fs[1].filecount = 0;
-        esFile_WriteFileSystem(1);
-        ESFILE_LOG("Formating Ram Finished\n");
-    }
-    else
-    {
-        esFile_ReadFileSystem(0);
-        if (fs[0].version != ESFILE_VERSION)
+        else if (initJob.phase == INIT_COUNT)
         {
-            ESFILE_LOG("Versions are mismatch for disk 0. It should be reformatted\n");
-            rv = -1;
+            if (did < esFile_GetDriveCount())
+            {
+                esFile_CalculateFileCountAndUid(did);
+                initJob.did++;
+                budget = budget > dInfos[did].fiSectorCount ? budget - dInfos[did].fiSectorCount : 0;
+            }
+            else
+            {
+                // The NAND is evaluated by the reclamation in idle time, not during boot
+                esFile_ReclaimRequest();
+                rv = 0;
+            }
         }
         else
         {
-            esFile_EvaluateSectorTable(0);
-
-            esFile_ReadFileSystem(1);
-            if (fs[1].version != ESFILE_VERSION)
-            {
-                ESFILE_LOG("Versions are mismatch for disk 1. It should be reformatted\n");
-                rv = -1;
-            } else {     
-                esFile_EvaluateSectorTable(1);
-
-                esFile_CalculateFileCountAndUid(0);
-                esFile_CalculateFileCountAndUid(1);
-
-                usedPages = esFtl_CalcUsedPages();
-                if(usedPages > (ESFTL_NANDNUMBLOCKS/10)*ESFTL_NANDNUMPAGEBLOCK && (esFile_CalcDiskUsage(0) * 2) < usedPages){
-                    esFtl_Defrag();
-                }              
-            }
+            rv = 0;
         }
+    }
 
+    if (rv != 1)
+    {
+        initJob.phase = INIT_DONE;
     }
 
-    LEAVE_CRITICAL();
+    esFile_UnlockAll();
     return rv;
 }
+
+/*
+ * @brief Set whether the data sector checksums of a drive are verified.
+ *  When it is enabled, the payload of every sealed data sector is checked
+    against the CRC32C in its header as the sector is read. The checksums are
+    only maintained while it is enabled; sectors written in the meantime are
+    left unsealed and are not checked.
+ * @param did 
+ * @param enable 
+ * @return 0 if it is successful
+ */
+int esFile_SetChecksumVerification(uint8_t did, uint8_t enable)
+{
+    if (did >= esFile_GetDriveCount())
+    {
+        return -1;
+    }
+
+    esFile_GetVolumes()[did].options.verifyCrc = enable ? 1 : 0;
+    return 0;
+}
\ No newline at end of file
@@ -19,5 +19,8 @@
 #define ESFILE_INIT_H__
 
 int esFile_Init(uint8_t format);
+int esFile_InitStart(uint8_t format);
+int esFile_InitStep(uint32_t budget);
+int esFile_SetChecksumVerification(uint8_t did, uint8_t enable);
 
 #endif
\ No newline at end of file
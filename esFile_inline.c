@@ -0,0 +1,193 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_cache.h"
+#include "esFile_disk.h"
+#include "esFile_open.h"
+#include "esFile_cryption.h"
+#include "esFile_inline.h"
+
+static int ReadSlot(esFile_FileDescriptor *fp, uint8_t *slot, esFile_FileInfo *fi);
+static int WriteSlot(esFile_FileDescriptor *fp, uint8_t *slot, esFile_FileInfo *fi);
+
+/*
+ * @brief Read data from an inline file.
+ *  The data of an inline file is kept in its file info slot, right after the
+    file info, so it is read with a single metadata access.
+ * @param fp 
+ * @param buff 
+ * @param btr 
+ * @param br 
+ * @return 0 if it is successful
+ */
+int esFile_InlineRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br)
+{
+    uint8_t slot[ESFILE_FILENGTH];
+    esFile_FileInfo fi;
+    uint32_t chunk = 0;
+    int rv = 0;
+
+    rv = ReadSlot(fp, slot, &fi);
+    if (rv != 0)
+    {
+        return rv;
+    }
+
+    chunk = (fp->index < fp->size) ? fp->size - fp->index : 0;
+    if (chunk > btr)
+        chunk = btr;
+
+    if (buff && chunk > 0)
+    {
+        memcpy(buff, &slot[sizeof(esFile_FileInfo) + fp->index], chunk);
+        if (fp->encrypted)
+        {
+            esFile_Decypt(fp->uid, 0, fp->index, (uint8_t *)buff, chunk);
+        }
+    }
+
+    fp->index += chunk;
+    if (br)
+        *br = chunk;
+
+    return 0;
+}
+
+/*
+ * @brief Write data to an inline file.
+ *  The data must fit in the slot, a file growing beyond it is promoted with
+    esFile_PackReserve first. The data and the new size are written back to
+    the slot with a single metadata access.
+ * @param fp 
+ * @param buff data to write, NULL writes zeros
+ * @param btw 
+ * @param bw 
+ * @return 0 if it is successful
+ */
+int esFile_InlineWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw)
+{
+    uint8_t slot[ESFILE_FILENGTH];
+    esFile_FileInfo fi;
+    uint8_t *data = NULL;
+    int rv = 0;
+
+    if (fp->index + btw > ESFILE_INLINE_SIZE)
+    {
+        return -1;
+    }
+
+    rv = ReadSlot(fp, slot, &fi);
+    if (rv != 0)
+    {
+        return rv;
+    }
+
+    data = &slot[sizeof(esFile_FileInfo) + fp->index];
+    if (buff)
+        memcpy(data, buff, btw);
+    else
+        memset(data, 0, btw);
+
+    if (fp->encrypted)
+    {
+        // The key stream matches the first sector of a data chain, so a
+        // promoted file keeps its cipher text as it is
+        esFile_Encypt(fp->uid, 0, fp->index, data, btw);
+    }
+
+    fp->index += btw;
+    if (fp->index > fp->size)
+        fp->size = fp->index;
+    fi.size = fp->size;
+
+    if (WriteSlot(fp, slot, &fi) != 0)
+    {
+        return -2;
+    }
+
+    if (bw)
+        *bw = btw;
+
+    return 0;
+}
+
+/*
+ * @brief Seek the cursor position within an inline file.
+ *  The position is limited to the end of the file.
+ * @param fp 
+ * @param ofs 
+ * @return 0 if it is successful
+ */
+int esFile_InlineSeek(esFile_FileDescriptor *fp, uint32_t ofs)
+{
+    fp->index = (ofs < fp->size) ? ofs : fp->size;
+    return 0;
+}
+
+/*
+ * @brief Read the file info slot of an inline file.
+ * @param fp 
+ * @param slot receives the whole slot
+ * @param fi receives the file info
+ * @return 0 if it is successful
+ */
+static int ReadSlot(esFile_FileDescriptor *fp, uint8_t *slot, esFile_FileInfo *fi)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+
+    if (esFile_CacheRead(fp->did, fp->infoLoc / dInfos[fp->did].sectorCapacity, slot, fp->infoLoc % dInfos[fp->did].sectorCapacity, ESFILE_FILENGTH) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    memcpy(fi, slot, sizeof(esFile_FileInfo));
+    if (fi->uid != fp->uid || !(fi->flags & ESFILE_FLAG_INLINE))
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Write back the file info slot of an inline file.
+ * @param fp 
+ * @param slot 
+ * @param fi 
+ * @return 0 if it is successful
+ */
+static int WriteSlot(esFile_FileDescriptor *fp, uint8_t *slot, esFile_FileInfo *fi)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+
+    memcpy(slot, fi, sizeof(esFile_FileInfo));
+    if (esFile_CacheWrite(fp->did, fp->infoLoc / dInfos[fp->did].sectorCapacity, slot, fp->infoLoc % dInfos[fp->did].sectorCapacity, ESFILE_FILENGTH) != 0)
+    {
+        ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    return 0;
+}
\ No newline at end of file
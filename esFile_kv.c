@@ -0,0 +1,607 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_open.h"
+#include "esFile_read.h"
+#include "esFile_write.h"
+#include "esFile_seek.h"
+#include "esFile_stat.h"
+#include "esFile_close.h"
+#include "esFile_remove.h"
+#include "esFile_rename.h"
+#include "esFile_kv.h"
+
+/*
+ * A store is a log file of records, each one a type byte, the key length, the
+ * value length as a 16-bit little endian value, the key and the value. A put
+ * appends a record with the new value, a delete appends a tombstone. The RAM
+ * index maps the hash of every live key to the offset of its latest record;
+ * offsets past the end of the file refer to the commit batch, which holds the
+ * records that are not written yet.
+ *
+ * Compaction copies the live records into a new log, a few at a time, and
+ * swaps the files when the copy has caught up with the end of the old log.
+ * Deletes made while compacting are copied too, since the new log may already
+ * hold the deleted record. The index is then rebuilt from the new log.
+ */
+
+#define KV_PUT                              0x50
+#define KV_DEL                              0x44
+#define KV_HEADER                           4
+#define KV_EMPTY                            0
+#define KV_USED                             1
+#define KV_DELETED                          2
+
+static int LoadLog(esFile_Kv *kv);
+static int Append(esFile_Kv *kv, uint8_t type, const char *key, const void *value, uint16_t len);
+static int ReadAt(esFile_Kv *kv, uint32_t ofs, uint8_t *buff, uint32_t len);
+static esFile_KvEntry *Lookup(esFile_Kv *kv, const char *key, uint32_t hash, esFile_KvEntry **slot);
+static esFile_KvEntry *LookupOffset(esFile_Kv *kv, uint32_t hash, uint32_t ofs);
+static void Index(esFile_Kv *kv, const char *key, uint32_t ofs, uint16_t length);
+static void Unindex(esFile_Kv *kv, const char *key);
+static int FinishCompaction(esFile_Kv *kv);
+static uint32_t KeyHash(const char *key, uint32_t len);
+
+/*
+ * @brief Open a key-value store.
+ *  This function opens the log file of the store, creating it if it does not
+    exist, and builds the RAM index from it. A compaction that was interrupted
+    by a reset is completed or discarded. The store object is used by one task
+    at a time.
+ * @param kv 
+ * @param path 
+ * @return 0 if it is successful
+ */
+int esFile_KvOpen(esFile_Kv *kv, const char *path)
+{
+    if (kv == NULL || path == NULL || strlen(path) + 2 > sizeof(kv->path))
+    {
+        return -1;
+    }
+
+    memset(kv, 0, sizeof(esFile_Kv));
+    strcpy(kv->path, path);
+    strcpy(kv->tmpPath, path);
+    strcat(kv->tmpPath, "~");
+
+    if (esFile_Stat(kv->tmpPath, NULL) == 0)
+    {
+        // The new log is complete once the old one is removed
+        if (esFile_Stat(kv->path, NULL) == 0)
+            esFile_Remove(kv->tmpPath);
+        else
+            esFile_Rename(kv->tmpPath, kv->path);
+    }
+
+    if (esFile_Open(&kv->fp, kv->path, (esFile_Stat(kv->path, NULL) == 0 ? ESFILE_MODE_OPEN_EXISTING : ESFILE_MODE_CREATE_NEW) |
+                    ESFILE_MODE_READ | ESFILE_MODE_WRITE) != 0)
+    {
+        return -2;
+    }
+
+    return LoadLog(kv);
+}
+
+/*
+ * @brief Get the value of a key.
+ * @param kv 
+ * @param key 
+ * @param value buffer for the value, may be NULL
+ * @param size size of the buffer, a longer value is truncated
+ * @return length of the value, -1 if the key does not exist
+ */
+int esFile_KvGet(esFile_Kv *kv, const char *key, void *value, uint16_t size)
+{
+    esFile_KvEntry *entry = NULL;
+    uint32_t keyLen = 0, valLen = 0;
+
+    if (kv == NULL || key == NULL)
+    {
+        return -1;
+    }
+
+    keyLen = strlen(key);
+    entry = Lookup(kv, key, KeyHash(key, keyLen), NULL);
+    if (entry == NULL)
+    {
+        return -1;
+    }
+
+    valLen = entry->length - KV_HEADER - keyLen;
+    if (value && size > 0)
+    {
+        if (ReadAt(kv, entry->offset + KV_HEADER + keyLen, (uint8_t *)value, valLen < size ? valLen : size) != 0)
+        {
+            return -2;
+        }
+    }
+
+    return valLen;
+}
+
+/*
+ * @brief Set the value of a key.
+ *  The change is kept in the commit batch until esFile_KvCommit is called or
+    the batch is full.
+ * @param kv 
+ * @param key 
+ * @param value 
+ * @param len 
+ * @return 0 if it is successful
+ */
+int esFile_KvPut(esFile_Kv *kv, const char *key, const void *value, uint16_t len)
+{
+    if (kv == NULL || key == NULL || (value == NULL && len > 0))
+    {
+        return -1;
+    }
+
+    return Append(kv, KV_PUT, key, value, len);
+}
+
+/*
+ * @brief Delete a key.
+ * @param kv 
+ * @param key 
+ * @return 0 if it is successful, -1 if the key does not exist
+ */
+int esFile_KvDelete(esFile_Kv *kv, const char *key)
+{
+    if (kv == NULL || key == NULL || Lookup(kv, key, KeyHash(key, strlen(key)), NULL) == NULL)
+    {
+        return -1;
+    }
+
+    return Append(kv, KV_DEL, key, NULL, 0);
+}
+
+/*
+ * @brief Write the commit batch to the log.
+ *  All changes since the last commit are written with a single file write.
+ * @param kv 
+ * @return 0 if it is successful
+ */
+int esFile_KvCommit(esFile_Kv *kv)
+{
+    uint32_t bw = 0;
+
+    if (kv == NULL)
+    {
+        return -1;
+    }
+
+    if (kv->batchLen == 0)
+    {
+        return 0;
+    }
+
+    if (esFile_Seek(&kv->fp, kv->fp.size) != 0 ||
+        esFile_Write(&kv->fp, kv->batch, kv->batchLen, &bw) != 0 || bw != kv->batchLen)
+    {
+        ESFILE_LOG("KvCommit error: %s %d \n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    kv->batchLen = 0;
+    return 0;
+}
+
+/*
+ * @brief Run a step of the log compaction.
+ *  A compaction starts when the dead records take more space than the live
+    ones. Each step copies about budget bytes of records, so the work can be
+    spread over idle time.
+ * @param kv 
+ * @param budget 
+ * @return 1 if a compaction is in progress, 0 if it is idle, negative on error
+ */
+int esFile_KvCompactStep(esFile_Kv *kv, uint32_t budget)
+{
+    uint32_t copied = 0, length = 0, bw = 0;
+    uint8_t *rec = NULL;
+    int copy = 0;
+
+    if (kv == NULL)
+    {
+        return -1;
+    }
+
+    if (!kv->compacting)
+    {
+        if (kv->fp.size + kv->batchLen < ESFILE_KV_COMPACT_MIN || kv->fp.size + kv->batchLen - kv->liveBytes <= kv->liveBytes)
+        {
+            return 0;
+        }
+
+        if (esFile_KvCommit(kv) != 0 ||
+            esFile_Open(&kv->tmp, kv->tmpPath, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_READ | ESFILE_MODE_WRITE) != 0)
+        {
+            return -2;
+        }
+
+        kv->compactOfs = 0;
+        kv->compactStart = kv->fp.size;
+        kv->compacting = 1;
+    }
+
+    rec = kv->record;
+    while (copied < budget && kv->compactOfs < kv->fp.size)
+    {
+        if (ReadAt(kv, kv->compactOfs, rec, KV_HEADER) != 0)
+        {
+            return -2;
+        }
+
+        length = KV_HEADER + rec[1] + (rec[2] | (rec[3] << 8));
+        if (ReadAt(kv, kv->compactOfs + KV_HEADER, &rec[KV_HEADER], length - KV_HEADER) != 0)
+        {
+            return -2;
+        }
+
+        if (rec[0] == KV_PUT)
+            copy = LookupOffset(kv, KeyHash((const char *)&rec[KV_HEADER], rec[1]), kv->compactOfs) != NULL;
+        else
+            copy = kv->compactOfs >= kv->compactStart;
+
+        if (copy)
+        {
+            if (esFile_Seek(&kv->tmp, kv->tmp.size) != 0 ||
+                esFile_Write(&kv->tmp, rec, length, &bw) != 0 || bw != length)
+            {
+                ESFILE_LOG("KvCompact error: %s %d \n", __FILE__, __LINE__);
+                return -2;
+            }
+        }
+
+        kv->compactOfs += length;
+        copied += length;
+    }
+
+    if (kv->compactOfs >= kv->fp.size)
+    {
+        if (kv->batchLen > 0)
+        {
+            return esFile_KvCommit(kv) == 0 ? 1 : -2;
+        }
+
+        return FinishCompaction(kv);
+    }
+
+    return 1;
+}
+
+/*
+ * @brief Close a key-value store.
+ *  This function commits the pending changes and completes a compaction in
+    progress, which would otherwise start over after reopening.
+ * @param kv 
+ * @return 0 if it is successful
+ */
+int esFile_KvClose(esFile_Kv *kv)
+{
+    int rv = 0;
+
+    if (kv == NULL)
+    {
+        return -1;
+    }
+
+    rv = esFile_KvCommit(kv);
+    while (rv >= 0 && kv->compacting)
+    {
+        rv = esFile_KvCompactStep(kv, 0xFFFFFFFF);
+    }
+    esFile_Close(&kv->fp);
+
+    return rv < 0 ? rv : 0;
+}
+
+/*
+ * @brief Build the RAM index from the log.
+ * @param kv 
+ * @return 0 if it is successful
+ */
+static int LoadLog(esFile_Kv *kv)
+{
+    uint8_t *rec = NULL;
+    uint32_t ofs = 0, length = 0;
+    char key[ESFILE_KV_MAXKEY + 1];
+
+    rec = kv->record;
+    while (ofs < kv->fp.size)
+    {
+        if (ReadAt(kv, ofs, rec, KV_HEADER) != 0)
+        {
+            return -2;
+        }
+
+        length = KV_HEADER + rec[1] + (rec[2] | (rec[3] << 8));
+        if ((rec[0] != KV_PUT && rec[0] != KV_DEL) || rec[1] == 0 || rec[1] > ESFILE_KV_MAXKEY ||
+            length - KV_HEADER - rec[1] > ESFILE_KV_MAXVALUE || ofs + length > kv->fp.size)
+        {
+            ESFILE_LOG("Kv log is corrupted at %u: %s %d\n", ofs, __FILE__, __LINE__);
+            return -3;
+        }
+
+        if (ReadAt(kv, ofs + KV_HEADER, (uint8_t *)key, rec[1]) != 0)
+        {
+            return -2;
+        }
+        key[rec[1]] = 0;
+
+        if (rec[0] == KV_PUT)
+            Index(kv, key, ofs, length);
+        else
+            Unindex(kv, key);
+
+        ofs += length;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Add a record to the commit batch and update the index.
+ * @param kv 
+ * @param type 
+ * @param key 
+ * @param value 
+ * @param len 
+ * @return 0 if it is successful
+ */
+static int Append(esFile_Kv *kv, uint8_t type, const char *key, const void *value, uint16_t len)
+{
+    esFile_KvEntry *slot = NULL;
+    uint32_t keyLen = 0, length = 0, ofs = 0;
+    uint8_t *rec = NULL;
+
+    keyLen = strlen(key);
+    length = KV_HEADER + keyLen + len;
+    if (keyLen == 0 || keyLen > ESFILE_KV_MAXKEY || len > ESFILE_KV_MAXVALUE)
+    {
+        return -1;
+    }
+
+    if (type == KV_PUT && Lookup(kv, key, KeyHash(key, keyLen), &slot) == NULL && slot == NULL)
+    {
+        ESFILE_LOG("Kv index is full: %s %d\n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    if (kv->batchLen + length > ESFILE_KV_BATCH && esFile_KvCommit(kv) != 0)
+    {
+        return -2;
+    }
+
+    ofs = kv->fp.size + kv->batchLen;
+    rec = &kv->batch[kv->batchLen];
+    rec[0] = type;
+    rec[1] = keyLen;
+    rec[2] = len & 0xFF;
+    rec[3] = len >> 8;
+    memcpy(&rec[KV_HEADER], key, keyLen);
+    if (len > 0)
+        memcpy(&rec[KV_HEADER + keyLen], value, len);
+    kv->batchLen += length;
+
+    if (type == KV_PUT)
+        Index(kv, key, ofs, length);
+    else
+        Unindex(kv, key);
+
+    return 0;
+}
+
+/*
+ * @brief Read bytes of the log, including the uncommitted part.
+ * @param kv 
+ * @param ofs 
+ * @param buff 
+ * @param len 
+ * @return 0 if it is successful
+ */
+static int ReadAt(esFile_Kv *kv, uint32_t ofs, uint8_t *buff, uint32_t len)
+{
+    uint32_t br = 0;
+
+    if (ofs >= kv->fp.size)
+    {
+        memcpy(buff, &kv->batch[ofs - kv->fp.size], len);
+        return 0;
+    }
+
+    if (esFile_Seek(&kv->fp, ofs) != 0 || esFile_Read(&kv->fp, buff, len, &br) != 0 || br != len)
+    {
+        ESFILE_LOG("Kv read error: %s %d \n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Find the index entry of a key.
+ *  The keys of the entries with a matching hash are compared with the key of
+    their record.
+ * @param kv 
+ * @param key 
+ * @param hash 
+ * @param slot receives the free slot for a new key, may be NULL
+ * @return The entry or NULL if the key is not indexed
+ */
+static esFile_KvEntry *Lookup(esFile_Kv *kv, const char *key, uint32_t hash, esFile_KvEntry **slot)
+{
+    esFile_KvEntry *entry = NULL;
+    uint32_t keyLen = 0;
+    uint8_t header[KV_HEADER];
+    char stored[ESFILE_KV_MAXKEY];
+
+    keyLen = strlen(key);
+    if (slot)
+        *slot = NULL;
+
+    for (uint32_t i = 0; i < ESFILE_KV_SLOTS; i++)
+    {
+        entry = &kv->entries[(hash + i) % ESFILE_KV_SLOTS];
+        if (entry->state == KV_EMPTY)
+        {
+            if (slot && *slot == NULL)
+                *slot = entry;
+            break;
+        }
+
+        if (entry->state == KV_DELETED)
+        {
+            if (slot && *slot == NULL)
+                *slot = entry;
+            continue;
+        }
+
+        if (entry->hash == hash && entry->length >= KV_HEADER + keyLen &&
+            ReadAt(kv, entry->offset, header, KV_HEADER) == 0 && header[1] == keyLen &&
+            ReadAt(kv, entry->offset + KV_HEADER, (uint8_t *)stored, keyLen) == 0 && memcmp(stored, key, keyLen) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Find the index entry that refers to a record.
+ * @param kv 
+ * @param hash hash of the key of the record
+ * @param ofs offset of the record
+ * @return The entry or NULL if the record is not live
+ */
+static esFile_KvEntry *LookupOffset(esFile_Kv *kv, uint32_t hash, uint32_t ofs)
+{
+    esFile_KvEntry *entry = NULL;
+
+    for (uint32_t i = 0; i < ESFILE_KV_SLOTS; i++)
+    {
+        entry = &kv->entries[(hash + i) % ESFILE_KV_SLOTS];
+        if (entry->state == KV_EMPTY)
+        {
+            break;
+        }
+
+        if (entry->state == KV_USED && entry->hash == hash && entry->offset == ofs)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Point the index entry of a key to a new record.
+ * @param kv 
+ * @param key 
+ * @param ofs 
+ * @param length 
+ */
+static void Index(esFile_Kv *kv, const char *key, uint32_t ofs, uint16_t length)
+{
+    esFile_KvEntry *entry = NULL, *slot = NULL;
+    uint32_t hash = 0;
+
+    hash = KeyHash(key, strlen(key));
+    entry = Lookup(kv, key, hash, &slot);
+    if (entry)
+    {
+        kv->liveBytes -= entry->length;
+    }
+    else if (slot)
+    {
+        entry = slot;
+        entry->hash = hash;
+        entry->state = KV_USED;
+    }
+    else
+    {
+        ESFILE_LOG("Kv index is full: %s %d\n", __FILE__, __LINE__);
+        return;
+    }
+
+    entry->offset = ofs;
+    entry->length = length;
+    kv->liveBytes += length;
+}
+
+/*
+ * @brief Remove a key from the index.
+ * @param kv 
+ * @param key 
+ */
+static void Unindex(esFile_Kv *kv, const char *key)
+{
+    esFile_KvEntry *entry = NULL;
+
+    entry = Lookup(kv, key, KeyHash(key, strlen(key)), NULL);
+    if (entry)
+    {
+        kv->liveBytes -= entry->length;
+        entry->state = KV_DELETED;
+    }
+}
+
+/*
+ * @brief Replace the old log with the compacted one.
+ * @param kv 
+ * @return 0 if it is successful
+ */
+static int FinishCompaction(esFile_Kv *kv)
+{
+    esFile_Close(&kv->tmp);
+    esFile_Close(&kv->fp);
+    kv->compacting = 0;
+
+    if (esFile_Remove(kv->path) != 0 || esFile_Rename(kv->tmpPath, kv->path) != 0 ||
+        esFile_Open(&kv->fp, kv->path, ESFILE_MODE_READ | ESFILE_MODE_WRITE) != 0)
+    {
+        ESFILE_LOG("KvCompact error: %s %d \n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    memset(kv->entries, 0, sizeof(kv->entries));
+    kv->liveBytes = 0;
+
+    return LoadLog(kv);
+}
+
+/*
+ * @brief Hash a key (FNV-1a).
+ * @param key 
+ * @param len 
+ * @return hash
+ */
+static uint32_t KeyHash(const char *key, uint32_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        hash = (hash ^ (uint8_t)key[i]) * 16777619u;
+    }
+
+    return hash;
+}
\ No newline at end of file
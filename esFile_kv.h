@@ -0,0 +1,51 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_KV_H__
+#define ESFILE_KV_H__
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+    uint16_t length;
+    uint8_t state;
+} esFile_KvEntry;
+
+typedef struct {
+    esFile_FileDescriptor fp;
+    esFile_FileDescriptor tmp;
+    char path[64];
+    char tmpPath[64];
+    esFile_KvEntry entries[ESFILE_KV_SLOTS];
+    uint8_t batch[ESFILE_KV_BATCH];
+    uint8_t record[4 + ESFILE_KV_MAXKEY + ESFILE_KV_MAXVALUE];
+    uint32_t batchLen;
+    uint32_t liveBytes;
+    uint32_t compactOfs;
+    uint32_t compactStart;
+    uint8_t compacting;
+} esFile_Kv;
+
+int esFile_KvOpen(esFile_Kv *kv, const char *path);
+int esFile_KvGet(esFile_Kv *kv, const char *key, void *value, uint16_t size);
+int esFile_KvPut(esFile_Kv *kv, const char *key, const void *value, uint16_t len);
+int esFile_KvDelete(esFile_Kv *kv, const char *key);
+int esFile_KvCommit(esFile_Kv *kv);
+int esFile_KvCompactStep(esFile_Kv *kv, uint32_t budget);
+int esFile_KvClose(esFile_Kv *kv);
+
+#endif
\ No newline at end of file
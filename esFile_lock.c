@@ -0,0 +1,356 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_lock.h"
+
+typedef struct {
+    uint8_t did;
+    uint32_t uid;
+    uint16_t readers;
+    uint8_t writers;
+    uint8_t writing;
+} esFile_FileLockEntry;
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+#include <pthread.h>
+
+static pthread_mutex_t locks[ESFILE_LOCK_COUNT];
+static pthread_cond_t lockConds[ESFILE_LOCK_COUNT];
+static pthread_mutex_t fileLockMutex;
+static pthread_cond_t fileLockCond;
+static pthread_once_t lockOnce = PTHREAD_ONCE_INIT;
+
+static void LockSetup(void);
+#elif ESFILE_LOCK == ESFILE_LOCK_PORT
+static void *locks[ESFILE_LOCK_COUNT + 1];
+#else
+static volatile uint32_t lockDepth;
+#endif
+
+#if ESFILE_LOCK != ESFILE_LOCK_INTERRUPTS
+static esFile_FileLockEntry fileLocks[ESFILE_FILE_LOCKS];
+
+static esFile_FileLockEntry *FileLockEntry(uint8_t did, uint32_t uid);
+static void FileLockTable(uint8_t lock);
+static void FileLockWait(void);
+#endif
+
+/*
+ * @brief Create the locks of the file system.
+ *  This is done by esFile_Init and esFile_RegisterDrive, before the file
+    system is used by several tasks.
+ */
+void esFile_LockInit(void)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_once(&lockOnce, LockSetup);
+#elif ESFILE_LOCK == ESFILE_LOCK_PORT
+    for (int i = 0; i <= ESFILE_LOCK_COUNT; i++)
+    {
+        if (locks[i] == NULL)
+        {
+            locks[i] = MutexCreate();
+        }
+    }
+#endif
+}
+
+/*
+ * @brief Take a lock of the file system.
+ *  There is one lock per drive, held by the public functions for the whole
+    operation on that drive, and a shared lock taken for the short sections
+    which change the state shared by the drives, like the sector cache. No
+    device is accessed under the shared lock. The device functions of a drive
+    are called under its device lock, so they are never entered twice at the
+    same time, while the devices of different drives work in parallel.
+    The locks are taken in this order, so they can not deadlock: drive,
+    compression or wear, shared, device. All locks are recursive, a public
+    function may call another one.
+    ESFILE_LOCK selects the implementation: pthread mutexes on the host,
+    MutexCreate/MutexLock/MutexUnlock of the port, which must provide
+    recursive mutexes, or disabling the interrupts as a last resort.
+ * @param id drive ID or one of the ESFILE_LOCK_ values
+ */
+void esFile_Lock(uint8_t id)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_once(&lockOnce, LockSetup);
+    pthread_mutex_lock(&locks[id]);
+#elif ESFILE_LOCK == ESFILE_LOCK_PORT
+    MutexLock(locks[id]);
+#else
+    ENTER_CRITICAL();
+    lockDepth++;
+#endif
+}
+
+/*
+ * @brief Release a lock of the file system.
+ * @param id drive ID or one of the ESFILE_LOCK_ values
+ */
+void esFile_Unlock(uint8_t id)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_mutex_unlock(&locks[id]);
+#elif ESFILE_LOCK == ESFILE_LOCK_PORT
+    MutexUnlock(locks[id]);
+#else
+    if (--lockDepth == 0)
+    {
+        LEAVE_CRITICAL();
+    }
+#endif
+}
+
+/*
+ * @brief Wait until another task changes the state guarded by a lock.
+ *  The lock is released while waiting and taken again before returning, so it
+    must be held exactly once. The port has no condition variable, so there
+    the task yields and the caller checks again. When the interrupts are the
+    lock nothing runs in parallel, so there is nothing to wait for.
+ * @param id one of the ESFILE_LOCK_ values
+ */
+void esFile_LockWait(uint8_t id)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_cond_wait(&lockConds[id], &locks[id]);
+#elif ESFILE_LOCK == ESFILE_LOCK_PORT
+    MutexUnlock(locks[id]);
+    TaskYield();
+    MutexLock(locks[id]);
+#else
+    (void)id;
+#endif
+}
+
+/*
+ * @brief Wake the tasks waiting for a change of the state guarded by a lock.
+ * @param id one of the ESFILE_LOCK_ values
+ */
+void esFile_LockWake(uint8_t id)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_cond_broadcast(&lockConds[id]);
+#else
+    (void)id;
+#endif
+}
+
+/*
+ * @brief Take the locks of all drives.
+ *  This is used by the operations which span every drive, like mounting.
+ */
+void esFile_LockAll(void)
+{
+    for (int i = 0; i < ESFILE_MAX_DRIVES; i++)
+    {
+        esFile_Lock(i);
+    }
+}
+
+/*
+ * @brief Release the locks of all drives.
+ */
+void esFile_UnlockAll(void)
+{
+    for (int i = ESFILE_MAX_DRIVES - 1; i >= 0; i--)
+    {
+        esFile_Unlock(i);
+    }
+}
+
+/*
+ * @brief Take the reader/writer lock of a file.
+ *  Readers of a file do not take the lock of its drive, only this lock, so
+    tasks reading different files, or the same file through several
+    descriptors, run in parallel with each other and with the writers of other
+    files of the drive. A writer excludes the readers of the file it modifies
+    only. Waiting writers stop new readers from coming in, so a busy file
+    can not starve its writer. The file locks are not recursive and the shared
+    lock must not be held while one is taken. When the interrupts are the lock
+    this is the lock of the drive.
+ * @param did 
+ * @param uid 
+ * @param exclusive 1 for a writer, 0 for a reader
+ */
+void esFile_FileLock(uint8_t did, uint32_t uid, uint8_t exclusive)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_INTERRUPTS
+    esFile_Lock(did);
+#else
+    esFile_FileLockEntry *entry = NULL;
+
+    FileLockTable(1);
+
+    while ((entry = FileLockEntry(did, uid)) == NULL)
+    {
+        FileLockWait();
+    }
+
+    if (exclusive)
+    {
+        entry->writers++;
+        while (entry->writing || entry->readers)
+        {
+            FileLockWait();
+        }
+        entry->writing = 1;
+    }
+    else
+    {
+        while (entry->writers)
+        {
+            FileLockWait();
+            while ((entry = FileLockEntry(did, uid)) == NULL)
+            {
+                FileLockWait();
+            }
+        }
+        entry->readers++;
+    }
+
+    FileLockTable(0);
+#endif
+}
+
+/*
+ * @brief Release the reader/writer lock of a file.
+ * @param did 
+ * @param uid 
+ * @param exclusive as it was taken
+ */
+void esFile_FileUnlock(uint8_t did, uint32_t uid, uint8_t exclusive)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_INTERRUPTS
+    esFile_Unlock(did);
+#else
+    esFile_FileLockEntry *entry = NULL;
+
+    FileLockTable(1);
+
+    entry = FileLockEntry(did, uid);
+    if (exclusive)
+    {
+        entry->writing = 0;
+        entry->writers--;
+    }
+    else
+    {
+        entry->readers--;
+    }
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_cond_broadcast(&fileLockCond);
+#endif
+    FileLockTable(0);
+#endif
+}
+
+#if ESFILE_LOCK != ESFILE_LOCK_INTERRUPTS
+/*
+ * @brief Find the entry of a file in the file lock table.
+ *  An entry is in use while the file has readers or writers. A free entry is
+    given to the file when it has none.
+ * @param did 
+ * @param uid 
+ * @return The entry or NULL if the table is full
+ */
+static esFile_FileLockEntry *FileLockEntry(uint8_t did, uint32_t uid)
+{
+    esFile_FileLockEntry *unused = NULL;
+
+    for (int i = 0; i < ESFILE_FILE_LOCKS; i++)
+    {
+        if (fileLocks[i].readers == 0 && fileLocks[i].writers == 0)
+        {
+            if (unused == NULL)
+                unused = &fileLocks[i];
+        }
+        else if (fileLocks[i].did == did && fileLocks[i].uid == uid)
+        {
+            return &fileLocks[i];
+        }
+    }
+
+    if (unused)
+    {
+        unused->did = did;
+        unused->uid = uid;
+    }
+
+    return unused;
+}
+
+/*
+ * @brief Take or release the mutex of the file lock table.
+ * @param lock 1 to take it, 0 to release it
+ */
+static void FileLockTable(uint8_t lock)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_once(&lockOnce, LockSetup);
+    if (lock)
+        pthread_mutex_lock(&fileLockMutex);
+    else
+        pthread_mutex_unlock(&fileLockMutex);
+#else
+    if (lock)
+        MutexLock(locks[ESFILE_LOCK_COUNT]);
+    else
+        MutexUnlock(locks[ESFILE_LOCK_COUNT]);
+#endif
+}
+
+/*
+ * @brief Wait for a change in the file lock table.
+ *  The mutex of the table is released while waiting. The port has no
+    condition variable, so there the task yields and checks again.
+ */
+static void FileLockWait(void)
+{
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+    pthread_cond_wait(&fileLockCond, &fileLockMutex);
+#else
+    FileLockTable(0);
+    TaskYield();
+    FileLockTable(1);
+#endif
+}
+#endif
+
+#if ESFILE_LOCK == ESFILE_LOCK_PTHREAD
+/*
+ * @brief Create the recursive mutexes on the first use.
+ */
+static void LockSetup(void)
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for (int i = 0; i < ESFILE_LOCK_COUNT; i++)
+    {
+        pthread_mutex_init(&locks[i], &attr);
+        pthread_cond_init(&lockConds[i], NULL);
+    }
+    pthread_mutexattr_destroy(&attr);
+
+    pthread_mutex_init(&fileLockMutex, NULL);
+    pthread_cond_init(&fileLockCond, NULL);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,37 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_LOCK_H__
+#define ESFILE_LOCK_H__
+
+#define ESFILE_LOCK_SHARED ESFILE_MAX_DRIVES
+#define ESFILE_LOCK_WEAR (ESFILE_MAX_DRIVES + 1)
+#define ESFILE_LOCK_DEVICE(did) (ESFILE_MAX_DRIVES + 2 + (did))
+#define ESFILE_LOCK_COMPRESS(did) (2 * ESFILE_MAX_DRIVES + 2 + (did) % ESFILE_COMPRESS_SETS)
+#define ESFILE_LOCK_COUNT (3 * ESFILE_MAX_DRIVES + 2)
+
+void esFile_LockInit(void);
+void esFile_Lock(uint8_t id);
+void esFile_Unlock(uint8_t id);
+void esFile_LockWait(uint8_t id);
+void esFile_LockWake(uint8_t id);
+void esFile_LockAll(void);
+void esFile_UnlockAll(void);
+void esFile_FileLock(uint8_t did, uint32_t uid, uint8_t exclusive);
+void esFile_FileUnlock(uint8_t did, uint32_t uid, uint8_t exclusive);
+
+#endif
\ No newline at end of file
@@ -21,8 +21,13 @@
 #include "esFile_disk.h"
 #include "esFile_remove.h"
 #include "esFile_open.h"
+#include "esFile_lock.h"
+#include "esFile_cryption.h"
 #include "esFile_seek.h"
 
+static uint8_t IsEncryptedMode(int did, uint16_t mode);
+static int StartFile(int did, esFile_FileInfo *fi, int infoLoc, uint16_t mode);
+
 /*
  * @brief Open/Create a file for reading or/and writing.
  *  This function opens a file at the specified file path using the given mode.
@@ -30,12 +35,14 @@
  * @param fp 
  * @param path 
  * @param mode 
- * @return 0 if it is successful 
+ * @return 0 if it is successful, -2 for an encrypted file while no key is set
  */
-int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint8_t mode)
+int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint16_t mode)
 {
     esFile_FileInfo fi;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
+    uint32_t uid = 0;
+    uint8_t encrypted = 0;
     int rv = -1, did = 0, infoLoc = 0;
 
     if (fp == NULL || path == NULL)
@@ -43,47 +50,79 @@ int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint8_t mode)
         return -1;
     }
 
-    ENTER_CRITICAL();
-    
     did = esFile_DiskDriveIdFromPath(path);
-    fs = esFile_GetFileSystems();
+
+    esFile_Lock(did);
+
+    vols = esFile_GetVolumes();
 
     infoLoc = esFile_GetFileInfo(did, path, &fi);
+    if (mode & ESFILE_MODE_CREATE_NEW || mode & ESFILE_MODE_CREATE_ALWAYS)
+        encrypted = IsEncryptedMode(did, mode);
+    else
+        encrypted = (infoLoc >= 0) ? fi.encrypted : 0;
+
+    if (encrypted && !esFile_CryptReady())
+    {
+        // An all zero key would give away the data of the file
+        ESFILE_LOG("Crypt key is not set: %s %d\n", __FILE__, __LINE__);
+        esFile_Unlock(did);
+        return -2;
+    }
+
     if (mode & ESFILE_MODE_CREATE_NEW || mode & ESFILE_MODE_CREATE_ALWAYS)
     {
         if (infoLoc >= 0)
         {
+            // Wait for the readers of the old data to leave before it goes
+            uid = fi.uid;
+            esFile_FileLock(did, uid, 1);
+
             fi.uid = esFile_GenerateUid(did);
             fi.size = 0;
+            fi.encrypted = IsEncryptedMode(did, mode);
+            fi.recordSize = 0;
+            fi.capacity = 0;
+            fi.head = 0;
+            fi.lap = 0;
 
             esFile_ReleaseSectors(did, &fi);
-            esFile_SetSectorFlag(did, fi.startSector, 1);
-
-            esFile_DataSectorHeader dsh = {infoLoc, fi.uid, 0, 0};
-            esFile_UpdateDataSectorHeader(did, fi.startSector, &dsh);
+            if (fi.flags & ESFILE_FLAG_PACKED)
+            {
+                fi.startSector = 0;
+                fi.packOffset = 0;
+            }
+            if (StartFile(did, &fi, infoLoc, mode) == 0)
+            {
+                esFile_WriteFileInfo(did, &fi, infoLoc);
+            }
+            else
+            {
+                // The old data is gone, leave an empty inline file behind
+                ESFILE_LOG("Disk Full: %s %d\n", __FILE__, __LINE__);
+                fi.startSector = 0;
+                fi.flags = ESFILE_FLAG_INLINE;
+                esFile_WriteFileInfo(did, &fi, infoLoc);
+                infoLoc = -1;
+            }
 
-            esFile_WriteFileInfo(did, &fi, infoLoc);
+            esFile_FileUnlock(did, uid, 1);
         }
         else
         {
             infoLoc = esFile_GetFreeFileInfoIndex(did);
             if (infoLoc >= 0)
             {
-                int freesector = esFile_GetFreeSector(did);
-                if (freesector > 0)
-                {
-                    memset(&fi, 0, sizeof(esFile_FileInfo));
-                    strcpy(fi.name, path);
-                    fi.uid = esFile_GenerateUid(did);
-                    fi.startSector = freesector;
-                    fi.encrypted = 1;
-
-                    esFile_DataSectorHeader dsh = {infoLoc, fi.uid, 0, 0};
-                    esFile_UpdateDataSectorHeader(did, fi.startSector, &dsh);
+                memset(&fi, 0, sizeof(esFile_FileInfo));
+                strcpy(fi.name, path);
+                fi.uid = esFile_GenerateUid(did);
+                fi.encrypted = IsEncryptedMode(did, mode);
 
+                if (StartFile(did, &fi, infoLoc, mode) == 0)
+                {
                     esFile_WriteFileInfo(did, &fi, infoLoc);
 
-                    fs[did].filecount++;
+                    vols[did].fs.filecount++;
                 }
                 else
                 {
@@ -107,8 +146,16 @@ int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint8_t mode)
         fp->size = fi.size;
         fp->index = 0;
         fp->currentSector = fi.startSector;
-        fp->sectorIndex = sizeof(esFile_DataSectorHeader);
         fp->encrypted = fi.encrypted;
+        fp->compressed = (fi.flags & ESFILE_FLAG_COMPRESSED) ? 1 : 0;
+        fp->block = 0;
+        fp->packOffset = (fi.flags & ESFILE_FLAG_PACKED) ? fi.packOffset : 0;
+        fp->packSize = (fi.flags & ESFILE_FLAG_PACKED) ? fi.capacity : 0;
+        fp->sectorIndex = (fp->compressed || fp->sector == 0 || fp->packSize) ? 0 : sizeof(esFile_DataSectorHeader);
+        fp->capacity = (fi.flags & ESFILE_FLAG_RING) ? fi.capacity : 0;
+        fp->head = fi.head;
+        fp->lap = fi.lap;
+        fp->recordSize = (fi.flags & ESFILE_FLAG_RECORDS) ? fi.recordSize : 0;
 
         if (mode & ESFILE_MODE_OPEN_APPEND)
         {
@@ -118,6 +165,98 @@ int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint8_t mode)
         rv = 0;
     }
 
-    LEAVE_CRITICAL();
+    esFile_Unlock(did);
     return rv;
 }
+
+/*
+ * @brief Set whether new files of a drive are encrypted by default.
+ *  This function selects the encryption of the files created on a drive
+    without ESFILE_MODE_PLAIN or ESFILE_MODE_ENCRYPTED in their open mode.
+ * @param did 
+ * @param encrypted 
+ * @return 0 if it is successful
+ */
+int esFile_SetDefaultEncryption(uint8_t did, uint8_t encrypted)
+{
+    if (did >= esFile_GetDriveCount())
+    {
+        return -1;
+    }
+
+    esFile_GetVolumes()[did].options.encrypt = encrypted ? 1 : 0;
+    return 0;
+}
+
+/*
+ * @brief Decide whether a file created with an open mode is encrypted.
+ * @param did 
+ * @param mode 
+ * @return 1 if the file is encrypted
+ */
+static uint8_t IsEncryptedMode(int did, uint16_t mode)
+{
+    if (mode & ESFILE_MODE_PLAIN)
+    {
+        return 0;
+    }
+
+    if (mode & ESFILE_MODE_ENCRYPTED)
+    {
+        return 1;
+    }
+
+    return esFile_GetVolumes()[did].options.encrypt;
+}
+
+/*
+ * @brief Give a new or truncated file the place where its data starts.
+ *  Plain files start inline in their file info slot and get a data chain
+    once they grow beyond it. Other files get a first data sector, reusing the
+    one of a truncated file if it had any.
+ * @param did 
+ * @param fi 
+ * @param infoLoc 
+ * @param mode 
+ * @return 0 if it is successful
+ */
+static int StartFile(int did, esFile_FileInfo *fi, int infoLoc, uint16_t mode)
+{
+    esFile_DataSectorHeader dsh;
+    int sno = fi->startSector;
+
+    fi->flags = (mode & ESFILE_MODE_COMPRESSED) ? ESFILE_FLAG_COMPRESSED : 0;
+
+    if (ESFILE_INLINE_FILES && !(mode & ESFILE_MODE_COMPRESSED))
+    {
+        fi->startSector = 0;
+        fi->flags |= ESFILE_FLAG_INLINE;
+        return 0;
+    }
+
+    if (sno > 0)
+    {
+        // The sector was just released, its discard must not reach the disk
+        esFile_CacheDiscardClaim(did, sno, 1);
+        esFile_SetSectorFlag(did, sno, 1);
+    }
+    else
+    {
+        sno = esFile_GetFreeSector(did);
+    }
+
+    if (sno <= 0)
+    {
+        return -1;
+    }
+
+    fi->startSector = sno;
+
+    dsh.infoLoc = infoLoc;
+    dsh.uid = fi->uid;
+    dsh.presector = 0;
+    dsh.nextsector = 0;
+    dsh.rfu = 0;
+    esFile_UpdateDataSectorHeader(did, fi->startSector, &dsh);
+    return 0;
+}
\ No newline at end of file
@@ -18,6 +18,11 @@
 #ifndef ESFILE_OPEN_H__
 #define ESFILE_OPEN_H__
 
+/*
+ * The open mode is 16 bits wide since ESFILE_MODE_COMPRESSED was added, the
+ * 8-bit modes had no bit left for it. esFile_Open and esFile_OpenAsync take a
+ * uint16_t mode, so the code calling them must be rebuilt against this header.
+ */
 #define	ESFILE_MODE_READ			0x01
 #define	ESFILE_MODE_WRITE			0x02
 #define	ESFILE_MODE_OPEN_EXISTING	0x00
@@ -25,6 +30,9 @@
 #define	ESFILE_MODE_CREATE_ALWAYS	0x08
 #define	ESFILE_MODE_OPEN_ALWAYS		0x10
 #define	ESFILE_MODE_OPEN_APPEND		0x30
+#define	ESFILE_MODE_PLAIN			0x40
+#define	ESFILE_MODE_ENCRYPTED		0x80
+#define	ESFILE_MODE_COMPRESSED		0x100
 
 typedef struct {
     uint8_t did;
@@ -36,8 +44,17 @@ typedef struct {
     uint16_t currentSector;
     uint16_t sectorIndex;
     uint8_t encrypted;
+    uint8_t compressed;
+    uint16_t block;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t lap;
+    uint16_t recordSize;
+    uint16_t packOffset;
+    uint16_t packSize;
 } esFile_FileDescriptor;
 
-int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint8_t mode);
+int esFile_Open(esFile_FileDescriptor *fp, const char *path, uint16_t mode);
+int esFile_SetDefaultEncryption(uint8_t did, uint8_t encrypted);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,664 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_disk.h"
+#include "esFile_open.h"
+#include "esFile_cryption.h"
+#include "esFile_crc.h"
+#include "esFile_read.h"
+#include "esFile_inline.h"
+#include "esFile_pack.h"
+
+typedef struct {
+    uint16_t sector;
+    uint16_t top;
+    uint16_t live;
+} esFile_PackSector;
+
+static esFile_PackSector packs[ESFILE_MAX_DRIVES][ESFILE_PACK_SECTORS];
+
+static uint32_t PackLimit(uint8_t did);
+static esFile_PackSector *PackFind(uint8_t did, uint16_t sno);
+static esFile_PackSector *PackAllocate(uint8_t did, uint32_t size);
+static int GrowInPlace(esFile_FileDescriptor *fp, uint32_t size);
+static int MoveToPack(esFile_FileDescriptor *fp, uint32_t size);
+static int ReadSmallData(esFile_FileDescriptor *fp, uint8_t *dest);
+
+/*
+ * @brief Initialize the pack sector table.
+ *  The table is rebuilt from the file infos while the drives are mounted.
+    Each drive has its own part of the table, which is only used under the
+    lock of the drive.
+ */
+void esFile_PackInit(void)
+{
+    memset(packs, 0, sizeof(packs));
+}
+
+/*
+ * @brief Read data from a packed file.
+ *  A packed file keeps its data in a region of a data sector shared with
+    other small files. The region is addressed by the start sector, the pack
+    offset and the capacity in the file info.
+ * @param fp 
+ * @param buff 
+ * @param btr 
+ * @param br 
+ * @return 0 if it is successful
+ */
+int esFile_PackRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br)
+{
+    esFile_DataSectorHeader dsh;
+    uint32_t chunk = 0;
+
+    chunk = (fp->index < fp->size) ? fp->size - fp->index : 0;
+    if (chunk > btr)
+        chunk = btr;
+
+    if (esFile_CacheRead(fp->did, fp->sector, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    if (dsh.uid != ESFILE_PACK_UID)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (buff && chunk > 0)
+    {
+        if (esFile_GetVolumes()[fp->did].options.verifyCrc && dsh.rfu != 0 && esFile_VerifySector(fp, &dsh, NULL) != 0)
+        {
+            ESFILE_LOG("Checksum error %d %d: %s %d\n", fp->did, fp->sector, __FILE__, __LINE__);
+            return -5;
+        }
+
+        if (esFile_CacheRead(fp->did, fp->sector, (uint8_t *)buff, sizeof(esFile_DataSectorHeader) + fp->packOffset + fp->index, chunk) != 0)
+        {
+            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            return -3;
+        }
+
+        if (fp->encrypted)
+        {
+            esFile_Decypt(fp->uid, 0, fp->index, (uint8_t *)buff, chunk);
+        }
+    }
+
+    fp->index += chunk;
+    if (br)
+        *br = chunk;
+
+    return 0;
+}
+
+/*
+ * @brief Write data to a packed file.
+ *  The data must fit in the region of the file, it is grown with
+    esFile_PackReserve first. The shared sector is rewritten with its checksum.
+ * @param fp 
+ * @param buff data to write, NULL writes zeros
+ * @param btw 
+ * @param bw 
+ * @return 0 if it is successful
+ */
+int esFile_PackWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    uint8_t *buffer = NULL, *data = NULL;
+    uint32_t payload = 0;
+
+    if (fp->index + btw > fp->packSize)
+    {
+        return -1;
+    }
+
+    dInfos = esFile_GetDriveInfos();
+    buffer = esFile_GetDiskBuffer(fp->did);
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    if (esFile_CacheReadSector(fp->did, fp->sector, buffer) != 0)
+    {
+        ESFILE_LOG("DiskRead error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        return -3;
+    }
+
+    memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
+    if (dsh.uid != ESFILE_PACK_UID)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    data = &buffer[sizeof(esFile_DataSectorHeader) + fp->packOffset + fp->index];
+    if (buff)
+        memcpy(data, buff, btw);
+    else
+        memset(data, 0, btw);
+
+    if (fp->encrypted)
+    {
+        esFile_Encypt(fp->uid, 0, fp->index, data, btw);
+    }
+
+    dsh.rfu = esFile_GetVolumes()[fp->did].options.verifyCrc ? esFile_PayloadChecksum(&buffer[sizeof(esFile_DataSectorHeader)], payload) : 0;
+    memcpy(buffer, &dsh, sizeof(esFile_DataSectorHeader));
+
+    if (esFile_CacheWrite(fp->did, fp->sector, buffer, 0, dInfos[fp->did].sectorCapacity) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        return -2;
+    }
+
+    fp->index += btw;
+    if (fp->index > fp->size)
+    {
+        fp->size = fp->index;
+
+        esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+        fi.size = fp->size;
+        esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc);
+    }
+
+    if (bw)
+        *bw = btw;
+
+    return 0;
+}
+
+/*
+ * @brief Bring the descriptor of an inline or packed file up to date.
+ *  Another descriptor of the same file may have moved its data since the
+    last access, to another region, into a data chain or within its pack
+    sector. The old region may already belong to another file by then, so
+    the layout is reloaded from the file info before every access and the
+    caller continues on the path the data is on now. The position is never
+    beyond the payload of a sector, so it is always within the first sector
+    of a chain.
+ * @param fp 
+ * @return 0 if it is successful, -2 if the file was replaced
+ */
+int esFile_PackRefresh(esFile_FileDescriptor *fp)
+{
+    esFile_FileInfo fi;
+
+    if (esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc) != 0)
+    {
+        return -3;
+    }
+
+    if (fi.uid != fp->uid)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (fi.size > fp->size)
+        fp->size = fi.size;
+
+    fp->sector = (fi.flags & ESFILE_FLAG_INLINE) ? 0 : fi.startSector;
+    fp->currentSector = fp->sector;
+    fp->packOffset = (fi.flags & ESFILE_FLAG_PACKED) ? fi.packOffset : 0;
+    fp->packSize = (fi.flags & ESFILE_FLAG_PACKED) ? fi.capacity : 0;
+    fp->sectorIndex = (fp->sector == 0 || fp->packSize) ? 0 : sizeof(esFile_DataSectorHeader) + fp->index;
+    return 0;
+}
+
+/*
+ * @brief Make room for the data of an inline or packed file.
+ *  A file that outgrows its slot or its region gets a larger region of a pack
+    sector while it is small enough. The region grows in place when it is the
+    last one of its sector, which is the usual case for a file being written.
+    Otherwise the file moves and the region is doubled, so it only moves a few
+    times. Larger files, or files which find no room in the pack sectors, move
+    to a data chain of their own.
+ * @param fp 
+ * @param end size the file must be able to hold
+ * @return 0 if it is successful
+ */
+int esFile_PackReserve(esFile_FileDescriptor *fp, uint32_t end)
+{
+    uint32_t limit = 0, size = 0;
+
+    if (fp->sector == 0 && end <= ESFILE_INLINE_SIZE)
+    {
+        return 0;
+    }
+
+    if (fp->packSize && end <= fp->packSize)
+    {
+        return 0;
+    }
+
+    limit = PackLimit(fp->did);
+    if (end <= limit)
+    {
+        size = (end + ESFILE_PACK_GRANULE - 1) / ESFILE_PACK_GRANULE * ESFILE_PACK_GRANULE;
+        if (size > limit)
+            size = limit;
+
+        if (fp->packSize && GrowInPlace(fp, size) == 0)
+        {
+            return 0;
+        }
+
+        size = fp->packSize * 2;
+        if (size < end)
+            size = end;
+        size = (size + ESFILE_PACK_GRANULE - 1) / ESFILE_PACK_GRANULE * ESFILE_PACK_GRANULE;
+        if (size > limit)
+            size = limit;
+
+        if (MoveToPack(fp, size) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return esFile_PackPromote(fp);
+}
+
+/*
+ * @brief Move the data of an inline or packed file into a data chain.
+ *  A first data sector is allocated and filled with the data of the file,
+    then the file info is pointed at it. The data is encrypted with the key
+    stream of the first sector of a chain in all three places, so the cipher
+    text is copied as it is. The descriptor continues at the same position in
+    the new sector.
+ * @param fp 
+ * @return 0 if it is successful
+ */
+int esFile_PackPromote(esFile_FileDescriptor *fp)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    uint8_t *buffer = NULL;
+    uint32_t payload = 0;
+    int sno = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    buffer = esFile_GetDiskBuffer(fp->did);
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    sno = esFile_GetFreeSector(fp->did);
+    if (sno <= 0)
+    {
+        ESFILE_LOG("Disk Full: %s %d\n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    memset(buffer, 0, dInfos[fp->did].sectorCapacity);
+    if (fp->size > 0 && ReadSmallData(fp, &buffer[sizeof(esFile_DataSectorHeader)]) != 0)
+    {
+        esFile_SetSectorFlag(fp->did, sno, 0);
+        return -3;
+    }
+
+    memset(&dsh, 0, sizeof(dsh));
+    dsh.infoLoc = fp->infoLoc;
+    dsh.uid = fp->uid;
+    dsh.rfu = esFile_GetVolumes()[fp->did].options.verifyCrc ? esFile_PayloadChecksum(&buffer[sizeof(esFile_DataSectorHeader)], payload) : 0;
+    memcpy(buffer, &dsh, sizeof(esFile_DataSectorHeader));
+
+    if (esFile_CacheWrite(fp->did, sno, buffer, 0, dInfos[fp->did].sectorCapacity) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        esFile_SetSectorFlag(fp->did, sno, 0);
+        return -2;
+    }
+    esFile_SetChainLink(fp->did, sno, 0);
+
+    if (fp->packSize)
+    {
+        esFile_PackRelease(fp->did, fp->sector, fp->packOffset, fp->packSize);
+    }
+
+    esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+    fi.startSector = sno;
+    fi.packOffset = 0;
+    fi.capacity = 0;
+    fi.flags &= ~(ESFILE_FLAG_INLINE | ESFILE_FLAG_PACKED);
+    if (esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc) != 0)
+    {
+        return -2;
+    }
+
+    fp->sector = sno;
+    fp->currentSector = sno;
+    fp->sectorIndex = sizeof(esFile_DataSectorHeader) + fp->index;
+    fp->packOffset = 0;
+    fp->packSize = 0;
+    return 0;
+}
+
+/*
+ * @brief Account for a packed file found while a drive is mounted.
+ *  A drive never holds more pack sectors than the table has entries, so a full
+    table means the drive was written with a larger ESFILE_PACK_SECTORS. The
+    sector is not marked as used then, the mount fails instead of leaving a
+    sector that could never be released.
+ * @param did 
+ * @param fi 
+ * @return 0 if it is successful, -1 if the pack table is full
+ */
+int esFile_PackMount(uint8_t did, esFile_FileInfo *fi)
+{
+    esFile_PackSector *pack = NULL;
+
+    pack = PackFind(did, fi->startSector);
+    if (pack == NULL)
+    {
+        pack = PackFind(did, 0);
+        if (pack == NULL)
+        {
+            ESFILE_LOG("Pack table is full: %s %d\n", __FILE__, __LINE__);
+            return -1;
+        }
+
+        pack->sector = fi->startSector;
+    }
+
+    esFile_SetSectorFlag(did, fi->startSector, 1);
+    esFile_SetChainLink(did, fi->startSector, 0);
+
+    pack->live++;
+    if (pack->top < fi->packOffset + fi->capacity)
+        pack->top = fi->packOffset + fi->capacity;
+    return 0;
+}
+
+/*
+ * @brief Release the region of a packed file.
+ *  The space of a region is given back right away only when it is the last
+    one of its pack sector. Other regions are reclaimed when the last file of
+    the sector is gone and the whole sector is released.
+ * @param did 
+ * @param sno pack sector of the file
+ * @param offset offset of the region
+ * @param size size of the region
+ */
+void esFile_PackRelease(uint8_t did, uint16_t sno, uint16_t offset, uint32_t size)
+{
+    esFile_PackSector *pack = NULL;
+
+    pack = PackFind(did, sno);
+    if (pack == NULL || sno == 0)
+    {
+        ESFILE_LOG("Unknown pack sector %d: %s %d\n", sno, __FILE__, __LINE__);
+        return;
+    }
+
+    if (pack->top == offset + size)
+    {
+        pack->top = offset;
+    }
+
+    if (--pack->live == 0)
+    {
+        esFile_SetChainLink(did, sno, 0);
+        esFile_SetSectorFlag(did, sno, 0);
+        esFile_CacheRelease(did, sno);
+        memset(pack, 0, sizeof(esFile_PackSector));
+    }
+}
+
+/*
+ * @brief Largest region a file may have in a pack sector of a drive.
+ * @param did 
+ * @return The size in bytes, 0 if packing is disabled (uint32_t)
+ */
+static uint32_t PackLimit(uint8_t did)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t limit = ESFILE_PACK_MAX;
+
+    dInfos = esFile_GetDriveInfos();
+    if (limit > (dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader)) / 2)
+        limit = (dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader)) / 2;
+
+    return limit;
+}
+
+/*
+ * @brief Find the table entry of a pack sector.
+ * @param did 
+ * @param sno pack sector, 0 finds a free entry
+ * @return The entry or NULL if there is none
+ */
+static esFile_PackSector *PackFind(uint8_t did, uint16_t sno)
+{
+    for (int i = 0; i < ESFILE_PACK_SECTORS; i++)
+    {
+        if (packs[did][i].sector == sno)
+        {
+            return &packs[did][i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * @brief Find a pack sector with room for a new region.
+ *  A new pack sector is started when none of the existing ones of the drive
+    has room and the table has a free entry.
+ * @param did 
+ * @param size 
+ * @return The entry or NULL if there is no room
+ */
+static esFile_PackSector *PackAllocate(uint8_t did, uint32_t size)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_PackSector *pack = NULL;
+    uint8_t *buffer = NULL;
+    uint32_t payload = 0;
+    int sno = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    for (int i = 0; i < ESFILE_PACK_SECTORS; i++)
+    {
+        if (packs[did][i].sector != 0 && payload - packs[did][i].top >= size)
+        {
+            return &packs[did][i];
+        }
+    }
+
+    pack = PackFind(did, 0);
+    if (pack == NULL)
+    {
+        return NULL;
+    }
+
+    sno = esFile_GetFreeSector(did);
+    if (sno <= 0)
+    {
+        return NULL;
+    }
+
+    buffer = esFile_GetDiskBuffer(did);
+    memset(buffer, 0, dInfos[did].sectorCapacity);
+    memset(&dsh, 0, sizeof(dsh));
+    dsh.uid = ESFILE_PACK_UID;
+    memcpy(buffer, &dsh, sizeof(esFile_DataSectorHeader));
+
+    if (esFile_CacheWrite(did, sno, buffer, 0, dInfos[did].sectorCapacity) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", did, __FILE__, __LINE__);
+        esFile_SetSectorFlag(did, sno, 0);
+        return NULL;
+    }
+    esFile_SetChainLink(did, sno, 0);
+
+    pack->sector = sno;
+    pack->top = 0;
+    pack->live = 0;
+    return pack;
+}
+
+/*
+ * @brief Move the data of an inline or packed file into a new region.
+ * @param fp 
+ * @param size size of the new region
+ * @return 0 if it is successful
+ */
+static int MoveToPack(esFile_FileDescriptor *fp, uint32_t size)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_PackSector *pack = NULL;
+    esFile_FileInfo fi;
+    uint8_t *buffer = NULL, *data = NULL;
+    uint32_t payload = 0;
+
+    pack = PackAllocate(fp->did, size);
+    if (pack == NULL)
+    {
+        return -1;
+    }
+
+    dInfos = esFile_GetDriveInfos();
+    buffer = esFile_GetDiskBuffer(fp->did);
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    if (esFile_CacheReadSector(fp->did, pack->sector, buffer) != 0)
+    {
+        ESFILE_LOG("DiskRead error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        return -3;
+    }
+
+    data = &buffer[sizeof(esFile_DataSectorHeader) + pack->top];
+    memset(data, 0, size);
+    if (fp->size > 0 && ReadSmallData(fp, data) != 0)
+    {
+        return -3;
+    }
+
+    memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
+    dsh.rfu = esFile_GetVolumes()[fp->did].options.verifyCrc ? esFile_PayloadChecksum(&buffer[sizeof(esFile_DataSectorHeader)], payload) : 0;
+    memcpy(buffer, &dsh, sizeof(esFile_DataSectorHeader));
+
+    if (esFile_CacheWrite(fp->did, pack->sector, buffer, 0, dInfos[fp->did].sectorCapacity) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        return -2;
+    }
+
+    // The new region is taken before the old one is given back, so a file
+    // moving within its own pack sector does not release it
+    pack->live++;
+    pack->top += size;
+    if (fp->packSize)
+    {
+        esFile_PackRelease(fp->did, fp->sector, fp->packOffset, fp->packSize);
+    }
+
+    esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+    fi.startSector = pack->sector;
+    fi.packOffset = data - &buffer[sizeof(esFile_DataSectorHeader)];
+    fi.capacity = size;
+    fi.flags = (fi.flags & ~ESFILE_FLAG_INLINE) | ESFILE_FLAG_PACKED;
+    if (esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc) != 0)
+    {
+        return -2;
+    }
+
+    fp->sector = pack->sector;
+    fp->currentSector = pack->sector;
+    fp->packOffset = fi.packOffset;
+    fp->packSize = size;
+    return 0;
+}
+
+/*
+ * @brief Grow the region of a packed file without moving it.
+ *  This is possible when the region is the last one of its pack sector and
+    the sector has room after it.
+ * @param fp 
+ * @param size new size of the region
+ * @return 0 if it is successful
+ */
+static int GrowInPlace(esFile_FileDescriptor *fp, uint32_t size)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_PackSector *pack = NULL;
+    esFile_FileInfo fi;
+
+    dInfos = esFile_GetDriveInfos();
+
+    pack = PackFind(fp->did, fp->sector);
+    if (pack == NULL || pack->top != fp->packOffset + fp->packSize ||
+        fp->packOffset + size > dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader))
+    {
+        return -1;
+    }
+
+    // Bytes beyond the size of a file are never read, so the sector itself
+    // needs no rewrite
+    esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+    fi.capacity = size;
+    if (esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc) != 0)
+    {
+        return -2;
+    }
+
+    pack->top = fp->packOffset + size;
+    fp->packSize = size;
+    return 0;
+}
+
+/*
+ * @brief Read the data of an inline or packed file as it is stored.
+ * @param fp 
+ * @param dest receives the size of the file in bytes
+ * @return 0 if it is successful
+ */
+static int ReadSmallData(esFile_FileDescriptor *fp, uint8_t *dest)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    if (fp->sector == 0)
+    {
+        rv = esFile_CacheRead(fp->did, fp->infoLoc / dInfos[fp->did].sectorCapacity, dest,
+                              fp->infoLoc % dInfos[fp->did].sectorCapacity + sizeof(esFile_FileInfo), fp->size);
+    }
+    else
+    {
+        rv = esFile_CacheRead(fp->did, fp->sector, dest, sizeof(esFile_DataSectorHeader) + fp->packOffset, fp->size);
+    }
+
+    if (rv != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+    }
+
+    return rv;
+}
\ No newline at end of file
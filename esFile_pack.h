@@ -0,0 +1,32 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_PACK_H__
+#define ESFILE_PACK_H__
+
+#define ESFILE_PACK_UID 0xFFFFFFFF
+
+void esFile_PackInit(void);
+int esFile_PackRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br);
+int esFile_PackWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw);
+int esFile_PackRefresh(esFile_FileDescriptor *fp);
+int esFile_PackReserve(esFile_FileDescriptor *fp, uint32_t end);
+int esFile_PackPromote(esFile_FileDescriptor *fp);
+int esFile_PackMount(uint8_t did, esFile_FileInfo *fi);
+void esFile_PackRelease(uint8_t did, uint16_t sno, uint16_t offset, uint32_t size);
+
+#endif
\ No newline at end of file
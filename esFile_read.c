@@ -15,18 +15,30 @@
  *   limitations under the License.
  */
 
+#include "esFtl.h"
 #include "esFile_definitions.h"
 #include "esFile_system.h"
 #include "esFile_cache.h"
 #include "esFile_disk.h"
 #include "esFile_open.h"
 #include "esFile_cryption.h"
+#include "esFile_crc.h"
+#include "esFile_compress.h"
+#include "esFile_ring.h"
+#include "esFile_inline.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
 #include "esFile_read.h"
 
+static int ReadSectorDirect(esFile_FileDescriptor *fp, uint8_t *dest, esFile_DataSectorHeader *dsh);
+
 /*
  * @brief Read data from a file.
  *  This function reads data from the file located at the specified file path.
     It allows you to retrieve and work with the contents of the file.
+    Only the lock of the file is taken, so a read served by the cache goes on
+    while a writer of the same drive waits for the device. A cache miss waits
+    for the device like any other access of the drive.
  * @param fp 
  * @param buff 
  * @param btr 
@@ -36,58 +48,119 @@
 int esFile_Read(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br)
 {
     esFile_DataSectorHeader headSector;
+    esFile_CryptJob jobs[ESFILE_CRYPT_PIPELINE];
     esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL, *tmpBuff = NULL;
-    uint32_t idx = 0;
-    int rv = 0;
+    uint8_t *tmpBuff = NULL, *direct = NULL;
+    uint32_t idx = 0, payload = 0, chunk = 0;
+    int rv = 0, err = 0, jobCount = 0, n = 0, verify = 0;
 
-    if (fp == NULL)
+    if (fp == NULL || fp->recordSize)
     {
         return -1;
     }
 
-    ENTER_CRITICAL();
+    esFile_FileLock(fp->did, fp->uid, 0);
+
+    if (fp->compressed || fp->capacity)
+    {
+        rv = fp->compressed ? esFile_CompressedRead(fp, buff, btr, br) : esFile_RingRead(fp, buff, btr, br);
+        esFile_FileUnlock(fp->did, fp->uid, 0);
+        return rv;
+    }
+
+    if (fp->sector == 0 || fp->packSize)
+    {
+        // Another descriptor may have moved the data since the last access
+        rv = esFile_PackRefresh(fp);
+        if (rv == 0 && (fp->sector == 0 || fp->packSize))
+        {
+            rv = fp->packSize ? esFile_PackRead(fp, buff, btr, br) : esFile_InlineRead(fp, buff, btr, br);
+        }
+
+        if (rv != 0 || fp->sector == 0 || fp->packSize)
+        {
+            esFile_FileUnlock(fp->did, fp->uid, 0);
+            return rv;
+        }
+    }
 
-    
-    buffer = esFile_GetDiskBuffer();
     dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+    verify = esFile_GetVolumes()[fp->did].options.verifyCrc;
     
     tmpBuff = (uint8_t *)buff;
     while ((btr > 0) && (fp->index < fp->size))
     {
-        if (esFile_DiskRead(fp->did, fp->currentSector, buffer, 0, dInfos[fp->did].sectorCapacity) == 0)
+        chunk = dInfos[fp->did].sectorCapacity - fp->sectorIndex;
+        if (chunk > btr)
+            chunk = btr;
+        if (chunk > fp->size - fp->index)
+            chunk = fp->size - fp->index;
+
+        direct = NULL;
+        if (!fp->encrypted && tmpBuff && chunk == payload && idx >= sizeof(esFile_DataSectorHeader))
         {
-            memcpy(&headSector, buffer, sizeof(esFile_DataSectorHeader));
-            if (headSector.uid != fp->uid)
+            direct = &tmpBuff[idx];
+            err = ReadSectorDirect(fp, direct, &headSector);
+        }
+        else
+        {
+            err = esFile_CacheRead(fp->did, fp->currentSector, (uint8_t *)&headSector, 0, sizeof(esFile_DataSectorHeader));
+            if (err == 0 && tmpBuff && chunk > 0)
             {
-                ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
-                rv = -2;
-                break;
+                err = esFile_CacheRead(fp->did, fp->currentSector, &tmpBuff[idx], fp->sectorIndex, chunk);
             }
+        }
 
-            if (fp->encrypted)
+        if (err != 0)
+        {
+            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            rv = -3;
+            break;
+        }
+
+        if (headSector.uid != fp->uid)
+        {
+            ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+            rv = -2;
+            break;
+        }
+
+        if (verify && headSector.rfu != 0 && esFile_VerifySector(fp, &headSector, direct) != 0)
+        {
+            ESFILE_LOG("Checksum error %d %d: %s %d\n", fp->did, fp->currentSector, __FILE__, __LINE__);
+            rv = -5;
+            break;
+        }
+
+        if (fp->encrypted && tmpBuff && chunk > 0)
+        {
+            // The chunk is decrypted by the provider while the next sector is read
+            n = jobCount % ESFILE_CRYPT_PIPELINE;
+            if (jobCount >= ESFILE_CRYPT_PIPELINE && esFile_CryptWait(&jobs[n]) != 0)
             {
-                esFile_Decypt(&buffer[sizeof(esFile_DataSectorHeader)], dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader));
+                rv = -4;
+                break;
             }
 
-            for (; (fp->sectorIndex < dInfos[fp->did].sectorCapacity) && (btr > 0) && (fp->index < fp->size); fp->sectorIndex++)
+            jobs[n].data = &tmpBuff[idx];
+            jobs[n].len = chunk;
+            jobs[n].uid = fp->uid;
+            jobs[n].block = (fp->index - (fp->sectorIndex - sizeof(esFile_DataSectorHeader))) / payload;
+            jobs[n].offset = fp->sectorIndex - sizeof(esFile_DataSectorHeader);
+            if (esFile_CryptSubmit(&jobs[n], 1) != 0)
             {
-                if (tmpBuff)
-                {
-                    tmpBuff[idx] = buffer[fp->sectorIndex];
-                }
-                fp->index++;
-                idx++;
-                btr--;
+                rv = -4;
+                break;
             }
-        }
-        else
-        {
-            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-            rv = -3;
-            break;
+            jobCount++;
         }
 
+        fp->sectorIndex += chunk;
+        fp->index += chunk;
+        idx += chunk;
+        btr -= chunk;
+
         if (fp->sectorIndex >= dInfos[fp->did].sectorCapacity)
         {
             if (headSector.nextsector > 0)
@@ -102,11 +175,109 @@ int esFile_Read(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *b
         }
     }
 
+    n = jobCount > ESFILE_CRYPT_PIPELINE ? jobCount - ESFILE_CRYPT_PIPELINE : 0;
+    for (; n < jobCount; n++)
+    {
+        if (esFile_CryptWait(&jobs[n % ESFILE_CRYPT_PIPELINE]) != 0)
+            rv = -4;
+    }
+
     if (br)
         *br = idx;
 
-    LEAVE_CRITICAL();
+    esFile_FileUnlock(fp->did, fp->uid, 0);
     return rv;
 }
 
+/*
+ * @brief Read the whole payload of the current sector into the caller's buffer.
+ *  The sector is read in place, with its header landing on the bytes just
+    before the destination which were already filled by this read. Those bytes
+    are saved and restored around the transfer, so a plaintext sector travels
+    from the disk to the caller without an intermediate copy.
+ * @param fp 
+ * @param dest 
+ * @param dsh 
+ * @return 0 if it is successful
+ */
+static int ReadSectorDirect(esFile_FileDescriptor *fp, uint8_t *dest, esFile_DataSectorHeader *dsh)
+{
+    uint8_t saved[sizeof(esFile_DataSectorHeader)];
+    uint8_t *sector = dest - sizeof(esFile_DataSectorHeader);
+    int rv = 0;
+
+    memcpy(saved, sector, sizeof(saved));
+    rv = esFile_CacheReadSector(fp->did, fp->currentSector, sector);
+    memcpy(dsh, sector, sizeof(esFile_DataSectorHeader));
+    memcpy(sector, saved, sizeof(saved));
+
+    return rv;
+}
+
+/*
+ * @brief Check the payload of the current sector against its header checksum.
+ *  A payload that was read whole into the caller's buffer is checked in place.
+    Otherwise the sector is checked in the cache, where the result is remembered
+    so a sector read in small pieces is only checked once. The header is read
+    again from the same copy of the sector as the payload: a pack sector may be
+    rewritten by the writers of the other files in it meanwhile.
+ * @param fp 
+ * @param dsh 
+ * @param payload the payload if it is already in memory, NULL otherwise
+ * @return 0 if the payload matches
+ */
+int esFile_VerifySector(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint8_t *payload)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t len = 0;
+
+    if (payload)
+    {
+        dInfos = esFile_GetDriveInfos();
+        len = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+        return esFile_PayloadChecksum(payload, len) == dsh->rfu ? 0 : -1;
+    }
+
+    return esFile_CacheVerify(fp->did, fp->currentSector);
+}
+
+/*
+ * @brief Read a byte range from the payload of the current sector.
+ *  The range starts at the sector index of the descriptor and must not cross
+    the end of the sector. The sector is checked like in esFile_Read and the
+    range is decrypted before returning.
+ * @param fp 
+ * @param dsh receives the header of the current sector
+ * @param block ordinal of the key stream block of the sector
+ * @param dest destination, NULL only reads the header
+ * @param chunk 
+ * @return 0 if it is successful
+ */
+int esFile_ReadChunk(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint32_t block, uint8_t *dest, uint32_t chunk)
+{
+    if (esFile_CacheRead(fp->did, fp->currentSector, (uint8_t *)dsh, 0, sizeof(esFile_DataSectorHeader)) != 0 ||
+        (dest && chunk > 0 && esFile_CacheRead(fp->did, fp->currentSector, dest, fp->sectorIndex, chunk) != 0))
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    if (dsh->uid != fp->uid)
+    {
+        ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+        return -2;
+    }
+
+    if (dest && chunk > 0 && esFile_GetVolumes()[fp->did].options.verifyCrc && dsh->rfu != 0 && esFile_VerifySector(fp, dsh, NULL) != 0)
+    {
+        ESFILE_LOG("Checksum error %d %d: %s %d\n", fp->did, fp->currentSector, __FILE__, __LINE__);
+        return -5;
+    }
+
+    if (fp->encrypted && dest && chunk > 0)
+    {
+        esFile_Decypt(fp->uid, block, fp->sectorIndex - sizeof(esFile_DataSectorHeader), dest, chunk);
+    }
 
+    return 0;
+}
\ No newline at end of file
@@ -19,5 +19,7 @@
 #define ESFILE_READ_H__
 
 int esFile_Read(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br);
+int esFile_ReadChunk(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint32_t block, uint8_t *dest, uint32_t chunk);
+int esFile_VerifySector(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint8_t *payload);
 
 #endif
\ No newline at end of file
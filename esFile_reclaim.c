@@ -0,0 +1,175 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFtl.h"
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_disk.h"
+#include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_reclaim.h"
+
+typedef struct {
+    uint8_t phase;
+    uint8_t check;
+    uint16_t sector;
+} esFile_ReclaimJob;
+
+static esFile_ReclaimJob reclaimJob;
+
+static int IsFragmented(void);
+
+/*
+ * @brief Reset the reclamation service.
+ *  Called by the initialization of the file system, a pass in progress is
+    abandoned.
+ */
+void esFile_ReclaimInit(void)
+{
+    memset(&reclaimJob, 0, sizeof(reclaimJob));
+}
+
+/*
+ * @brief Ask the reclamation service to evaluate the NAND at its next step.
+ *  The initialization requests it after mounting, as the pages left behind
+    by an interrupted session are not counted by the release watermark.
+ */
+void esFile_ReclaimRequest(void)
+{
+    reclaimJob.check = 1;
+}
+
+/*
+ * @brief Run a step of the reclamation of the space of the NAND.
+ *  It is meant to be called in idle time. The released sectors are counted as
+    they are freed, and the NAND is only evaluated when ESFILE_RECLAIM_WATERMARK
+    of them accumulated since the last evaluation, or when it was requested.
+    If the FTL holds much more pages than the files use, the free sectors are
+    discarded a budget at a time, giving back the pages that a lost release
+    left mapped. Only if this is not enough the NAND is defragmented, by
+    esFtl_Defrag which runs to completion in a single step.
+ * @param budget number of sectors
+ * @return 1 if a reclamation is in progress, 0 if it is idle
+ */
+int esFile_ReclaimStep(uint32_t budget)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vols = NULL;
+    int rv = 1;
+
+    // The reclamation is for the FTL of the NAND drive
+    if (esFile_GetDriveCount() == 0)
+        return 0;
+
+    dInfos = esFile_GetDriveInfos();
+    vols = esFile_GetVolumes();
+
+    esFile_Lock(0);
+
+    if (reclaimJob.phase == ESFILE_RECLAIM_IDLE)
+    {
+        rv = 0;
+        if (reclaimJob.check || vols[0].releasedSectors >= ESFILE_RECLAIM_WATERMARK)
+        {
+            reclaimJob.check = 0;
+            vols[0].releasedSectors = 0;
+            if (IsFragmented())
+            {
+                reclaimJob.phase = ESFILE_RECLAIM_DISCARD;
+                reclaimJob.sector = dInfos[0].dataSectorStart;
+                rv = 1;
+            }
+        }
+    }
+    else if (reclaimJob.phase == ESFILE_RECLAIM_DISCARD)
+    {
+        while (budget > 0 && reclaimJob.sector < dInfos[0].dataSectorEnd)
+        {
+            if (!esFile_GetSectorFlag(0, reclaimJob.sector))
+            {
+                esFile_CacheRelease(0, reclaimJob.sector);
+            }
+            reclaimJob.sector++;
+            budget--;
+        }
+
+        if (reclaimJob.sector >= dInfos[0].dataSectorEnd)
+        {
+            reclaimJob.phase = IsFragmented() ? ESFILE_RECLAIM_DEFRAG : ESFILE_RECLAIM_IDLE;
+        }
+    }
+    else
+    {
+        esFile_Lock(ESFILE_LOCK_DEVICE(0));
+        esFtl_Defrag();
+        esFile_Unlock(ESFILE_LOCK_DEVICE(0));
+        reclaimJob.phase = ESFILE_RECLAIM_IDLE;
+    }
+
+    if (reclaimJob.phase == ESFILE_RECLAIM_IDLE)
+    {
+        rv = 0;
+    }
+
+    esFile_Unlock(0);
+    return rv;
+}
+
+/*
+ * @brief Get the progress of the reclamation.
+ * @param progress receives the phase and the sectors done out of the total of the pass
+ */
+void esFile_GetReclaimProgress(esFile_ReclaimProgress *progress)
+{
+    esFile_DriveInfo *dInfos = NULL;
+
+    memset(progress, 0, sizeof(esFile_ReclaimProgress));
+    if (esFile_GetDriveCount() == 0)
+        return;
+
+    dInfos = esFile_GetDriveInfos();
+
+    esFile_Lock(0);
+    progress->phase = reclaimJob.phase;
+    progress->total = dInfos[0].dataSectorEnd - dInfos[0].dataSectorStart;
+    if (reclaimJob.phase == ESFILE_RECLAIM_DISCARD)
+        progress->done = reclaimJob.sector - dInfos[0].dataSectorStart;
+    else if (reclaimJob.phase == ESFILE_RECLAIM_DEFRAG)
+        progress->done = progress->total;
+    esFile_Unlock(0);
+}
+
+/*
+ * @brief Check if the FTL holds much more pages than the files use.
+ *  The pages in use are compared with the sectors counted as used, which
+    replaces the scan of the file infos by esFile_CalcDiskUsage.
+ * @return 1 if the NAND should be reclaimed
+ */
+static int IsFragmented(void)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    int usedPages = 0, usedSectors = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    esFile_CacheDiscardFlush(0);
+    esFile_Lock(ESFILE_LOCK_DEVICE(0));
+    usedPages = esFtl_CalcUsedPages();
+    esFile_Unlock(ESFILE_LOCK_DEVICE(0));
+    usedSectors = esFile_GetVolumes()[0].usedSectors + dInfos[0].fiSectorCount;
+
+    return usedPages > (ESFTL_NANDNUMBLOCKS / 10) * ESFTL_NANDNUMPAGEBLOCK && usedSectors * 2 < usedPages;
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_RECLAIM_H__
+#define ESFILE_RECLAIM_H__
+
+#define ESFILE_RECLAIM_IDLE                 0
+#define ESFILE_RECLAIM_DISCARD              1
+#define ESFILE_RECLAIM_DEFRAG               2
+
+typedef struct {
+    uint8_t phase;
+    uint32_t done;
+    uint32_t total;
+} esFile_ReclaimProgress;
+
+void esFile_ReclaimInit(void);
+void esFile_ReclaimRequest(void);
+int esFile_ReclaimStep(uint32_t budget);
+void esFile_GetReclaimProgress(esFile_ReclaimProgress *progress);
+
+#endif
\ No newline at end of file
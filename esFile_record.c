@@ -0,0 +1,331 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_cache.h"
+#include "esFile_disk.h"
+#include "esFile_open.h"
+#include "esFile_read.h"
+#include "esFile_write.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
+#include "esFile_record.h"
+
+/*
+ * The first data sector of a record file is its index: its payload is an
+ * array of 16-bit sector numbers, entry k holding the k-th sector of records.
+ * The record sectors follow the index sector in the chain. A sector holds
+ * payload / recordSize records, so a record is never split, and record n is
+ * found with one index lookup. The file size is the record count times the
+ * record size.
+ */
+
+static int IndexEntry(esFile_FileDescriptor *fp, uint32_t k);
+static int AppendRecordSector(esFile_FileDescriptor *fp, uint32_t k);
+
+/*
+ * @brief Open a record file, creating it if it does not exist.
+ *  A record file is an array of fixed size records addressed by their number.
+    An existing file must have been created with the same record size.
+ * @param fp 
+ * @param path 
+ * @param recordSize 
+ * @return 0 if it is successful
+ */
+int esFile_OpenRecords(esFile_FileDescriptor *fp, const char *path, uint16_t recordSize)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    uint32_t payload = 0;
+    int rv = -1, did = 0, infoLoc = 0;
+
+    if (fp == NULL || path == NULL || recordSize == 0)
+    {
+        return -1;
+    }
+
+    did = esFile_DiskDriveIdFromPath(path);
+
+    esFile_Lock(did);
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    infoLoc = esFile_GetFileInfo(did, path, &fi);
+    if (infoLoc >= 0)
+    {
+        if ((fi.flags & ESFILE_FLAG_RECORDS) && fi.recordSize == recordSize)
+        {
+            rv = 0;
+        }
+        else
+        {
+            ESFILE_LOG("Record size mismatch: %s %d\n", __FILE__, __LINE__);
+        }
+    }
+    else if (recordSize <= payload)
+    {
+        rv = esFile_Open(fp, path, ESFILE_MODE_CREATE_NEW | ESFILE_MODE_READ | ESFILE_MODE_WRITE);
+        if (rv == 0 && fp->sector == 0)
+        {
+            // The index needs a data sector from the start
+            rv = esFile_PackPromote(fp);
+        }
+
+        if (rv == 0 && esFile_ReadFileInfo(did, &fi, fp->infoLoc) == 0)
+        {
+            fi.flags = ESFILE_FLAG_RECORDS;
+            fi.recordSize = recordSize;
+            esFile_WriteFileInfo(did, &fi, fp->infoLoc);
+
+            // Clear the index
+            fp->sectorIndex = sizeof(esFile_DataSectorHeader);
+            if (esFile_ReadChunk(fp, &dsh, 0, NULL, 0) != 0 || esFile_WriteChunk(fp, &dsh, 0, NULL, payload) != 0)
+            {
+                rv = -2;
+            }
+        }
+    }
+
+    esFile_Unlock(did);
+
+    if (rv == 0)
+    {
+        rv = esFile_Open(fp, path, ESFILE_MODE_READ | ESFILE_MODE_WRITE);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Read a record.
+ * @param fp 
+ * @param n record number
+ * @param record 
+ * @return 0 if it is successful, -1 if the record does not exist
+ */
+int esFile_ReadRecord(esFile_FileDescriptor *fp, uint32_t n, void *record)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t rps = 0;
+    int rv = -1, sno = 0;
+
+    if (fp == NULL || record == NULL || fp->recordSize == 0)
+    {
+        return -1;
+    }
+
+    esFile_FileLock(fp->did, fp->uid, 0);
+
+    dInfos = esFile_GetDriveInfos();
+    rps = (dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader)) / fp->recordSize;
+
+    if (n < fp->size / fp->recordSize)
+    {
+        sno = IndexEntry(fp, n / rps);
+        if (sno > 0)
+        {
+            fp->currentSector = sno;
+            fp->sectorIndex = sizeof(esFile_DataSectorHeader) + (n % rps) * fp->recordSize;
+            rv = esFile_ReadChunk(fp, &dsh, n / rps + 1, (uint8_t *)record, fp->recordSize);
+        }
+        else
+        {
+            rv = -2;
+        }
+    }
+
+    esFile_FileUnlock(fp->did, fp->uid, 0);
+    return rv;
+}
+
+/*
+ * @brief Write a record.
+ *  Writing beyond the last record extends the file; the records in between
+    read as zeros.
+ * @param fp 
+ * @param n record number
+ * @param record 
+ * @return 0 if it is successful
+ */
+int esFile_WriteRecord(esFile_FileDescriptor *fp, uint32_t n, const void *record)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    uint32_t rps = 0, count = 0, sectors = 0;
+    int rv = 0, sno = 0;
+
+    if (fp == NULL || record == NULL || fp->recordSize == 0)
+    {
+        return -1;
+    }
+
+    esFile_Lock(fp->did);
+    esFile_FileLock(fp->did, fp->uid, 1);
+
+    dInfos = esFile_GetDriveInfos();
+    rps = (dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader)) / fp->recordSize;
+    count = fp->size / fp->recordSize;
+    sectors = (count + rps - 1) / rps;
+
+    while (rv == 0 && sectors <= n / rps)
+    {
+        rv = AppendRecordSector(fp, sectors++);
+    }
+
+    if (rv == 0)
+    {
+        sno = IndexEntry(fp, n / rps);
+        if (sno > 0)
+        {
+            fp->currentSector = sno;
+            fp->sectorIndex = sizeof(esFile_DataSectorHeader) + (n % rps) * fp->recordSize;
+            rv = esFile_ReadChunk(fp, &dsh, 0, NULL, 0);
+            if (rv == 0 && esFile_WriteChunk(fp, &dsh, n / rps + 1, (const uint8_t *)record, fp->recordSize) != 0)
+            {
+                rv = -2;
+            }
+        }
+        else
+        {
+            rv = -2;
+        }
+    }
+
+    if (rv == 0 && n >= count)
+    {
+        fp->size = (n + 1) * fp->recordSize;
+        fp->index = fp->size;
+
+        esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
+        fi.size = fp->size;
+        esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc);
+    }
+
+    esFile_FileUnlock(fp->did, fp->uid, 1);
+    esFile_Unlock(fp->did);
+    return rv;
+}
+
+/*
+ * @brief Get the number of records in a record file.
+ * @param fp 
+ * @return record count, -1 if it is not a record file
+ */
+int esFile_RecordCount(esFile_FileDescriptor *fp)
+{
+    if (fp == NULL || fp->recordSize == 0)
+    {
+        return -1;
+    }
+
+    return fp->size / fp->recordSize;
+}
+
+/*
+ * @brief Look up a record sector in the index.
+ * @param fp 
+ * @param k ordinal of the record sector
+ * @return sector number, 0 if it is not allocated, negative on error
+ */
+static int IndexEntry(esFile_FileDescriptor *fp, uint32_t k)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    uint16_t sno = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    if (k >= (dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader)) / sizeof(uint16_t))
+    {
+        ESFILE_LOG("Record index is full: %s %d\n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    fp->currentSector = fp->sector;
+    fp->sectorIndex = sizeof(esFile_DataSectorHeader) + k * sizeof(uint16_t);
+    if (esFile_ReadChunk(fp, &dsh, 0, (uint8_t *)&sno, sizeof(uint16_t)) != 0)
+    {
+        return -2;
+    }
+
+    return sno;
+}
+
+/*
+ * @brief Link a new, zero filled record sector to the file and the index.
+ * @param fp 
+ * @param k ordinal of the new record sector
+ * @return 0 if it is successful
+ */
+static int AppendRecordSector(esFile_FileDescriptor *fp, uint32_t k)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    uint16_t entry = 0;
+    int last = 0, sno = 0;
+
+    dInfos = esFile_GetDriveInfos();
+
+    last = (k > 0) ? IndexEntry(fp, k - 1) : fp->sector;
+    if (last <= 0 || IndexEntry(fp, k) < 0)
+    {
+        return -2;
+    }
+
+    sno = esFile_GetFreeSector(fp->did);
+    if (sno <= 0)
+    {
+        ESFILE_LOG("Unable to write Disk Full: %s %d\n", __FILE__, __LINE__);
+        return -3;
+    }
+
+    dsh.infoLoc = fp->infoLoc;
+    dsh.uid = fp->uid;
+    dsh.presector = last;
+    dsh.nextsector = 0;
+    dsh.rfu = 0;
+    fp->currentSector = sno;
+    fp->sectorIndex = sizeof(esFile_DataSectorHeader);
+    if (esFile_WriteChunk(fp, &dsh, k + 1, NULL, dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader)) != 0)
+    {
+        esFile_SetSectorFlag(fp->did, sno, 0);
+        return -2;
+    }
+    esFile_SetChainLink(fp->did, sno, 0);
+
+    fp->currentSector = last;
+    if (esFile_ReadChunk(fp, &dsh, 0, NULL, 0) != 0)
+    {
+        return -2;
+    }
+    dsh.nextsector = sno;
+    esFile_UpdateDataSectorHeader(fp->did, last, &dsh);
+
+    entry = sno;
+    fp->currentSector = fp->sector;
+    fp->sectorIndex = sizeof(esFile_DataSectorHeader) + k * sizeof(uint16_t);
+    if (esFile_ReadChunk(fp, &dsh, 0, NULL, 0) != 0 || esFile_WriteChunk(fp, &dsh, 0, (uint8_t *)&entry, sizeof(uint16_t)) != 0)
+    {
+        return -2;
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -19,53 +19,193 @@
 #include "esFile_system.h"
 #include "esFile_disk.h"
 #include "esFile_cache.h"
+#include "esFile_open.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
 #include "esFile_remove.h"
 
+static esFile_ReleaseJob removeQueue[ESFILE_MAX_DRIVES][ESFILE_REMOVE_QUEUE];
+static uint8_t removeCount[ESFILE_MAX_DRIVES];
+
+static void RemoveDequeue(uint8_t did);
+
 /*
  * @brief Remove (delete) a file.
  *  This function deletes the file located at the specified file path. It permanently
     removes the file from the file system, and the data cannot be recovered.
+    It returns once the file is gone from its directory: the chain of the file
+    is queued and its sectors are freed by esFile_RemoveService in idle time,
+    or by the allocation when the drive runs short of free sectors. A full
+    queue frees the chain of its oldest file first.
  * @param path 
  * @return 0 if it is successful 
  */
 int esFile_Remove(const char *path)
+{
+    esFile_ReleaseJob job;
+
+    if (esFile_RemoveStart(path, &job) == 1)
+    {
+        esFile_Lock(job.did);
+
+        if (removeCount[job.did] == ESFILE_REMOVE_QUEUE)
+        {
+            esFile_ReleaseStep(&removeQueue[job.did][0], UINT32_MAX);
+            RemoveDequeue(job.did);
+        }
+        removeQueue[job.did][removeCount[job.did]++] = job;
+
+        esFile_Unlock(job.did);
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Run a step of the release of the removed files.
+ *  It is meant to be called in idle time. On every drive, at most budget
+    sectors of the chains waiting in the queue are freed.
+ * @param budget number of sectors
+ * @return 1 if there are chains left, 0 if the queues are empty
+ */
+int esFile_RemoveService(uint32_t budget)
+{
+    int rv = 0;
+
+    for (int did = 0; did < esFile_GetDriveCount(); did++)
+    {
+        esFile_Lock(did);
+
+        if (removeCount[did] && esFile_ReleaseStep(&removeQueue[did][0], budget) == 0)
+        {
+            RemoveDequeue(did);
+        }
+        if (removeCount[did])
+        {
+            rv = 1;
+        }
+
+        esFile_Unlock(did);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Free the sectors of all removed files of a drive.
+ *  The caller holds the lock of the drive.
+ * @param did 
+ * @return 1 if a sector was freed, 0 if the queue was empty
+ */
+int esFile_RemoveDrain(uint8_t did)
+{
+    int rv = removeCount[did] ? 1 : 0;
+
+    while (removeCount[did])
+    {
+        esFile_ReleaseStep(&removeQueue[did][0], UINT32_MAX);
+        RemoveDequeue(did);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Drop the queues of the removed files.
+ *  Called by the initialization of the file system. The sectors of a chain
+    which was not freed are not reached from any file info, so the mount does
+    not mark them as used.
+ */
+void esFile_RemoveInit(void)
+{
+    memset(removeCount, 0, sizeof(removeCount));
+}
+
+/*
+ * @brief Take the first chain out of the queue of a drive.
+ * @param did 
+ */
+static void RemoveDequeue(uint8_t did)
+{
+    removeCount[did]--;
+    memmove(&removeQueue[did][0], &removeQueue[did][1], removeCount[did] * sizeof(esFile_ReleaseJob));
+}
+
+/*
+ * @brief Remove a file and leave the release of its sectors to steps.
+ *  The file disappears from its directory at once, its name can be used again
+    when this returns. The sectors of its chain stay in use until they are
+    released by esFile_RemoveStep, so a long file can be deleted without
+    blocking the drive for the whole chain.
+ * @param path 
+ * @param job receives the state of the release
+ * @return 1 if there are sectors to release, 0 if the removal is complete
+ */
+int esFile_RemoveStart(const char *path, esFile_ReleaseJob *job)
 {
     uint8_t *buffer = NULL;
     esFile_DriveInfo *dInfos = NULL;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
     esFile_FileInfo fi;
-    int did = 0, infoLoc = 0;
+    uint32_t uid = 0;
+    int did = 0, infoLoc = 0, rv = 0;
+
+    memset(job, 0, sizeof(esFile_ReleaseJob));
+    did = esFile_DiskDriveIdFromPath(path);
 
-    ENTER_CRITICAL();
+    esFile_Lock(did);
 
-    buffer = esFile_GetDiskBuffer();
+    buffer = esFile_GetDiskBuffer(did);
     dInfos = esFile_GetDriveInfos();
-    
-    did = esFile_DiskDriveIdFromPath(path);
-    fs = esFile_GetFileSystems();
+    vols = esFile_GetVolumes();
     
     infoLoc = esFile_GetFileInfo(did, path, &fi);
     if (infoLoc >= 0)
     {
         int sector = infoLoc / dInfos[did].sectorCapacity;
-        if (esFile_DiskRead(did, sector, buffer, 0, dInfos[did].sectorCapacity) == 0)
-        {
-            memset(&buffer[infoLoc % dInfos[did].sectorCapacity], 0, ESFILE_FILENGTH);
-            esFile_DiskWrite(did, sector, buffer, 0, dInfos[did].sectorCapacity);
 
-            fs[did].filecount--;
+        // Wait for the readers of the file to leave before its sectors go
+        uid = fi.uid;
+        esFile_FileLock(did, uid, 1);
+
+        memset(buffer, 0, ESFILE_FILENGTH);
+        if (esFile_CacheWrite(did, sector, buffer, infoLoc % dInfos[did].sectorCapacity, ESFILE_FILENGTH) == 0)
+        {
+            vols[did].fs.filecount--;
 
             fi.uid = 0;
-            esFile_ReleaseSectors(did, &fi);
+            rv = esFile_ReleaseStart(did, &fi, job);
         }
         else
         {
-            ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+            ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
         }
+
+        esFile_FileUnlock(did, uid, 1);
     }
 
-    LEAVE_CRITICAL();
-    return 0;
+    esFile_Unlock(did);
+    return rv;
+}
+
+/*
+ * @brief Run a step of the release of the sectors of a removed file.
+ * @param job 
+ * @param budget number of sectors
+ * @return 1 if there are sectors left, 0 if the release is complete
+ */
+int esFile_RemoveStep(esFile_ReleaseJob *job, uint32_t budget)
+{
+    int rv = 0;
+
+    if (job->sno == 0)
+        return 0;
+
+    esFile_Lock(job->did);
+    rv = esFile_ReleaseStep(job, budget);
+    esFile_Unlock(job->did);
+
+    return rv;
 }
 
 /*
@@ -78,40 +218,89 @@ int esFile_Remove(const char *path)
  */
 void esFile_ReleaseSectors(uint8_t did, esFile_FileInfo *fi)
 {
-    esFile_DataSectorHeader dsh;
-    uint8_t *buffer = NULL;
-    int sno = 0;
+    esFile_ReleaseJob job;
 
-    if (!fi || did != 0)
-        return;
+    if (esFile_ReleaseStart(did, fi, &job) == 1)
+    {
+        esFile_ReleaseStep(&job, UINT32_MAX);
+    }
+}
 
-    buffer = esFile_GetDiskBuffer();
-    
-    sno = fi->startSector;
-    while (1)
+/*
+ * @brief Prepare the release of the sectors of a file.
+ *  A packed file only gives its granules back to the pack sector, this is done
+    here. The chain of a file with its own sectors is left to esFile_ReleaseStep.
+ * @param did 
+ * @param fi 
+ * @param job receives the state of the release
+ * @return 1 if there are sectors to release, 0 otherwise
+ */
+int esFile_ReleaseStart(uint8_t did, esFile_FileInfo *fi, esFile_ReleaseJob *job)
+{
+    memset(job, 0, sizeof(esFile_ReleaseJob));
+
+    if (fi && (fi->flags & ESFILE_FLAG_PACKED))
+    {
+        esFile_PackRelease(did, fi->startSector, fi->packOffset, fi->capacity);
+        return 0;
+    }
+
+    if (!fi || fi->startSector == 0)
+        return 0;
+
+    job->did = did;
+    job->uid = fi->uid;
+    job->sno = fi->startSector;
+    return 1;
+}
+
+/*
+ * @brief Release at most budget sectors of the chain of a job.
+ *  The chain is walked from the sector kept in the job, the sectors after it
+    are still marked as used so they can not be taken by a write in between.
+    The caller holds the lock of the drive.
+ * @param job 
+ * @param budget number of sectors
+ * @return 1 if there are sectors left, 0 if the release is complete
+ */
+int esFile_ReleaseStep(esFile_ReleaseJob *job, uint32_t budget)
+{
+    esFile_DataSectorHeader dsh;
+    uint8_t did = job->did;
+    int sno = job->sno, next = 0;
+
+    while (sno > 0 && budget > 0)
     {
-        if (esFile_DiskRead(did, sno, buffer, 0, sizeof(esFile_DataSectorHeader)) == 0)
+        budget--;
+        next = esFile_GetChainLink(did, sno);
+        if (next >= 0)
         {
-            memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
-            if (dsh.uid != fi->uid)
+            esFile_SetChainLink(did, sno, 0);
+            esFile_SetSectorFlag(did, sno, 0);
+            esFile_CacheRelease(did, sno);
+            sno = next;
+        }
+        else if (esFile_CacheRead(did, sno, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) == 0)
+        {
+            if (dsh.uid != job->uid)
             {
                 esFile_SetSectorFlag(did, sno, 0);
-                esFile_DiskRelease(did, sno);
-                if (dsh.nextsector > 0)
-                    sno = dsh.nextsector;
-                else
-                    break;
+                esFile_CacheRelease(did, sno);
+                sno = dsh.nextsector;
             }
             else
             {
                 ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
-                break;
+                sno = 0;
             }
         }
         else
         {
             ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-            break;
+            sno = 0;
         }
     }
+
+    job->sno = sno;
+    return sno > 0 ? 1 : 0;
 }
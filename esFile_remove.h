@@ -18,7 +18,20 @@
 #ifndef ESFILE_REMOVE_H__
 #define ESFILE_REMOVE_H__
 
+typedef struct {
+    uint8_t did;
+    uint16_t sno;
+    uint32_t uid;
+} esFile_ReleaseJob;
+
 int esFile_Remove(const char *path);
+int esFile_RemoveStart(const char *path, esFile_ReleaseJob *job);
+int esFile_RemoveStep(esFile_ReleaseJob *job, uint32_t budget);
+int esFile_RemoveService(uint32_t budget);
+int esFile_RemoveDrain(uint8_t did);
+void esFile_RemoveInit(void);
 void esFile_ReleaseSectors(uint8_t did, esFile_FileInfo *fi);
+int esFile_ReleaseStart(uint8_t did, esFile_FileInfo *fi, esFile_ReleaseJob *job);
+int esFile_ReleaseStep(esFile_ReleaseJob *job, uint32_t budget);
 
 #endif
\ No newline at end of file
@@ -21,6 +21,7 @@
 #include "esFile_cache.h"
 #include "esFile_open.h"
 #include "esFile_stat.h"
+#include "esFile_lock.h"
 #include "esFile_rename.h"
 
 /*
@@ -35,17 +36,15 @@ int esFile_Rename(const char *path_old, const char *path_new)
 {
     esFile_FileInfo fi;
     esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL;
     int did = 0, did_new = 0, infoLoc = 0, sector = 0;
 
-    ENTER_CRITICAL();
-
-    buffer = esFile_GetDiskBuffer();
-    dInfos = esFile_GetDriveInfos();
-
     did = esFile_DiskDriveIdFromPath(path_old);
     did_new = esFile_DiskDriveIdFromPath(path_new);
 
+    esFile_Lock(did);
+
+    dInfos = esFile_GetDriveInfos();
+
     if (did == did_new)
     {
         if (esFile_Stat(path_new, NULL))
@@ -54,16 +53,11 @@ int esFile_Rename(const char *path_old, const char *path_new)
             if (infoLoc >= 0)
             {
                 sector = infoLoc / dInfos[did].sectorCapacity;
-                if (esFile_DiskRead(did, sector, buffer, 0, dInfos[did].sectorCapacity) == 0)
-                {
-                    memset(fi.name, 0, sizeof(fi.name));
-                    strcpy(fi.name, path_new);
-                    memcpy(&buffer[infoLoc % dInfos[did].sectorCapacity], &fi, sizeof(esFile_FileInfo));
-                    esFile_DiskWrite(did, sector, buffer, 0, dInfos[did].sectorCapacity);
-                }
-                else
+                memset(fi.name, 0, sizeof(fi.name));
+                strcpy(fi.name, path_new);
+                if (esFile_CacheWrite(did, sector, (uint8_t *)&fi, infoLoc % dInfos[did].sectorCapacity, sizeof(esFile_FileInfo)) != 0)
                 {
-                    ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+                    ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
                 }
             }
         }
@@ -77,6 +71,6 @@ int esFile_Rename(const char *path_old, const char *path_new)
         ESFILE_LOG("Drives are not match: %s %d \n", __FILE__, __LINE__);
     }
 
-    LEAVE_CRITICAL();
+    esFile_Unlock(did);
     return 0;
 }
@@ -0,0 +1,402 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_cache.h"
+#include "esFile_disk.h"
+#include "esFile_remove.h"
+#include "esFile_open.h"
+#include "esFile_read.h"
+#include "esFile_write.h"
+#include "esFile_lock.h"
+#include "esFile_ring.h"
+
+/*
+ * A ring file owns a fixed chain of data sectors which is allocated when the
+ * file is created and never changes. Its payload bytes form a circular buffer
+ * of the file capacity: head is the ring offset of the oldest byte, size the
+ * number of valid bytes and lap the number of times the write position has
+ * wrapped. The chain itself is linear, the wrap is resolved here.
+ *
+ * The descriptor index is the logical position (0 is the oldest byte) and
+ * block is the ordinal of the current sector in the chain.
+ */
+
+static int CreateRing(uint8_t did, const char *path, uint32_t capacity);
+static int RingLocate(esFile_FileDescriptor *fp, uint32_t r);
+static uint32_t RingKeyBlock(esFile_FileDescriptor *fp, uint32_t r, uint32_t lap);
+
+/*
+ * @brief Open a ring file, creating it if it does not exist.
+ *  A new ring file gets all its sectors at once, enough for the requested
+    capacity rounded up to whole sectors. Writes to a ring file append at its
+    end and overwrite the oldest data once it is full, so logging into it never
+    allocates or releases sectors. The capacity of an existing ring file is not
+    changed.
+ * @param fp 
+ * @param path 
+ * @param capacity capacity in bytes for a new file
+ * @return 0 if it is successful
+ */
+int esFile_OpenRing(esFile_FileDescriptor *fp, const char *path, uint32_t capacity)
+{
+    esFile_FileInfo fi;
+    int rv = -1, did = 0;
+
+    if (fp == NULL || path == NULL)
+    {
+        return -1;
+    }
+
+    did = esFile_DiskDriveIdFromPath(path);
+
+    esFile_Lock(did);
+
+    if (esFile_GetFileInfo(did, path, &fi) >= 0)
+    {
+        if (fi.flags & ESFILE_FLAG_RING)
+        {
+            rv = 0;
+        }
+        else
+        {
+            ESFILE_LOG("Not a ring file: %s %d\n", __FILE__, __LINE__);
+        }
+    }
+    else
+    {
+        rv = CreateRing(did, path, capacity);
+    }
+
+    esFile_Unlock(did);
+
+    if (rv == 0)
+    {
+        rv = esFile_Open(fp, path, ESFILE_MODE_OPEN_APPEND | ESFILE_MODE_READ | ESFILE_MODE_WRITE);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Read data from a ring file.
+ * @param fp 
+ * @param buff 
+ * @param btr 
+ * @param br 
+ * @return 0 if it is successful
+ */
+int esFile_RingRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    uint8_t *tmpBuff = NULL;
+    uint32_t idx = 0, chunk = 0, r = 0, w = 0;
+    int rv = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    tmpBuff = (uint8_t *)buff;
+    w = (fp->head + fp->size) % fp->capacity;
+
+    while ((btr > 0) && (fp->index < fp->size))
+    {
+        r = (fp->head + fp->index) % fp->capacity;
+        rv = RingLocate(fp, r);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        chunk = dInfos[fp->did].sectorCapacity - fp->sectorIndex;
+        if (chunk > btr)
+            chunk = btr;
+        if (chunk > fp->size - fp->index)
+            chunk = fp->size - fp->index;
+
+        // The bytes behind the write position were written in the previous lap
+        rv = esFile_ReadChunk(fp, &dsh, RingKeyBlock(fp, r, r < w ? fp->lap : fp->lap - 1), tmpBuff ? &tmpBuff[idx] : NULL, chunk);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        fp->sectorIndex += chunk;
+        fp->index += chunk;
+        idx += chunk;
+        btr -= chunk;
+    }
+
+    if (br)
+        *br = idx;
+
+    return rv;
+}
+
+/*
+ * @brief Append data to a ring file.
+ *  When the file is full, every byte written replaces the oldest one. The ring
+    state is stored in the file info once the data is written.
+ * @param fp 
+ * @param buff 
+ * @param btw 
+ * @param bw 
+ * @return 0 if it is successful
+ */
+int esFile_RingWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_FileInfo fi;
+    const uint8_t *tmpBuff = NULL;
+    uint32_t idx = 0, chunk = 0, w = 0;
+    int rv = 0;
+
+    if (fp->index != fp->size)
+    {
+        ESFILE_LOG("Ring files can only be appended: %s %d\n", __FILE__, __LINE__);
+        return -4;
+    }
+
+    dInfos = esFile_GetDriveInfos();
+    tmpBuff = (const uint8_t *)buff;
+
+    while (btw > idx)
+    {
+        w = (fp->head + fp->size) % fp->capacity;
+        rv = RingLocate(fp, w);
+        if (rv != 0)
+        {
+            break;
+        }
+
+        chunk = dInfos[fp->did].sectorCapacity - fp->sectorIndex;
+        if (chunk > btw - idx)
+            chunk = btw - idx;
+
+        rv = esFile_ReadChunk(fp, &dsh, 0, NULL, 0);
+        if (rv == 0 && esFile_WriteChunk(fp, &dsh, RingKeyBlock(fp, w, fp->lap), tmpBuff ? &tmpBuff[idx] : NULL, chunk) != 0)
+        {
+            rv = -2;
+        }
+
+        if (rv != 0)
+        {
+            break;
+        }
+
+        fp->size += chunk;
+        if (fp->size > fp->capacity)
+        {
+            fp->head = (fp->head + fp->size - fp->capacity) % fp->capacity;
+            fp->size = fp->capacity;
+        }
+
+        if ((w + chunk) % fp->capacity == 0)
+        {
+            fp->lap++;
+        }
+
+        fp->sectorIndex += chunk;
+        idx += chunk;
+    }
+
+    fp->index = fp->size;
+
+    if (bw)
+    {
+        *bw = idx;
+    }
+
+    if (idx > 0 && esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc) == 0)
+    {
+        fi.size = fp->size;
+        fi.head = fp->head;
+        fi.lap = fp->lap;
+        esFile_WriteFileInfo(fp->did, &fi, fp->infoLoc);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Seek the cursor position within a ring file.
+ * @param fp 
+ * @param ofs logical offset, 0 is the oldest byte
+ * @return 0 if it is successful
+ */
+int esFile_RingSeek(esFile_FileDescriptor *fp, uint32_t ofs)
+{
+    int rv = 0;
+
+    if (ofs > fp->size)
+    {
+        ofs = fp->size;
+    }
+
+    rv = RingLocate(fp, (fp->head + ofs) % fp->capacity);
+    if (rv == 0)
+    {
+        fp->index = ofs;
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Create a ring file with its whole sector chain.
+ * @param did 
+ * @param path 
+ * @param capacity 
+ * @return 0 if it is successful
+ */
+static int CreateRing(uint8_t did, const char *path, uint32_t capacity)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vols = NULL;
+    esFile_FileInfo fi;
+    uint32_t payload = 0, count = 0;
+    int infoLoc = 0, sno = 0, next = 0, prev = 0, full = 0, run = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    vols = esFile_GetVolumes();
+    payload = dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    count = (capacity + payload - 1) / payload;
+    if (count == 0)
+        count = 1;
+
+    infoLoc = esFile_GetFreeFileInfoIndex(did);
+    if (infoLoc < 0)
+    {
+        ESFILE_LOG("File Limit is reached: %s %d\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    memset(&fi, 0, sizeof(esFile_FileInfo));
+    strcpy(fi.name, path);
+    fi.uid = esFile_GenerateUid(did);
+    fi.encrypted = esFile_GetVolumes()[did].options.encrypt;
+    fi.flags = ESFILE_FLAG_RING;
+    fi.capacity = count * payload;
+
+    // The whole chain is taken from one run of sectors when the drive has one
+    run = esFile_GetFreeRun(did, count);
+    sno = run > 0 ? run : esFile_GetFreeSector(did);
+    if (sno <= 0)
+    {
+        ESFILE_LOG("Disk Full: %s %d\n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    fi.startSector = sno;
+    for (uint32_t i = 0; i < count && sno > 0; i++)
+    {
+        if (i + 1 == count)
+            next = 0;
+        else
+            next = run > 0 ? sno + 1 : esFile_GetFreeSector(did);
+        if (next < 0)
+        {
+            next = 0;
+            full = 1;
+        }
+
+        dsh.infoLoc = infoLoc;
+        dsh.uid = fi.uid;
+        dsh.presector = prev;
+        dsh.nextsector = next;
+        dsh.rfu = 0;
+        esFile_UpdateDataSectorHeader(did, sno, &dsh);
+
+        prev = sno;
+        sno = next;
+    }
+
+    if (full)
+    {
+        ESFILE_LOG("Disk Full: %s %d\n", __FILE__, __LINE__);
+        fi.uid = 0;
+        esFile_ReleaseSectors(did, &fi);
+        return -1;
+    }
+
+    esFile_WriteFileInfo(did, &fi, infoLoc);
+    vols[did].fs.filecount++;
+
+    return 0;
+}
+
+/*
+ * @brief Move the sector cursor of a ring file to a ring offset.
+ * @param fp 
+ * @param r ring offset
+ * @return 0 if it is successful
+ */
+static int RingLocate(esFile_FileDescriptor *fp, uint32_t r)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t payload = 0, target = 0;
+    int next = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+    target = r / payload;
+
+    if (target < fp->block)
+    {
+        fp->currentSector = fp->sector;
+        fp->block = 0;
+    }
+
+    while (fp->block < target)
+    {
+        next = esFile_GetNextSector(fp->did, fp->currentSector);
+        if (next <= 0)
+        {
+            ESFILE_LOG("FS: FATAL ERROR: %s %d\n", __FILE__, __LINE__);
+            return -2;
+        }
+
+        fp->currentSector = next;
+        fp->block++;
+    }
+
+    fp->sectorIndex = sizeof(esFile_DataSectorHeader) + r % payload;
+    return 0;
+}
+
+/*
+ * @brief Select the key stream block of a ring offset.
+ *  Every lap gets its own key stream blocks, so overwritten data is never
+    encrypted with a key stream that was used before.
+ * @param fp 
+ * @param r ring offset
+ * @param lap lap in which the data at the offset is written
+ * @return key stream block
+ */
+static uint32_t RingKeyBlock(esFile_FileDescriptor *fp, uint32_t r, uint32_t lap)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    uint32_t payload = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+
+    return lap * (fp->capacity / payload) + r / payload;
+}
\ No newline at end of file
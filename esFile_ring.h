@@ -0,0 +1,26 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_RING_H__
+#define ESFILE_RING_H__
+
+int esFile_OpenRing(esFile_FileDescriptor *fp, const char *path, uint32_t capacity);
+int esFile_RingRead(esFile_FileDescriptor *fp, void *buff, uint32_t btr, uint32_t *br);
+int esFile_RingWrite(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw);
+int esFile_RingSeek(esFile_FileDescriptor *fp, uint32_t ofs);
+
+#endif
\ No newline at end of file
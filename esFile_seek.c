@@ -20,6 +20,11 @@
 #include "esFile_cache.h"
 #include "esFile_disk.h"
 #include "esFile_open.h"
+#include "esFile_compress.h"
+#include "esFile_ring.h"
+#include "esFile_inline.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
 #include "esFile_seek.h"
 
 /*
@@ -35,88 +40,98 @@ int esFile_Seek(esFile_FileDescriptor *fp, uint32_t ofs)
     esFile_FileInfo fi;
     esFile_DataSectorHeader headSector;
     esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL;
-    int rv = 0;
+    uint32_t payload = 0, current = 0, target = 0;
+    int rv = 0, next = 0;
 
-    if (fp == NULL)
+    if (fp == NULL || fp->recordSize)
     {
         return -1;
     }
 
-    ENTER_CRITICAL();
+    esFile_FileLock(fp->did, fp->uid, 0);
+
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
 
-    buffer = esFile_GetDiskBuffer();
-    dInfos = esFile_GetDriveInfos();    
-    
     esFile_ReadFileInfo(fp->did, &fi, fp->infoLoc);
 
-    if (fi.uid == fp->uid)
+    if (fi.uid == fp->uid && (fp->sector == 0 || fp->packSize))
+    {
+        // Another descriptor may have moved the data since the last access
+        rv = esFile_PackRefresh(fp);
+    }
+
+    if (rv == 0 && fi.uid == fp->uid && fp->compressed)
+    {
+        rv = esFile_CompressedSeek(fp, ofs);
+    }
+    else if (rv == 0 && fi.uid == fp->uid && fp->capacity)
     {
-        if (fp->index > ofs)
+        rv = esFile_RingSeek(fp, ofs);
+    }
+    else if (rv == 0 && fi.uid == fp->uid && (fp->sector == 0 || fp->packSize))
+    {
+        rv = esFile_InlineSeek(fp, ofs);
+    }
+    else if (rv == 0 && fi.uid == fp->uid)
+    {
+        current = (fp->index - (fp->sectorIndex - sizeof(esFile_DataSectorHeader))) / payload;
+        target = ofs / payload;
+
+        if (target < current)
         {
-            while (fp->index > ofs)
+            if (esFile_GetChainLink(fp->did, fp->sector) >= 0)
             {
-                if (esFile_DiskRead(fp->did, fp->currentSector, buffer, 0, sizeof(esFile_DataSectorHeader)) == 0)
+                fp->currentSector = fp->sector;
+                current = 0;
+            }
+            else
+            {
+                while (current > target)
                 {
-                    memcpy(&headSector, buffer, sizeof(esFile_DataSectorHeader));
-                    for (; (fp->sectorIndex >= sizeof(esFile_DataSectorHeader)) && (fp->index > ofs); fp->sectorIndex--)
+                    if (esFile_CacheRead(fp->did, fp->currentSector, (uint8_t *)&headSector, 0, sizeof(esFile_DataSectorHeader)) != 0)
                     {
-                        fp->index--;
+                        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+                        rv = -2;
+                        break;
                     }
-                }
-                else
-                {
-                    ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-                    rv = -2;
-                    break;
-                }
 
-                if (fp->sectorIndex < sizeof(esFile_DataSectorHeader))
-                {
-                    if (headSector.presector > 0)
-                    {
-                        fp->currentSector = headSector.presector;
-                        fp->sectorIndex = dInfos[fp->did].sectorCapacity - 1;
-                    }
-                    else
+                    if (headSector.presector == 0)
                     {
+                        ESFILE_LOG("FATAL ERROR: %s %d \n", __FILE__, __LINE__);
+                        rv = -2;
                         break;
                     }
+
+                    fp->currentSector = headSector.presector;
+                    current--;
                 }
             }
         }
-        else
+
+        while (rv == 0 && current < target)
         {
-            while (fp->index < ofs)
+            next = esFile_GetNextSector(fp->did, fp->currentSector);
+            if (next < 0)
             {
-                if (esFile_DiskRead(fp->did, fp->currentSector, buffer, 0, sizeof(esFile_DataSectorHeader)) == 0)
-                {
-                    memcpy(&headSector, buffer, sizeof(esFile_DataSectorHeader));
-                    for (; (fp->sectorIndex < dInfos[fp->did].sectorCapacity) && (fp->index < ofs); fp->sectorIndex++)
-                    {
-                        fp->index++;
-                    }
-                }
-                else
-                {
-                    ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
-                    rv = -2;
-                    break;
-                }
-
-                if (fp->sectorIndex >= dInfos[fp->did].sectorCapacity)
-                {
-                    if (headSector.nextsector > 0)
-                    {
-                        fp->currentSector = headSector.nextsector;
-                        fp->sectorIndex = sizeof(esFile_DataSectorHeader);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+                rv = -2;
+            }
+            else if (next == 0)
+            {
+                ofs = (current + 1) * payload;
+                break;
             }
+            else
+            {
+                fp->currentSector = next;
+                current++;
+            }
+        }
+
+        if (rv == 0)
+        {
+            fp->index = ofs;
+            fp->sectorIndex = sizeof(esFile_DataSectorHeader) + ofs - current * payload;
         }
     }
     else
@@ -124,6 +139,6 @@ int esFile_Seek(esFile_FileDescriptor *fp, uint32_t ofs)
         ESFILE_LOG("FATAL ERROR: %s %d \n", __FILE__, __LINE__);
     }
 
-    LEAVE_CRITICAL();
+    esFile_FileUnlock(fp->did, fp->uid, 0);
     return rv;
 }
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include "esFile_cache.h"
 #include "esFile_disk.h"
 #include "esFile_open.h"
+#include "esFile_lock.h"
 #include "esFile_stat.h"
 
 /*
@@ -41,9 +42,10 @@ int esFile_Stat(const char *path, esFile_FileInfo *info)
         return -1;
     }
 
-    ENTER_CRITICAL();
-
     did = esFile_DiskDriveIdFromPath(path);
+
+    esFile_Lock(did);
+
     infoLoc = esFile_GetFileInfo(did, path, &fi);
     if (infoLoc >= 0)
     {
@@ -53,7 +55,7 @@ int esFile_Stat(const char *path, esFile_FileInfo *info)
         rv = 0;
     }
 
-    LEAVE_CRITICAL();
+    esFile_Unlock(did);
     return rv;
 }
 
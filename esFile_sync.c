@@ -0,0 +1,50 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile_definitions.h"
+#include "esFile_system.h"
+#include "esFile_disk.h"
+#include "esFile_cache.h"
+#include "esFile_lock.h"
+#include "esFile_open.h"
+#include "esFile_write.h"
+#include "esFile_sync.h"
+
+/*
+ * @brief Persist the cached changes of all drives.
+ *  This function writes every modification that is still held in RAM by a
+    write-back cache to the disks. It should be called periodically and before
+    the power is removed.
+ * @return 0 if it is successful
+ */
+int esFile_Sync(void)
+{
+    int rv = 0;
+
+    for (int i = 0; i < esFile_GetDriveCount(); i++)
+    {
+        esFile_Lock(i);
+        esFile_SealFlush(i, 0);
+        if (esFile_CacheFlush(i) != 0)
+        {
+            rv = -1;
+        }
+        esFile_Unlock(i);
+    }
+
+    return rv;
+}
\ No newline at end of file
@@ -19,8 +19,14 @@
 #include "esFile_disk.h"
 #include "esFile_system.h"
 #include "esFile_cache.h"
+#include "esFile_remove.h"
 
 static int IsUidUsed(uint8_t did, uint32_t uid);
+static int FindFreeSectors(uint8_t did, uint32_t count);
+static int FindFreeRun(const uint32_t *table, uint32_t sno, uint32_t end, uint32_t count);
+static int FindLeastWorn(const esFile_DriveInfo *info, uint32_t cursor);
+static uint32_t NextSector(const uint32_t *table, uint32_t sno, uint32_t end, int used);
+static uint32_t TrailingZeros(uint32_t word);
 
 /*
  * @brief The size of the opened file in bytes (int)
@@ -32,14 +38,14 @@ static int IsUidUsed(uint8_t did, uint32_t uid);
 int esFile_ReadFileSystem(uint8_t did)
 {
     uint8_t *buffer = NULL;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
     
-    buffer = esFile_GetDiskBuffer();
-    fs = esFile_GetFileSystems();
+    buffer = esFile_GetDiskBuffer(did);
+    vols = esFile_GetVolumes();
 
-    if (esFile_DiskRead(did, 0, buffer, 0, sizeof(esFile_System)) == 0)
+    if (esFile_CacheRead(did, 0, buffer, 0, sizeof(esFile_System)) == 0)
     {
-        memcpy(&fs[did], buffer, sizeof(esFile_System));
+        memcpy(&vols[did].fs, buffer, sizeof(esFile_System));
         return 0;
     }
     else
@@ -61,16 +67,16 @@ int esFile_WriteFileSystem(uint8_t did)
 {
     esFile_DriveInfo *dInfos = NULL;
     uint8_t *buffer = NULL;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
 
     dInfos = esFile_GetDriveInfos();
-    buffer = esFile_GetDiskBuffer();
-    fs = esFile_GetFileSystems();
+    buffer = esFile_GetDiskBuffer(did);
+    vols = esFile_GetVolumes();
 
-    esFile_ClearDiskBuffer();
-    memcpy(buffer, &fs[did], sizeof(esFile_System));
+    esFile_ClearDiskBuffer(did);
+    memcpy(buffer, &vols[did].fs, sizeof(esFile_System));
 
-    if (esFile_DiskWrite(did, 0, buffer, 0, dInfos[did].sectorCapacity) == 0)
+    if (esFile_CacheWrite(did, 0, buffer, 0, dInfos[did].sectorCapacity) == 0)
     {
         return 0;
     }
@@ -92,12 +98,12 @@ int esFile_CalcDiskUsage(uint8_t did){
     uint8_t *buffer = NULL;
     esFile_DriveInfo *dInfos = NULL;
 
-    buffer = esFile_GetDiskBuffer();
+    buffer = esFile_GetDiskBuffer(did);
     dInfos = esFile_GetDriveInfos();
 
     for (int i = 1; i < dInfos[did].fiSectorCount; i++)
     {
-        if (esFile_DiskRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
+        if (esFile_CacheRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
         {
             for (int j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
             {
@@ -133,12 +139,12 @@ int esFile_GetFreeFileInfoIndex(uint8_t did)
     uint8_t *buffer = NULL;
     esFile_DriveInfo *dInfos = NULL;
 
-    buffer = esFile_GetDiskBuffer();
+    buffer = esFile_GetDiskBuffer(did);
     dInfos = esFile_GetDriveInfos();
 
     for (int i = 1; i < dInfos[did].fiSectorCount; i++)
     {
-        if (esFile_DiskRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
+        if (esFile_CacheRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
         {
             for (int j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
             {
@@ -170,9 +176,10 @@ int esFile_GetFreeFileInfoIndex(uint8_t did)
  */
 int esFile_GetFileInfo(uint8_t did, const char *path, esFile_FileInfo *fi)
 {
-    int rv = -1, filecount = 0;
+    uint32_t filecount = 0;
+    int rv = -1;
     uint8_t *buffer = NULL;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
     esFile_DriveInfo *dInfos = NULL;
 
     if (fi == NULL)
@@ -180,13 +187,13 @@ int esFile_GetFileInfo(uint8_t did, const char *path, esFile_FileInfo *fi)
         return -1;
     }
 
-    buffer = esFile_GetDiskBuffer();
-    fs = esFile_GetFileSystems();
+    buffer = esFile_GetDiskBuffer(did);
+    vols = esFile_GetVolumes();
     dInfos = esFile_GetDriveInfos();
 
     for (int i = 1; i < dInfos[did].fiSectorCount; i++)
     {
-        if (esFile_DiskRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
+        if (esFile_CacheRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
         {
             for (int j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
             {
@@ -202,7 +209,7 @@ int esFile_GetFileInfo(uint8_t did, const char *path, esFile_FileInfo *fi)
                     filecount++;
                 }
 
-                if (filecount >= fs[did].filecount)
+                if (filecount >= vols[did].fs.filecount)
                 {
                     return rv;
                 }
@@ -228,23 +235,19 @@ int esFile_GetFileInfo(uint8_t did, const char *path, esFile_FileInfo *fi)
  */
 int esFile_WriteFileInfo(uint8_t did, esFile_FileInfo *fi, int idx)
 {
-    uint8_t *buffer = NULL;
     esFile_DriveInfo *dInfos = NULL;
     int sector = 0;
 
-    buffer = esFile_GetDiskBuffer();
     dInfos = esFile_GetDriveInfos();
 
     sector = idx / dInfos[did].sectorCapacity;
-    if (esFile_DiskRead(did, sector, buffer, 0, dInfos[did].sectorCapacity) == 0)
+    if (esFile_CacheWrite(did, sector, (uint8_t *)fi, idx % dInfos[did].sectorCapacity, sizeof(esFile_FileInfo)) == 0)
     {
-        memcpy(&buffer[idx % dInfos[did].sectorCapacity], fi, sizeof(esFile_FileInfo));
-        esFile_DiskWrite(did, sector, buffer, 0, dInfos[did].sectorCapacity);
         return 0;
     }
     else
     {
-        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        ESFILE_LOG("DiskWrite error: %s %d \n", __FILE__, __LINE__);
         return -1;
     }
 }
@@ -260,11 +263,9 @@ int esFile_WriteFileInfo(uint8_t did, esFile_FileInfo *fi, int idx)
 int esFile_ReadFileInfo(uint8_t did, esFile_FileInfo *fi, int idx)
 {
     esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL;
     int sector = 0;
 
     dInfos = esFile_GetDriveInfos();
-    buffer = esFile_GetDiskBuffer();
 
     sector = idx / dInfos[did].sectorCapacity;
     if (sector < 1 || sector >= dInfos[did].fiSectorCount)
@@ -273,9 +274,8 @@ int esFile_ReadFileInfo(uint8_t did, esFile_FileInfo *fi, int idx)
         return -1;
     }
 
-    if (esFile_DiskRead(did, sector, buffer, idx % dInfos[did].sectorCapacity, sizeof(esFile_FileInfo)) == 0)
+    if (esFile_CacheRead(did, sector, (uint8_t *)fi, idx % dInfos[did].sectorCapacity, sizeof(esFile_FileInfo)) == 0)
     {
-        memcpy(fi, buffer, sizeof(esFile_FileInfo));
         return 0;
     }
     else
@@ -295,20 +295,20 @@ int esFile_ReadFileInfo(uint8_t did, esFile_FileInfo *fi, int idx)
  */
 uint32_t esFile_GenerateUid(uint8_t did)
 {
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
 
-    fs = esFile_GetFileSystems();
+    vols = esFile_GetVolumes();
     while (1)
     {
-        fs[did].lastuid += 1;
-        if (fs[did].lastuid >= 0xFFFFFFFF)
-        	fs[did].lastuid = 1;
+        vols[did].fs.lastuid += 1;
+        if (vols[did].fs.lastuid >= 0xFFFFFFFF)
+        	vols[did].fs.lastuid = 1;
 
-        if (IsUidUsed(did, fs[did].lastuid))
+        if (IsUidUsed(did, vols[did].fs.lastuid))
             break;
     }
 
-    return fs[did].lastuid;
+    return vols[did].fs.lastuid;
 }
 
 /*
@@ -323,20 +323,44 @@ uint32_t esFile_GenerateUid(uint8_t did)
 int esFile_UpdateDataSectorHeader(uint8_t did, uint16_t sno, esFile_DataSectorHeader *dsh)
 {
 	int rv = -1;
-    esFile_DriveInfo *dInfos = NULL;
-    uint8_t *buffer = NULL;
-
-    dInfos = esFile_GetDriveInfos();
-    buffer = esFile_GetDiskBuffer();
 
-    esFile_DiskRead(did, sno, buffer, 0, dInfos[did].sectorCapacity);
-    memcpy(buffer, dsh, sizeof(esFile_DataSectorHeader));
-    esFile_DiskWrite(did, sno, buffer, 0, dInfos[did].sectorCapacity);
-    rv = 0;
+    if (esFile_CacheWrite(did, sno, (uint8_t *)dsh, 0, sizeof(esFile_DataSectorHeader)) == 0)
+    {
+        esFile_SetChainLink(did, sno, dsh->nextsector);
+        rv = 0;
+    }
 
     return rv;
 }
 
+/*
+ * @brief Retrieve the sector following a sector in its chain.
+ *  This function looks the link up in the RAM chain table when the drive has
+    one and reads the data sector header otherwise.
+ * @param did 
+ * @param sno 
+ * @return The next sector, 0 at the end of the chain or -1 on a read error (int)
+ */
+int esFile_GetNextSector(uint8_t did, uint16_t sno)
+{
+    esFile_DataSectorHeader dsh;
+    int next = 0;
+
+    next = esFile_GetChainLink(did, sno);
+    if (next >= 0)
+    {
+        return next;
+    }
+
+    if (esFile_CacheRead(did, sno, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) != 0)
+    {
+        ESFILE_LOG("DiskRead error: %s %d \n", __FILE__, __LINE__);
+        return -1;
+    }
+
+    return dsh.nextsector;
+}
+
 /*
  * @brief Retrieve a free sector for data storage.
  *  This function retrieves and provides access to a sector that is currently
@@ -346,28 +370,212 @@ int esFile_UpdateDataSectorHeader(uint8_t did, uint16_t sno, esFile_DataSectorHe
  * @return The number of the retrieved free sector (int)
  */
 int esFile_GetFreeSector(uint8_t did)
+{
+    return esFile_GetFreeRun(did, 1);
+}
+
+/*
+ * @brief Retrieve a run of consecutive free sectors.
+ *  The search is next-fit: it starts where the previous allocation of the drive
+    ended and wraps around to the first data sector once. The usage table is
+    scanned a word at a time, so a full word of used sectors is skipped in one
+    test. The sectors of the run are marked as used. On a drive with a wear
+    table a single sector is the least written of the next free ones, so the
+    churn of the files rotates over the whole drive. When nothing is found the
+    chains of the removed files waiting to be freed are released first.
+ * @param did 
+ * @param count number of sectors
+ * @return The first sector of the run, -1 if there is no such run (int)
+ */
+int esFile_GetFreeRun(uint8_t did, uint32_t count)
 {
     esFile_DriveInfo *dInfos = NULL;
-    uint32_t count = 0, sno = 0;
-    int rv = -1, i = 0;
+    esFile_Volume *vols = NULL;
+    uint32_t start = 0, end = 0;
+    int rv = -1;
 
-    dInfos = esFile_GetDriveInfos();    
-    count = dInfos[did].dataSectorEnd - dInfos[did].dataSectorStart;
+    dInfos = esFile_GetDriveInfos();
+    vols = esFile_GetVolumes();
+    start = dInfos[did].dataSectorStart;
+    end = dInfos[did].dataSectorEnd;
 
-    for (i = 0; i < count; i++)
+    if (count == 0)
     {
-        sno = dInfos[did].dataSectorStart + i;
-        if (!esFile_GetSectorFlag(did, sno))
+        return -1;
+    }
+
+    rv = FindFreeSectors(did, count);
+
+    // The sectors of the removed files are freed before giving up
+    if (rv < 0 && esFile_RemoveDrain(did))
+    {
+        rv = FindFreeSectors(did, count);
+    }
+
+    if (rv >= 0)
+    {
+        esFile_CacheDiscardClaim(did, rv, count);
+        for (uint32_t i = 0; i < count; i++)
         {
-            rv = sno;
-            esFile_SetSectorFlag(did, sno, 1);
-            break;
+            esFile_SetSectorFlag(did, rv + i, 1);
         }
+        vols[did].allocCursor = rv + count < end ? rv + count : start;
     }
 
     return rv;
 }
 
+/*
+ * @brief Search the free sectors of a drive from its allocation cursor.
+ * @param did 
+ * @param count number of sectors
+ * @return The first sector of the run, -1 if there is no such run (int)
+ */
+static int FindFreeSectors(uint8_t did, uint32_t count)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    esFile_Volume *vols = NULL;
+    uint32_t start = 0, end = 0, cursor = 0;
+    int rv = -1;
+
+    dInfos = esFile_GetDriveInfos();
+    vols = esFile_GetVolumes();
+    start = dInfos[did].dataSectorStart;
+    end = dInfos[did].dataSectorEnd;
+
+    if ((end - start) - vols[did].usedSectors < count)
+    {
+        return -1;
+    }
+
+    cursor = vols[did].allocCursor;
+    if (cursor < start || cursor >= end)
+        cursor = start;
+
+    if (count == 1 && dInfos[did].wearTable)
+    {
+        rv = FindLeastWorn(&dInfos[did], cursor);
+    }
+    else
+    {
+        rv = FindFreeRun(dInfos[did].sectorTable, cursor, end, count);
+    }
+
+    if (rv < 0 && cursor > start)
+    {
+        rv = FindFreeRun(dInfos[did].sectorTable, start, end, count);
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Find the first run of consecutive free sectors in a range of the usage table.
+ * @param table 
+ * @param sno first sector of the range
+ * @param end end of the range
+ * @param count number of sectors
+ * @return The first sector of the run, -1 if there is no such run (int)
+ */
+static int FindFreeRun(const uint32_t *table, uint32_t sno, uint32_t end, uint32_t count)
+{
+    uint32_t stop = 0;
+
+    sno = NextSector(table, sno, end, 0);
+    while (sno + count <= end)
+    {
+        stop = NextSector(table, sno, sno + count, 1);
+        if (stop == sno + count)
+        {
+            return sno;
+        }
+        sno = NextSector(table, stop, end, 0);
+    }
+
+    return -1;
+}
+
+/*
+ * @brief Find the least written of the next free sectors of a drive.
+ *  Up to ESFILE_WEAR_WINDOW free sectors are compared, starting from the
+    cursor and wrapping around to the first data sector.
+ * @param info 
+ * @param cursor 
+ * @return The sector, -1 if the drive is full (int)
+ */
+static int FindLeastWorn(const esFile_DriveInfo *info, uint32_t cursor)
+{
+    uint32_t start = info->dataSectorStart, end = info->dataSectorEnd, sno = cursor, seen = 0;
+    int rv = -1;
+
+    // From the cursor to the end of the drive, then from the first data sector to the cursor
+    for (int pass = 0; pass < 2 && seen < ESFILE_WEAR_WINDOW; pass++)
+    {
+        sno = NextSector(info->sectorTable, sno, end, 0);
+        while (sno < end && seen < ESFILE_WEAR_WINDOW)
+        {
+            if (rv < 0 || info->wearTable[sno - start] < info->wearTable[rv - start])
+                rv = sno;
+            seen++;
+            sno = NextSector(info->sectorTable, sno + 1, end, 0);
+        }
+
+        end = cursor;
+        sno = start;
+    }
+
+    return rv;
+}
+
+/*
+ * @brief Find the next sector with the given usage flag in the usage table.
+ * @param table 
+ * @param sno first sector to test
+ * @param end end of the range
+ * @param used 
+ * @return The sector, end if there is none in the range
+ */
+static uint32_t NextSector(const uint32_t *table, uint32_t sno, uint32_t end, int used)
+{
+    uint32_t word = 0;
+
+    while (sno < end)
+    {
+        word = used ? table[sno / 32] : ~table[sno / 32];
+        word &= 0xFFFFFFFFu << sno % 32;
+        if (word)
+        {
+            sno = (sno & ~31u) + TrailingZeros(word);
+            return sno < end ? sno : end;
+        }
+        sno = (sno & ~31u) + 32;
+    }
+
+    return end;
+}
+
+/*
+ * @brief Count the trailing zero bits of a non-zero word.
+ * @param word 
+ * @return The number of trailing zero bits
+ */
+static uint32_t TrailingZeros(uint32_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctz(word);
+#else
+    uint32_t n = 0;
+
+    while (!(word & 1))
+    {
+        word >>= 1;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
 /*
  * @brief Check if a unique ID is already in use.
  *  This function checks whether a specific unique ID is already in use within the
@@ -381,17 +589,18 @@ static int IsUidUsed(uint8_t did, uint32_t uid)
 {
     esFile_DriveInfo *dInfos = NULL;
     uint8_t *buffer = NULL;
-    esFile_System *fs = NULL;
+    esFile_Volume *vols = NULL;
     esFile_FileInfo fi;
-    int rv = -1, i = 0, j = 0, filecount = 0;
+    uint32_t filecount = 0;
+    int rv = -1, i = 0, j = 0;
 
     dInfos = esFile_GetDriveInfos();
-    buffer = esFile_GetDiskBuffer();
-    fs = esFile_GetFileSystems();
+    buffer = esFile_GetDiskBuffer(did);
+    vols = esFile_GetVolumes();
 
     for (i = 1; i < dInfos[did].fiSectorCount; i++)
     {
-        if (esFile_DiskRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
+        if (esFile_CacheRead(did, i, buffer, 0, dInfos[did].sectorCapacity) == 0)
         {
             for (j = 0; j < dInfos[did].sectorCapacity / ESFILE_FILENGTH; j++)
             {
@@ -403,7 +612,7 @@ static int IsUidUsed(uint8_t did, uint32_t uid)
                         return 0;
                 }
 
-                if (filecount >= fs[did].filecount)
+                if (filecount >= vols[did].fs.filecount)
                 {
                     return rv;
                 }
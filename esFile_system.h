@@ -32,15 +32,62 @@ typedef struct {
     uint32_t filecount;
 } esFile_System;
 
+typedef struct {
+    uint8_t encrypt;
+    uint8_t verifyCrc;
+} esFile_VolumeOptions;
+
+typedef struct {
+    uint16_t first;
+    uint16_t count;
+} esFile_DiscardRange;
+
+typedef struct {
+    uint32_t uid;
+    uint16_t sector;
+} esFile_SealEntry;
+
+typedef struct {
+    esFile_System fs;
+    esFile_VolumeOptions options;
+    uint32_t metaValid;
+    uint32_t metaDirty;
+    uint32_t metaDirtySince;
+    uint32_t metaLoading;
+    uint32_t metaBusy;
+    uint32_t usedSectors;
+    uint32_t releasedSectors;
+    uint16_t allocCursor;
+    uint16_t wearPending;
+    esFile_DiscardRange discards[ESFILE_DISCARD_RANGES];
+    uint8_t discardCount;
+    uint16_t discardPending;
+    uint8_t discardBusy;
+    esFile_SealEntry seals[ESFILE_SEAL_PENDING];
+    uint8_t sealCount;
+} esFile_Volume;
+
 typedef struct {
     char name[64];
     uint16_t startSector;
+    uint16_t packOffset;
     uint32_t size;
     uint32_t uid;
     uint8_t encrypted;
+    uint8_t flags;
+    uint16_t recordSize;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t lap;
 } esFile_FileInfo;
 #define ESFILE_FILENGTH 128
 
+#define ESFILE_FLAG_COMPRESSED 0x01
+#define ESFILE_FLAG_RING 0x02
+#define ESFILE_FLAG_RECORDS 0x04
+#define ESFILE_FLAG_INLINE 0x08
+#define ESFILE_FLAG_PACKED 0x10
+
 int esFile_ReadFileSystem(uint8_t did);
 int esFile_WriteFileSystem(uint8_t did);
 int esFile_CalcDiskUsage(uint8_t did);
@@ -50,6 +97,8 @@ int esFile_WriteFileInfo(uint8_t did, esFile_FileInfo *fi, int idx);
 int esFile_ReadFileInfo(uint8_t did, esFile_FileInfo *fi, int idx);
 uint32_t esFile_GenerateUid(uint8_t did);
 int esFile_UpdateDataSectorHeader(uint8_t did, uint16_t sno, esFile_DataSectorHeader *dsh);
+int esFile_GetNextSector(uint8_t did, uint16_t sno);
 int esFile_GetFreeSector(uint8_t did);
+int esFile_GetFreeRun(uint8_t did, uint32_t count);
 
 #endif
\ No newline at end of file
@@ -21,8 +21,17 @@
 #include "esFile_disk.h"
 #include "esFile_open.h"
 #include "esFile_cryption.h"
+#include "esFile_crc.h"
+#include "esFile_compress.h"
+#include "esFile_ring.h"
+#include "esFile_inline.h"
+#include "esFile_pack.h"
+#include "esFile_lock.h"
 #include "esFile_write.h"
 
+static void TrackSeal(uint8_t did, uint32_t uid, uint16_t sno, uint8_t sealed);
+static void SealSector(uint8_t did, esFile_SealEntry *seal);
+
 /*
  * @brief Write data to a file.
  *  This function writes the provided data to the file located at the specified
@@ -35,52 +44,79 @@
  */
 int esFile_Write(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw)
 {
-    uint8_t *buffer = NULL, *tmpBuff = NULL;
+    uint8_t *tmpBuff = NULL;
     esFile_DriveInfo *dInfos = NULL;
-    uint32_t idx = 0;
+    uint32_t idx = 0, payload = 0, block = 0, chunk = 0;
     esFile_DataSectorHeader dsh;    
     esFile_FileInfo fi;
     int rv = 0;
 
-    if (fp == NULL || btw <= 0)
+    if (fp == NULL || fp->recordSize || btw <= 0)
     {
         return -1;
     }
 
-    ENTER_CRITICAL();
+    esFile_Lock(fp->did);
+    esFile_FileLock(fp->did, fp->uid, 1);
 
-    
-    buffer = esFile_GetDiskBuffer();
-    dInfos = esFile_GetDriveInfos();
-    tmpBuff = (uint8_t *)buff;
+    if (fp->compressed || fp->capacity)
+    {
+        rv = fp->compressed ? esFile_CompressedWrite(fp, buff, btw, bw) : esFile_RingWrite(fp, buff, btw, bw);
+        esFile_FileUnlock(fp->did, fp->uid, 1);
+        esFile_Unlock(fp->did);
+        return rv;
+    }
 
-    while (btw > idx)
+    if (fp->sector == 0 || fp->packSize)
     {
-        if (esFile_DiskRead(fp->did, fp->currentSector, buffer, 0, dInfos[fp->did].sectorCapacity) == 0)
+        // Another descriptor may have moved the data since the last access
+        rv = esFile_PackRefresh(fp);
+        if (rv == 0 && (fp->sector == 0 || fp->packSize))
         {
-            memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
+            rv = esFile_PackReserve(fp, fp->index + btw);
+        }
 
-            if (fp->encrypted)
-            {
-                esFile_Decypt(&buffer[sizeof(esFile_DataSectorHeader)], dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader));
-            }
+        if (rv == 0 && fp->sector == 0)
+        {
+            rv = esFile_InlineWrite(fp, buff, btw, bw);
+        }
+        else if (rv == 0 && fp->packSize)
+        {
+            rv = esFile_PackWrite(fp, buff, btw, bw);
+        }
 
-            for (; (fp->sectorIndex < dInfos[fp->did].sectorCapacity) && (btw > idx); fp->sectorIndex++)
-            {
-                if(tmpBuff)
-                    buffer[fp->sectorIndex] = tmpBuff[idx];
-                else
-                    buffer[fp->sectorIndex] = 0;    
+        if (rv != 0 || fp->sector == 0 || fp->packSize)
+        {
+            esFile_FileUnlock(fp->did, fp->uid, 1);
+            esFile_Unlock(fp->did);
+            return rv;
+        }
+    }
 
-                idx++;            
-            }
+    dInfos = esFile_GetDriveInfos();
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+    tmpBuff = (uint8_t *)buff;
 
-            if (fp->encrypted)
+    while (btw > idx)
+    {
+        if (esFile_CacheRead(fp->did, fp->currentSector, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) == 0)
+        {
+            chunk = dInfos[fp->did].sectorCapacity - fp->sectorIndex;
+            if (chunk > btw - idx)
+                chunk = btw - idx;
+
+            if (chunk > 0)
             {
-                esFile_Encypt(&buffer[sizeof(esFile_DataSectorHeader)], dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader));
+                block = (fp->index + idx - (fp->sectorIndex - sizeof(esFile_DataSectorHeader))) / payload;
+                if (esFile_WriteChunk(fp, &dsh, block, tmpBuff ? &tmpBuff[idx] : NULL, chunk) != 0)
+                {
+                    rv = -2;
+                    break;
+                }
             }
 
-            esFile_DiskWrite(fp->did, fp->currentSector, buffer, 0, dInfos[fp->did].sectorCapacity);
+            fp->sectorIndex += chunk;
+            idx += chunk;
         }
         else
         {
@@ -103,6 +139,7 @@ int esFile_Write(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint
 
                     dsh.presector = fp->currentSector;
                     dsh.nextsector = 0;
+                    dsh.rfu = 0;
                     fp->currentSector = newSector;
                     fp->sectorIndex = sizeof(esFile_DataSectorHeader);
 
@@ -136,6 +173,185 @@ int esFile_Write(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint
         }
     }
 
-    LEAVE_CRITICAL();
+    esFile_FileUnlock(fp->did, fp->uid, 1);
+    esFile_Unlock(fp->did);
     return rv;
 }
+
+/*
+ * @brief Write a byte range into the payload of the current sector.
+ *  The range starts at the sector index of the descriptor and must not cross
+    the end of the sector. Only the range itself is written. When the volume
+    keeps checksums, a whole payload is sealed with the same write, while a
+    partial one leaves the sector unsealed until the writer moves on to
+    another sector, the file is closed or the drives are synced. The header
+    passed in is updated with the checksum.
+ * @param fp 
+ * @param dsh header of the current sector
+ * @param block ordinal of the key stream block of the sector
+ * @param data data to write, NULL writes zeros
+ * @param chunk 
+ * @return 0 if it is successful
+ */
+int esFile_WriteChunk(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint32_t block, const uint8_t *data, uint32_t chunk)
+{
+    esFile_DriveInfo *dInfos = NULL;
+    uint8_t *buffer = NULL;
+    uint32_t payload = 0;
+    uint8_t seal = 0;
+
+    dInfos = esFile_GetDriveInfos();
+    buffer = esFile_GetDiskBuffer(fp->did);
+    payload = dInfos[fp->did].sectorCapacity - sizeof(esFile_DataSectorHeader);
+    seal = esFile_GetVolumes()[fp->did].options.verifyCrc;
+
+    if (seal)
+    {
+        TrackSeal(fp->did, fp->uid, fp->currentSector, chunk == payload);
+    }
+
+    if (data)
+        memcpy(&buffer[fp->sectorIndex], data, chunk);
+    else
+        memset(&buffer[fp->sectorIndex], 0, chunk);
+
+    if (fp->encrypted)
+    {
+        esFile_Encypt(fp->uid, block, fp->sectorIndex - sizeof(esFile_DataSectorHeader), &buffer[fp->sectorIndex], chunk);
+    }
+
+    if (chunk == payload)
+    {
+        dsh->rfu = seal ? esFile_PayloadChecksum(&buffer[sizeof(esFile_DataSectorHeader)], payload) : 0;
+        memcpy(buffer, dsh, sizeof(esFile_DataSectorHeader));
+
+        if (esFile_CacheWrite(fp->did, fp->currentSector, buffer, 0, dInfos[fp->did].sectorCapacity) != 0)
+        {
+            ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+            return -2;
+        }
+
+        return 0;
+    }
+
+    // The old checksum no longer matches the payload
+    if (dsh->rfu != 0)
+    {
+        dsh->rfu = 0;
+        if (esFile_CacheWrite(fp->did, fp->currentSector, (uint8_t *)dsh, 0, sizeof(esFile_DataSectorHeader)) != 0)
+        {
+            ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+            return -2;
+        }
+    }
+
+    if (esFile_CacheWrite(fp->did, fp->currentSector, &buffer[fp->sectorIndex], fp->sectorIndex, chunk) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", fp->did, __FILE__, __LINE__);
+        return -2;
+    }
+
+    return 0;
+}
+
+/*
+ * @brief Seal the sectors left unsealed by the writers of a drive.
+ * @param did 
+ * @param uid file whose sector is sealed, 0 seals all of them
+ */
+void esFile_SealFlush(uint8_t did, uint32_t uid)
+{
+    esFile_Volume *vol = &esFile_GetVolumes()[did];
+    int i = 0;
+
+    while (i < vol->sealCount)
+    {
+        if (uid == 0 || vol->seals[i].uid == uid)
+        {
+            SealSector(did, &vol->seals[i]);
+            vol->seals[i] = vol->seals[--vol->sealCount];
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+/*
+ * @brief Keep track of the sector a writer leaves unsealed.
+ *  Each file has at most one such sector. It is sealed once the writer
+    writes to another one, so a sector written in small pieces is only
+    checksummed once. The oldest entry is sealed when the list is full.
+ * @param did 
+ * @param uid 
+ * @param sno sector being written
+ * @param sealed 1 if the write seals the sector itself
+ */
+static void TrackSeal(uint8_t did, uint32_t uid, uint16_t sno, uint8_t sealed)
+{
+    esFile_Volume *vol = &esFile_GetVolumes()[did];
+
+    for (int i = 0; i < vol->sealCount; i++)
+    {
+        if (vol->seals[i].uid == uid)
+        {
+            if (vol->seals[i].sector != sno)
+            {
+                SealSector(did, &vol->seals[i]);
+            }
+            vol->seals[i] = vol->seals[--vol->sealCount];
+            break;
+        }
+    }
+
+    if (sealed)
+    {
+        return;
+    }
+
+    if (vol->sealCount == ESFILE_SEAL_PENDING)
+    {
+        SealSector(did, &vol->seals[0]);
+        vol->seals[0] = vol->seals[--vol->sealCount];
+    }
+
+    vol->seals[vol->sealCount].uid = uid;
+    vol->seals[vol->sealCount].sector = sno;
+    vol->sealCount++;
+}
+
+/*
+ * @brief Seal the payload of a sector with its checksum.
+ *  The sector is left alone when it no longer belongs to the file, e.g.
+    when the file was removed in the meantime.
+ * @param did 
+ * @param seal 
+ */
+static void SealSector(uint8_t did, esFile_SealEntry *seal)
+{
+    esFile_DataSectorHeader dsh;
+    esFile_DriveInfo *dInfos = NULL;
+    uint8_t *buffer = NULL;
+
+    dInfos = esFile_GetDriveInfos();
+    buffer = esFile_GetDiskBuffer(did);
+
+    if (esFile_CacheReadSector(did, seal->sector, buffer) != 0)
+    {
+        ESFILE_LOG("DiskRead error %d: %s %d \n", did, __FILE__, __LINE__);
+        return;
+    }
+
+    memcpy(&dsh, buffer, sizeof(esFile_DataSectorHeader));
+    if (dsh.uid != seal->uid || dsh.rfu != 0)
+    {
+        return;
+    }
+
+    dsh.rfu = esFile_PayloadChecksum(&buffer[sizeof(esFile_DataSectorHeader)], dInfos[did].sectorCapacity - sizeof(esFile_DataSectorHeader));
+    if (esFile_CacheWrite(did, seal->sector, (uint8_t *)&dsh, 0, sizeof(esFile_DataSectorHeader)) != 0)
+    {
+        ESFILE_LOG("DiskWrite error %d: %s %d \n", did, __FILE__, __LINE__);
+    }
+}
\ No newline at end of file
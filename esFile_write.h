@@ -15,9 +15,11 @@
  *   limitations under the License.
  */
 
-#ifndef ESFILE_READ_H__
-#define ESFILE_READ_H__
+#ifndef ESFILE_WRITE_H__
+#define ESFILE_WRITE_H__
 
 int esFile_Write(esFile_FileDescriptor *fp, const void *buff, uint32_t btw, uint32_t *bw);
+int esFile_WriteChunk(esFile_FileDescriptor *fp, esFile_DataSectorHeader *dsh, uint32_t block, const uint8_t *data, uint32_t chunk);
+void esFile_SealFlush(uint8_t did, uint32_t uid);
 
 #endif
\ No newline at end of file
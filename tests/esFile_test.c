@@ -0,0 +1,180 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+const uint8_t testKey[32] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+
+static int testFailures = 0;
+static int testCount = 0;
+
+void TestFail(const char *file, int line, const char *cond)
+{
+    printf("FAIL %s:%d: %s\n", file, line, cond);
+    testFailures++;
+}
+
+/*
+ * @brief Run a single test case and print its result.
+ * @param name
+ * @param fn
+ */
+void TestRun(const char *name, void (*fn)(void))
+{
+    int failures = testFailures;
+
+    fn();
+    testCount++;
+    printf("%s %s\n", testFailures == failures ? "ok  " : "FAIL", name);
+}
+
+/*
+ * @brief Print the summary of the test cases run so far.
+ * @return the exit code of the test program
+ */
+int TestReport(void)
+{
+    printf("%d tests, %d failures\n", testCount, testFailures);
+    return testFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * @brief Mount the RAM drives with the default options.
+ *  The volume options and the cache mode are kept across esFile_Init calls,
+    so they are reset here to keep the test cases independent.
+ * @param format
+ */
+void TestMount(uint8_t format)
+{
+    esFile_CacheSetWriteBack(0);
+    esFile_SetCryptKey(testKey);
+
+    for (int i = 0; i < esFile_GetDriveCount(); i++)
+    {
+        esFile_SetDefaultEncryption(i, 1);
+        esFile_SetChecksumVerification(i, 0);
+    }
+
+    TEST_CHECK(esFile_Init(format) == 0);
+}
+
+/*
+ * @brief Sync the drives and mount them again from the disk contents.
+ */
+void TestRemount(void)
+{
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(esFile_Init(0) == 0);
+}
+
+/*
+ * @brief Fill a buffer with a reproducible pattern.
+ * @param buff
+ * @param len
+ * @param seed
+ */
+void TestFill(uint8_t *buff, uint32_t len, uint32_t seed)
+{
+    uint32_t x = seed * 2654435761u + 1;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        x = x * 1103515245u + 12345u;
+        buff[i] = (uint8_t)(x >> 16);
+    }
+}
+
+/*
+ * @brief Create a file with the given content.
+ * @param path
+ * @param mode extra mode flags
+ * @param data
+ * @param len
+ * @return 0 if it is successful
+ */
+int TestWriteFile(const char *path, uint16_t mode, const uint8_t *data, uint32_t len)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+    int rv = 0;
+
+    rv = esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | mode);
+    if (rv != 0)
+    {
+        return rv;
+    }
+
+    rv = esFile_Write(&fp, data, len, &bw);
+    if (rv == 0 && bw != len)
+    {
+        rv = -100;
+    }
+
+    esFile_Close(&fp);
+    return rv;
+}
+
+/*
+ * @brief Read a file back and compare it with the expected content.
+ * @param path
+ * @param data
+ * @param len
+ * @return 1 if the size and the content match
+ */
+int TestCheckFile(const char *path, const uint8_t *data, uint32_t len)
+{
+    esFile_FileDescriptor fp;
+    uint8_t *buff = malloc(len + 1);
+    uint32_t br = 0;
+    int match = 0;
+
+    if (buff && esFile_Open(&fp, path, ESFILE_MODE_READ) == 0)
+    {
+        match = esFile_Size(&fp) == (int)len &&
+                esFile_Read(&fp, buff, len + 1, &br) == 0 &&
+                br == len && memcmp(buff, data, len) == 0;
+        esFile_Close(&fp);
+    }
+
+    free(buff);
+    return match;
+}
+
+/*
+ * @brief Count the data sectors that are marked as used on a drive.
+ * @param did
+ * @return sector count
+ */
+int TestUsedSectors(uint8_t did)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+    int count = 0;
+
+    for (int i = dInfos[did].dataSectorStart; i < dInfos[did].dataSectorEnd; i++)
+    {
+        count += esFile_GetSectorFlag(did, i) ? 1 : 0;
+    }
+
+    return count;
+}
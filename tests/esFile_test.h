@@ -0,0 +1,62 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFILE_TEST_H__
+#define ESFILE_TEST_H__
+
+#define TEST_CHECK(cond)                                                       \
+    do                                                                         \
+    {                                                                          \
+        if (!(cond))                                                           \
+        {                                                                      \
+            TestFail(__FILE__, __LINE__, #cond);                               \
+        }                                                                      \
+    } while (0)
+
+#define TEST_RUN(fn)                        TestRun(#fn, fn)
+
+typedef struct {
+    long nandReads;
+    long nandWrites;
+    long nandReleases;
+    long nandDefrags;
+    long eepromReads;
+    long eepromWrites;
+} esFile_TestCounters;
+
+extern esFile_TestCounters testCounters;
+extern const uint8_t testKey[32];
+
+void TestFail(const char *file, int line, const char *cond);
+void TestRun(const char *name, void (*fn)(void));
+int TestReport(void);
+
+void TestMount(uint8_t format);
+void TestRemount(void);
+void TestFill(uint8_t *buff, uint32_t len, uint32_t seed);
+int TestWriteFile(const char *path, uint16_t mode, const uint8_t *data, uint32_t len);
+int TestCheckFile(const char *path, const uint8_t *data, uint32_t len);
+int TestUsedSectors(uint8_t did);
+
+int TestNandContains(const void *pattern, int len);
+int TestNandCorrupt(const void *pattern, int len);
+int TestEepromCorrupt(const void *pattern, int len);
+void TestNandFailWrites(int fail);
+void TestNandBlockWrites(int block);
+int TestNandWaitBlocked(void);
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#ifndef ESFTL_H__
+#define ESFTL_H__
+
+#include <stdint.h>
+
+#define ESFTL_NANDNUMBLOCKS                 256
+#define ESFTL_NANDNUMPAGEBLOCK              64
+#define ESFTL_NANDPAGESIZE                  2112
+#define ESFTL_NANDPAGEDATASIZE              2048
+
+int esFtl_Init(uint8_t format);
+int esFtl_Read(int sector, uint8_t *buff, int idx, int count);
+int esFtl_FtlDriverWrite(int sector, uint8_t *buff, int idx, int count);
+int esFtl_FtlDriverRelease(int sector);
+int esFtl_CalcUsedPages(void);
+int esFtl_Defrag(void);
+
+#endif
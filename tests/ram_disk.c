@@ -0,0 +1,316 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFtl.h"
+#include "esFile_definitions.h"
+#include "M95M01_driver.h"
+#include "esFile_test.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define RAM_NAND_SECTORS                    (ESFTL_NANDNUMBLOCKS * ESFTL_NANDNUMPAGEBLOCK)
+
+static uint8_t ramNand[RAM_NAND_SECTORS][ESFTL_NANDPAGEDATASIZE];
+static uint8_t ramNandUsed[RAM_NAND_SECTORS];
+static uint8_t ramEeprom[EEPROM_SIZE];
+static uint8_t ramNandFailWrites;
+static uint8_t ramNandBlockWrites;
+static int ramNandBlocked;
+static pthread_mutex_t ramNandGate = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ramNandGateCond = PTHREAD_COND_INITIALIZER;
+
+esFile_TestCounters testCounters;
+
+/*
+ * @brief Print a log line of the file system.
+ *  The logs are only printed when ESFILE_TEST_VERBOSE is set in the
+    environment, the error paths under test would flood the output otherwise.
+ * @param fmt
+ */
+void PrintUart(char *fmt, ...)
+{
+    va_list args;
+
+    if (getenv("ESFILE_TEST_VERBOSE") == NULL)
+    {
+        return;
+    }
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void DisableInterrupts(void)
+{
+}
+
+void EnableInterrupts(void)
+{
+}
+
+/*
+ * @brief Initialize the RAM backed flash translation layer.
+ * @param format
+ * @return 0
+ */
+int esFtl_Init(uint8_t format)
+{
+    if (format)
+    {
+        memset(ramNand, 0xFF, sizeof(ramNand));
+        memset(ramNandUsed, 0, sizeof(ramNandUsed));
+    }
+
+    return 0;
+}
+
+int esFtl_Read(int sector, uint8_t *buff, int idx, int count)
+{
+    if (sector < 0 || sector >= RAM_NAND_SECTORS || idx + count > ESFTL_NANDPAGEDATASIZE)
+    {
+        return -1;
+    }
+
+    testCounters.nandReads++;
+    memcpy(buff, &ramNand[sector][idx], count);
+    return 0;
+}
+
+int esFtl_FtlDriverWrite(int sector, uint8_t *buff, int idx, int count)
+{
+    if (sector < 0 || sector >= RAM_NAND_SECTORS || idx + count > ESFTL_NANDPAGEDATASIZE)
+    {
+        return -1;
+    }
+
+    if (ramNandFailWrites)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ramNandGate);
+    if (ramNandBlockWrites)
+    {
+        ramNandBlocked++;
+        pthread_cond_broadcast(&ramNandGateCond);
+        while (ramNandBlockWrites)
+        {
+            pthread_cond_wait(&ramNandGateCond, &ramNandGate);
+        }
+        ramNandBlocked--;
+    }
+    pthread_mutex_unlock(&ramNandGate);
+
+    testCounters.nandWrites++;
+    memcpy(&ramNand[sector][idx], buff, count);
+    ramNandUsed[sector] = 1;
+    return 0;
+}
+
+int esFtl_FtlDriverRelease(int sector)
+{
+    if (sector < 0 || sector >= RAM_NAND_SECTORS)
+    {
+        return -1;
+    }
+
+    testCounters.nandReleases++;
+    ramNandUsed[sector] = 0;
+    return 0;
+}
+
+/*
+ * @brief Count the pages holding data that has not been released.
+ * @return page count
+ */
+int esFtl_CalcUsedPages(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < RAM_NAND_SECTORS; i++)
+    {
+        count += ramNandUsed[i];
+    }
+
+    return count;
+}
+
+int esFtl_Defrag(void)
+{
+    testCounters.nandDefrags++;
+    return 0;
+}
+
+uint8_t M95M01_PageWriteMemory(uint32_t addr, uint8_t *pData, unsigned int size)
+{
+    if (addr + size > EEPROM_SIZE)
+    {
+        return M95M01_PAGE_SIZE_EXCCED;
+    }
+
+    memcpy(&ramEeprom[addr], pData, size);
+    return M95M01_OK;
+}
+
+uint8_t M95M01_ReadSectors(uint8_t *pBuffer, uint32_t SectorNo, uint16_t SectorSize, uint32_t SectorCount)
+{
+    if ((SectorNo + SectorCount) * SectorSize > EEPROM_SIZE)
+    {
+        return M95M01_PAGE_SIZE_EXCCED;
+    }
+
+    testCounters.eepromReads++;
+    memcpy(pBuffer, &ramEeprom[SectorNo * SectorSize], SectorSize * SectorCount);
+    return M95M01_OK;
+}
+
+uint8_t M95M01_WriteSectors(const uint8_t *pBuffer, uint32_t SectorNo, uint16_t SectorSize, uint32_t SectorCount)
+{
+    if ((SectorNo + SectorCount) * SectorSize > EEPROM_SIZE)
+    {
+        return M95M01_PAGE_SIZE_EXCCED;
+    }
+
+    testCounters.eepromWrites++;
+    memcpy(&ramEeprom[SectorNo * SectorSize], pBuffer, SectorSize * SectorCount);
+    return M95M01_OK;
+}
+
+/*
+ * @brief Find a byte pattern in the raw memory.
+ * @param mem
+ * @param size
+ * @param pattern
+ * @param len
+ * @return the offset of the first match or -1
+ */
+static long FindPattern(const uint8_t *mem, long size, const void *pattern, int len)
+{
+    const uint8_t *p = (const uint8_t *)pattern;
+
+    for (long i = 0; i + len <= size; i++)
+    {
+        if (mem[i] == p[0] && memcmp(&mem[i], p, len) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * @brief Check whether a byte pattern is stored in plain form on the NAND.
+ * @param pattern
+ * @param len
+ * @return 1 if it is found
+ */
+int TestNandContains(const void *pattern, int len)
+{
+    return FindPattern((const uint8_t *)ramNand, sizeof(ramNand), pattern, len) >= 0;
+}
+
+/*
+ * @brief Flip a bit of the first copy of a byte pattern on the NAND.
+ * @param pattern
+ * @param len
+ * @return 1 if it is found and corrupted
+ */
+int TestNandCorrupt(const void *pattern, int len)
+{
+    long ofs = FindPattern((const uint8_t *)ramNand, sizeof(ramNand), pattern, len);
+
+    if (ofs < 0)
+    {
+        return 0;
+    }
+
+    ((uint8_t *)ramNand)[ofs] ^= 1;
+    return 1;
+}
+
+/*
+ * @brief Flip a bit of the first copy of a byte pattern on the EEPROM.
+ * @param pattern
+ * @param len
+ * @return 1 if it is found and corrupted
+ */
+int TestEepromCorrupt(const void *pattern, int len)
+{
+    long ofs = FindPattern(ramEeprom, sizeof(ramEeprom), pattern, len);
+
+    if (ofs < 0)
+    {
+        return 0;
+    }
+
+    ramEeprom[ofs] ^= 1;
+    return 1;
+}
+
+/*
+ * @brief Make the following NAND writes fail, or succeed again.
+ * @param fail
+ */
+void TestNandFailWrites(int fail)
+{
+    ramNandFailWrites = fail ? 1 : 0;
+}
+
+/*
+ * @brief Hold the following NAND writes until they are released again.
+ *  The writers wait inside the device function, with every lock they took
+    on the way still held.
+ * @param block
+ */
+void TestNandBlockWrites(int block)
+{
+    pthread_mutex_lock(&ramNandGate);
+    ramNandBlockWrites = block ? 1 : 0;
+    pthread_cond_broadcast(&ramNandGateCond);
+    pthread_mutex_unlock(&ramNandGate);
+}
+
+/*
+ * @brief Wait for a NAND write to be held, for at most a second.
+ * @return 1 if a writer is held
+ */
+int TestNandWaitBlocked(void)
+{
+    struct timespec ts;
+    int rv = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+
+    pthread_mutex_lock(&ramNandGate);
+    while (ramNandBlocked == 0)
+    {
+        if (pthread_cond_timedwait(&ramNandGateCond, &ramNandGate, &ts) != 0)
+        {
+            break;
+        }
+    }
+    rv = ramNandBlocked > 0;
+    pthread_mutex_unlock(&ramNandGate);
+
+    return rv;
+}
@@ -0,0 +1,129 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+static uint8_t data[4000];
+
+static void NextFit(void)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+    int start = 0, end = 0, count = 0;
+
+    TestMount(1);
+    start = dInfos[0].dataSectorStart;
+    end = dInfos[0].dataSectorEnd;
+
+    TEST_CHECK(esFile_GetFreeSector(0) == start);
+    TEST_CHECK(esFile_GetFreeRun(0, 40) == start + 1);
+
+    // Freed sectors behind the cursor are not reused while there is room ahead
+    esFile_SetSectorFlag(0, start + 10, 0);
+    esFile_SetSectorFlag(0, start + 20, 0);
+    esFile_SetSectorFlag(0, start + 21, 0);
+    TEST_CHECK(esFile_GetFreeSector(0) == start + 41);
+
+    while (esFile_GetFreeSector(0) >= 0)
+    {
+        count++;
+    }
+    TEST_CHECK(count == end - start - 39);
+    TEST_CHECK(TestUsedSectors(0) == end - start);
+    TEST_CHECK(esFile_GetFreeRun(0, 1) < 0);
+
+    // Runs need consecutive free sectors, wherever they are
+    esFile_SetSectorFlag(0, end - 1, 0);
+    esFile_SetSectorFlag(0, end - 2, 0);
+    esFile_SetSectorFlag(0, start + 100, 0);
+    TEST_CHECK(esFile_GetFreeRun(0, 3) < 0);
+    TEST_CHECK(esFile_GetFreeRun(0, 2) == end - 2);
+    TEST_CHECK(esFile_GetFreeRun(0, 1) == start + 100);
+    TEST_CHECK(esFile_GetFreeRun(0, 0) < 0);
+}
+
+static void CursorMovesOn(void)
+{
+    esFile_FileDescriptor fp;
+    int first = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    TEST_CHECK(TestWriteFile("a", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Open(&fp, "a", ESFILE_MODE_READ) == 0);
+    first = fp.sector;
+    esFile_Close(&fp);
+
+    TEST_CHECK(esFile_Remove("a") == 0);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(esFile_GetSectorFlag(0, first) == 0);
+
+    TEST_CHECK(TestWriteFile("b", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Open(&fp, "b", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(fp.sector > first);
+    esFile_Close(&fp);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("b", data, sizeof(data)));
+}
+
+/*
+ * @brief Fill the EEPROM drive, then make room and fill it again.
+ */
+static void FullDrive(void)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+    char path[16];
+    int files = 0;
+
+    TestMount(1);
+    esFile_SetDefaultEncryption(1, 0);
+    TestFill(data, sizeof(data), 2);
+
+    for (files = 0; files < 100; files++)
+    {
+        sprintf(path, "e:f%d", files);
+        if (TestWriteFile(path, 0, data, sizeof(data)) != 0)
+        {
+            esFile_Remove(path);
+            break;
+        }
+    }
+    TEST_CHECK(files > 0 && files < 100);
+    TEST_CHECK(esFile_GetFreeRun(1, dInfos[1].dataSectorEnd - dInfos[1].dataSectorStart) < 0);
+
+    TEST_CHECK(esFile_Remove("e:f0") == 0);
+    TEST_CHECK(TestWriteFile("e:again", 0, data, sizeof(data)) == 0);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("e:again", data, sizeof(data)));
+    for (int i = 1; i < files; i++)
+    {
+        sprintf(path, "e:f%d", i);
+        TEST_CHECK(TestCheckFile(path, data, sizeof(data)));
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(NextFit);
+    TEST_RUN(CursorMovesOn);
+    TEST_RUN(FullDrive);
+    return TestReport();
+}
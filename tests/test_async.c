@@ -0,0 +1,151 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_async.h"
+#include "esFile_lock.h"
+#include "esFile_test.h"
+
+#define REQUEST_COUNT                       64
+#define REQUEST_SIZE                        100
+
+static esFile_AsyncRequest requests[REQUEST_COUNT];
+static uint8_t data[REQUEST_COUNT * REQUEST_SIZE];
+static uint8_t buff[REQUEST_COUNT * REQUEST_SIZE + 1];
+static int callbacks = 0;
+
+static void Done(esFile_AsyncRequest *req)
+{
+    (*(int *)req->context)++;
+    callbacks++;
+}
+
+/*
+ * @brief Append the test data to a file with one queued write per piece.
+ *  The NAND drive is held while the writes are queued, so that the worker
+    finds them waiting and merges them.
+ * @param fp
+ * @param context counter passed to the callbacks
+ * @return the number of NAND programs done for the writes
+ */
+static long QueueWrites(esFile_FileDescriptor *fp, int *context)
+{
+    long writes = testCounters.nandWrites;
+
+    esFile_Lock(0);
+    for (int i = 0; i < REQUEST_COUNT; i++)
+    {
+        requests[i].context = context;
+        TEST_CHECK(esFile_WriteAsync(&requests[i], fp, data + i * REQUEST_SIZE, REQUEST_SIZE, Done) == 0);
+    }
+    esFile_Unlock(0);
+
+    for (int i = 0; i < REQUEST_COUNT; i++)
+    {
+        TEST_CHECK(esFile_AsyncWait(&requests[i]) == 0 && requests[i].count == REQUEST_SIZE);
+    }
+
+    return testCounters.nandWrites - writes;
+}
+
+static void RoundTrip(void)
+{
+    esFile_FileDescriptor fp, reader;
+    esFile_AsyncRequest open, read;
+    int context = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    callbacks = 0;
+
+    open.context = &context;
+    TEST_CHECK(esFile_OpenAsync(&open, &fp, "log", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE, Done) == 0);
+    TEST_CHECK(esFile_AsyncWait(&open) == 0);
+    QueueWrites(&fp, &context);
+    TEST_CHECK(context == REQUEST_COUNT + 1 && callbacks == context);
+    esFile_Close(&fp);
+
+    TEST_CHECK(esFile_Open(&reader, "log", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_ReadAsync(&read, &reader, buff, sizeof(buff), NULL) == 0);
+    TEST_CHECK(esFile_AsyncWait(&read) == 0 && read.count == sizeof(data));
+    TEST_CHECK(memcmp(buff, data, sizeof(data)) == 0);
+    esFile_Close(&reader);
+    TEST_CHECK(callbacks == context);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("log", data, sizeof(data)));
+}
+
+static void WritesAreMerged(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+    long merged = 0, single = 0;
+    int context = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+
+    TEST_CHECK(esFile_Open(&fp, "async", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE) == 0);
+    merged = QueueWrites(&fp, &context);
+    esFile_Close(&fp);
+
+    single = testCounters.nandWrites;
+    TEST_CHECK(esFile_Open(&fp, "sync", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE) == 0);
+    for (int i = 0; i < REQUEST_COUNT; i++)
+    {
+        TEST_CHECK(esFile_Write(&fp, data + i * REQUEST_SIZE, REQUEST_SIZE, &bw) == 0);
+    }
+    esFile_Close(&fp);
+    single = testCounters.nandWrites - single;
+
+#if ESFILE_NAND_METACACHE == ESFILE_META_WRITEBACK
+    // The file info is not written per write here, only the data sector programs are saved
+    TEST_CHECK(merged * 2 < single);
+#else
+    TEST_CHECK(merged * 4 < single);
+#endif
+    TEST_CHECK(TestCheckFile("async", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("sync", data, sizeof(data)));
+}
+
+static void ErrorsAreReported(void)
+{
+    esFile_FileDescriptor fp;
+    esFile_AsyncRequest req;
+    int context = 0;
+
+    TestMount(1);
+    callbacks = 0;
+
+    req.context = &context;
+    TEST_CHECK(esFile_OpenAsync(&req, &fp, "missing", ESFILE_MODE_READ, Done) == 0);
+    TEST_CHECK(esFile_AsyncWait(&req) < 0);
+    TEST_CHECK(context == 1 && callbacks == 1);
+
+    TEST_CHECK(esFile_OpenAsync(NULL, &fp, "missing", ESFILE_MODE_READ, NULL) == -1);
+    TEST_CHECK(esFile_ReadAsync(&req, NULL, buff, 1, NULL) == -1);
+    TEST_CHECK(esFile_WriteAsync(&req, &fp, NULL, 1, NULL) == -1);
+}
+
+int main(void)
+{
+    TEST_RUN(RoundTrip);
+    TEST_RUN(WritesAreMerged);
+    TEST_RUN(ErrorsAreReported);
+    return TestReport();
+}
@@ -0,0 +1,208 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+static uint8_t data[12000];
+static uint8_t buff[12000];
+
+static void RoundTrip(void)
+{
+    const char *paths[] = {"a.bin", "e:b.bin"};
+    esFile_FileDescriptor fp;
+    uint32_t br = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+
+    for (int i = 0; i < 2; i++)
+    {
+        TEST_CHECK(esFile_Open(&fp, paths[i], ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE) == 0);
+        for (uint32_t ofs = 0; ofs < sizeof(data); ofs += 1000)
+        {
+            TEST_CHECK(esFile_Write(&fp, data + ofs, 1000, &br) == 0 && br == 1000);
+        }
+        esFile_Close(&fp);
+
+        TEST_CHECK(TestCheckFile(paths[i], data, sizeof(data)));
+
+        TEST_CHECK(esFile_Open(&fp, paths[i], ESFILE_MODE_READ) == 0);
+        TEST_CHECK(esFile_Seek(&fp, 5123) == 0);
+        TEST_CHECK(esFile_Read(&fp, buff, 3000, &br) == 0 && br == 3000);
+        TEST_CHECK(memcmp(buff, data + 5123, 3000) == 0);
+        TEST_CHECK(esFile_Seek(&fp, 17) == 0);
+        TEST_CHECK(esFile_Read(&fp, buff, 100, &br) == 0 && br == 100);
+        TEST_CHECK(memcmp(buff, data + 17, 100) == 0);
+        esFile_Close(&fp);
+    }
+}
+
+static void Remount(void)
+{
+    esFile_DirDescriptor dp;
+    esFile_FileInfo fi;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    TEST_CHECK(TestWriteFile("a.bin", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("e:b.bin", 0, data, 3000) == 0);
+    TestRemount();
+
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:b.bin", data, 3000));
+
+    TEST_CHECK(esFile_Remove("a.bin") == 0);
+    TEST_CHECK(esFile_Remove("e:b.bin") == 0);
+    TestRemount();
+
+    TEST_CHECK(esFile_Stat("a.bin", &fi) != 0);
+    TEST_CHECK(esFile_OpenDir(&dp, "e:") == 0);
+    TEST_CHECK(esFile_ReadDir(&dp, &fi) != 0);
+    esFile_CloseDir(&dp);
+}
+
+#if ESFILE_CACHE_ENTRIES > 1
+static void RepeatedReadsHit(void)
+{
+    esFile_CacheStats stats;
+    esFile_FileDescriptor fp;
+    uint32_t br = 0;
+    long reads = 0;
+
+    TestMount(1);
+    TestFill(data, 1500, 3);
+    TEST_CHECK(TestWriteFile("small.bin", 0, data, 1500) == 0);
+
+    TEST_CHECK(esFile_Open(&fp, "small.bin", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 1500, &br) == 0 && br == 1500);
+
+    esFile_ResetCacheStats();
+    reads = testCounters.nandReads;
+    for (int i = 0; i < 20; i++)
+    {
+        TEST_CHECK(esFile_Seek(&fp, i * 50) == 0);
+        TEST_CHECK(esFile_Read(&fp, buff, 50, &br) == 0 && br == 50);
+        TEST_CHECK(memcmp(buff, data + i * 50, 50) == 0);
+    }
+    esFile_Close(&fp);
+
+    esFile_GetCacheStats(&stats);
+    TEST_CHECK(testCounters.nandReads == reads);
+    TEST_CHECK(stats.readHits > 0);
+}
+#endif
+
+#if ESFILE_CACHE_ENTRIES > 1 && ESFILE_CACHE_SETS > 1
+/*
+ * @brief Keep the cached NAND sectors through a burst of EEPROM traffic.
+ *  The drives have their own cache entries, the EEPROM can not evict the
+    sectors of the NAND.
+ */
+static void DrivesKeepTheirEntries(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t br = 0;
+    long reads = 0;
+    char path[16];
+
+    TestMount(1);
+    TestFill(data, 1500, 6);
+    TEST_CHECK(TestWriteFile("small.bin", 0, data, 1500) == 0);
+
+    TEST_CHECK(esFile_Open(&fp, "small.bin", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 100, &br) == 0 && br == 100);
+
+    reads = testCounters.nandReads;
+    for (int i = 0; i < 8; i++)
+    {
+        sprintf(path, "e:f%d", i);
+        TestFill(buff, 1000, i);
+        TEST_CHECK(TestWriteFile(path, 0, buff, 1000) == 0);
+        TEST_CHECK(TestCheckFile(path, buff, 1000));
+    }
+
+    TEST_CHECK(esFile_Seek(&fp, 700) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 100, &br) == 0 && br == 100);
+    TEST_CHECK(memcmp(buff, data + 700, 100) == 0);
+    esFile_Close(&fp);
+
+    TEST_CHECK(testCounters.nandReads == reads);
+}
+#endif
+
+static void FailedWriteNotCached(void)
+{
+    esFile_FileDescriptor fp;
+    uint8_t patch[64];
+    uint32_t br = 0;
+
+    TestMount(1);
+    TestFill(data, 5000, 5);
+    TestFill(patch, sizeof(patch), 6);
+    TEST_CHECK(TestWriteFile("fail.bin", 0, data, 5000) == 0);
+
+    TEST_CHECK(esFile_Open(&fp, "fail.bin", ESFILE_MODE_READ | ESFILE_MODE_WRITE) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 5000, &br) == 0 && br == 5000);
+    TEST_CHECK(esFile_Seek(&fp, 2100) == 0);
+    TestNandFailWrites(1);
+    TEST_CHECK(esFile_Write(&fp, patch, sizeof(patch), &br) != 0);
+    TestNandFailWrites(0);
+
+    // The sector is read from the disk again, not from the rejected copy
+    TEST_CHECK(esFile_Seek(&fp, 2100) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, sizeof(patch), &br) == 0 && br == sizeof(patch));
+    TEST_CHECK(memcmp(buff, data + 2100, sizeof(patch)) == 0);
+    esFile_Close(&fp);
+}
+
+static void SeekUsesChainTable(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t br = 0;
+    long reads = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 4);
+    TEST_CHECK(TestWriteFile("e:long.bin", 0, data, sizeof(data)) == 0);
+    TestRemount();
+
+    TEST_CHECK(esFile_Open(&fp, "e:long.bin", ESFILE_MODE_READ) == 0);
+
+    // The EEPROM drive keeps the links of the mounted files in RAM
+    reads = testCounters.eepromReads;
+    TEST_CHECK(esFile_Seek(&fp, sizeof(data) - 10) == 0);
+    TEST_CHECK(testCounters.eepromReads == reads);
+    TEST_CHECK(esFile_Read(&fp, buff, 10, &br) == 0 && br == 10);
+    TEST_CHECK(memcmp(buff, data + sizeof(data) - 10, 10) == 0);
+    esFile_Close(&fp);
+}
+
+int main(void)
+{
+    TEST_RUN(RoundTrip);
+    TEST_RUN(Remount);
+#if ESFILE_CACHE_ENTRIES > 1
+    TEST_RUN(RepeatedReadsHit);
+#endif
+#if ESFILE_CACHE_ENTRIES > 1 && ESFILE_CACHE_SETS > 1
+    TEST_RUN(DrivesKeepTheirEntries);
+#endif
+    TEST_RUN(FailedWriteNotCached);
+    TEST_RUN(SeekUsesChainTable);
+    return TestReport();
+}
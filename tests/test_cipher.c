@@ -0,0 +1,156 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_cryption_simulator.h"
+#include "esFile_test.h"
+
+static uint8_t data[6000];
+static uint8_t buff[6000];
+
+/*
+ * The ChaCha20 test vector of RFC 7539 section 2.4.2. Its nonce is zero
+ * apart from the 0x4a of byte 7, which is the high byte of the block number
+ * here, and the key stream starts at block counter 1, i.e. byte offset 64.
+ */
+static void KnownAnswer(void)
+{
+    const char *plain = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+    const uint8_t expected[16] = {
+        0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80,
+        0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81};
+    uint32_t len = strlen(plain);
+
+    esFile_SetCryptKey(testKey);
+    memcpy(buff, plain, len);
+    TEST_CHECK(esFile_Encypt(0, 0x4a000000, 64, buff, len) == (int)len);
+    TEST_CHECK(memcmp(buff, expected, sizeof(expected)) == 0);
+    TEST_CHECK(buff[len - 1] == 0x4d);
+
+    TEST_CHECK(esFile_Decypt(0, 0x4a000000, 64, buff, len) == (int)len);
+    TEST_CHECK(memcmp(buff, plain, len) == 0);
+}
+
+static void PiecewiseMatchesWhole(void)
+{
+    uint32_t ofs = 0, len = 0;
+
+    esFile_SetCryptKey(testKey);
+    TestFill(data, sizeof(data), 1);
+    memcpy(buff, data, sizeof(data));
+
+    TEST_CHECK(esFile_Encypt(5, 7, 0, data, sizeof(data)) == (int)sizeof(data));
+    while (ofs < sizeof(buff))
+    {
+        len = (ofs * 7 + 13) % 301 + 1;
+        if (ofs + len > sizeof(buff))
+        {
+            len = sizeof(buff) - ofs;
+        }
+        TEST_CHECK(esFile_Encypt(5, 7, ofs, buff + ofs, len) == (int)len);
+        ofs += len;
+    }
+    TEST_CHECK(memcmp(data, buff, sizeof(data)) == 0);
+}
+
+static void FilesAreEncrypted(void)
+{
+    esFile_FileInfo fi;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+
+    TEST_CHECK(TestWriteFile("secret.bin", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("plain.bin", ESFILE_MODE_PLAIN, data + 3000, 3000) == 0);
+    TEST_CHECK(!TestNandContains(data, 64));
+    TEST_CHECK(TestNandContains(data + 3000, 64));
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("secret.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("plain.bin", data + 3000, 3000));
+    TEST_CHECK(esFile_Stat("secret.bin", &fi) == 0 && fi.encrypted);
+    TEST_CHECK(esFile_Stat("plain.bin", &fi) == 0 && !fi.encrypted);
+}
+
+static void DefaultMode(void)
+{
+    esFile_FileInfo fi;
+
+    TestMount(1);
+    TestFill(data, 1000, 3);
+    TEST_CHECK(esFile_SetDefaultEncryption(0, 0) == 0);
+
+    TEST_CHECK(TestWriteFile("plain.bin", 0, data, 500) == 0);
+    TEST_CHECK(TestWriteFile("secret.bin", ESFILE_MODE_ENCRYPTED, data + 500, 500) == 0);
+    TEST_CHECK(TestNandContains(data, 64));
+    TEST_CHECK(!TestNandContains(data + 500, 64));
+
+    TestRemount();
+    TEST_CHECK(esFile_Stat("plain.bin", &fi) == 0 && !fi.encrypted);
+    TEST_CHECK(esFile_Stat("secret.bin", &fi) == 0 && fi.encrypted);
+    TEST_CHECK(TestCheckFile("plain.bin", data, 500));
+    TEST_CHECK(TestCheckFile("secret.bin", data + 500, 500));
+}
+
+static void RefusedWithoutKey(void)
+{
+    esFile_FileDescriptor fp;
+
+    TestMount(1);
+    TestFill(data, 100, 4);
+    TEST_CHECK(TestWriteFile("secret.bin", 0, data, 100) == 0);
+    TEST_CHECK(TestWriteFile("plain.bin", ESFILE_MODE_PLAIN, data, 100) == 0);
+
+    esFile_SetCryptKey(NULL);
+    TEST_CHECK(esFile_Open(&fp, "secret.bin", ESFILE_MODE_READ) == -2);
+    TEST_CHECK(esFile_Open(&fp, "new.bin", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_ENCRYPTED) == -2);
+    TEST_CHECK(TestCheckFile("plain.bin", data, 100));
+
+    // Without a key the new files are plain by default
+    TEST_CHECK(TestWriteFile("new.bin", 0, data, 100) == 0);
+    TEST_CHECK(TestNandContains(data, 100));
+
+    esFile_SetCryptKey(testKey);
+    TEST_CHECK(TestCheckFile("secret.bin", data, 100));
+}
+
+static void ProviderMatchesSoftware(void)
+{
+    TestMount(1);
+    TestFill(data, sizeof(data), 5);
+
+    esFile_SetCryptoProvider(esFile_GetCryptSimulator());
+    TEST_CHECK(TestWriteFile("a.bin", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("e:b.bin", 0, data, 2000) == 0);
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    esFile_SetCryptoProvider(NULL);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:b.bin", data, 2000));
+}
+
+int main(void)
+{
+    TEST_RUN(KnownAnswer);
+    TEST_RUN(PiecewiseMatchesWhole);
+    TEST_RUN(FilesAreEncrypted);
+    TEST_RUN(DefaultMode);
+    TEST_RUN(RefusedWithoutKey);
+    TEST_RUN(ProviderMatchesSoftware);
+    return TestReport();
+}
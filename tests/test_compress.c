@@ -0,0 +1,180 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+static uint8_t shadow[2][120000];
+static uint32_t shadowSize[2];
+static uint8_t buff[20000];
+
+/*
+ * @brief Format log lines into a buffer.
+ * @param dest
+ * @param len
+ * @param line the number of the first line, advanced past the last one
+ */
+static void FillLog(uint8_t *dest, uint32_t len, long *line)
+{
+    char text[100];
+    uint32_t pos = 0, l = 0;
+
+    while (pos < len)
+    {
+        l = snprintf(text, sizeof(text), "%08ld [INFO] sensor=%ld value=%ld status=%s\n",
+                     *line, *line % 8, (*line * 37) % 1000, (*line % 3) ? "ok" : "degraded");
+        if (l > len - pos)
+        {
+            l = len - pos;
+        }
+        memcpy(dest + pos, text, l);
+        pos += l;
+        (*line)++;
+    }
+}
+
+static void LogRoundTrip(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+    long line = 0;
+    int usage = 0;
+
+    TestMount(1);
+    usage = esFile_CalcDiskUsage(0);
+    FillLog(shadow[0], sizeof(shadow[0]), &line);
+
+    TEST_CHECK(esFile_Open(&fp, "log.txt", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_COMPRESSED) == 0);
+    for (uint32_t ofs = 0; ofs < sizeof(shadow[0]); ofs += 60)
+    {
+        TEST_CHECK(esFile_Write(&fp, shadow[0] + ofs, 60, &bw) == 0 && bw == 60);
+    }
+    esFile_Close(&fp);
+
+    TEST_CHECK(TestCheckFile("log.txt", shadow[0], sizeof(shadow[0])));
+    TEST_CHECK(esFile_CalcDiskUsage(0) - usage < (int)sizeof(shadow[0]) / 2);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("log.txt", shadow[0], sizeof(shadow[0])));
+}
+
+/*
+ * @brief Append, read and remount at random against a shadow copy.
+ *  Some appends are incompressible or written as zeros from a NULL buffer,
+    so the raw frames and the zero fill are covered as well.
+ */
+static void RandomAccess(void)
+{
+    const char *paths[2] = {"log.txt", "e:log.txt"};
+    const uint32_t limits[2] = {sizeof(shadow[0]), 40000};
+    esFile_FileDescriptor fp[2];
+    uint32_t bw = 0, br = 0, ofs = 0, len = 0, expected = 0;
+    long line = 0;
+    int k = 0, op = 0, zero = 0;
+
+    srand(1);
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    memset(shadowSize, 0, sizeof(shadowSize));
+
+    for (k = 0; k < 2; k++)
+    {
+        TEST_CHECK(esFile_Open(&fp[k], paths[k], ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_COMPRESSED) == 0);
+    }
+
+    for (int i = 0; i < 1500; i++)
+    {
+        k = rand() % 2;
+        op = rand() % 10;
+        if (op < 5)
+        {
+            len = 1 + rand() % (op == 0 ? 8000 : 300);
+            if (shadowSize[k] + len > limits[k])
+            {
+                continue;
+            }
+
+            FillLog(buff, len, &line);
+            if (rand() % 20 == 0)
+            {
+                TestFill(buff, len, i);
+            }
+            zero = rand() % 30 == 0;
+            if (zero)
+            {
+                memset(buff, 0, len);
+            }
+
+            TEST_CHECK(esFile_Seek(&fp[k], shadowSize[k]) == 0);
+            TEST_CHECK(esFile_Write(&fp[k], zero ? NULL : buff, len, &bw) == 0 && bw == len);
+            memcpy(shadow[k] + shadowSize[k], buff, len);
+            shadowSize[k] += len;
+        }
+        else if (op < 9)
+        {
+            ofs = shadowSize[k] ? rand() % (shadowSize[k] + 1) : 0;
+            len = rand() % (op == 5 ? sizeof(buff) : 500);
+            expected = shadowSize[k] - ofs < len ? shadowSize[k] - ofs : len;
+
+            TEST_CHECK(esFile_Seek(&fp[k], ofs) == 0);
+            TEST_CHECK(esFile_Read(&fp[k], buff, len, &br) == 0 && br == expected);
+            TEST_CHECK(memcmp(buff, shadow[k] + ofs, br) == 0);
+        }
+        else
+        {
+            esFile_Close(&fp[0]);
+            esFile_Close(&fp[1]);
+            TestRemount();
+            for (int j = 0; j < 2; j++)
+            {
+                TEST_CHECK(esFile_Open(&fp[j], paths[j], ESFILE_MODE_OPEN_APPEND | ESFILE_MODE_WRITE) == 0);
+                TEST_CHECK(esFile_Size(&fp[j]) == (int)shadowSize[j]);
+            }
+        }
+    }
+
+    esFile_Close(&fp[0]);
+    esFile_Close(&fp[1]);
+    TestRemount();
+    TEST_CHECK(TestCheckFile(paths[0], shadow[0], shadowSize[0]));
+    TEST_CHECK(TestCheckFile(paths[1], shadow[1], shadowSize[1]));
+}
+
+static void UnencryptedFrames(void)
+{
+    long line = 0;
+
+    TestMount(1);
+    FillLog(shadow[0], 20000, &line);
+
+    TEST_CHECK(TestWriteFile("log.txt", ESFILE_MODE_COMPRESSED | ESFILE_MODE_PLAIN, shadow[0], 20000) == 0);
+    TEST_CHECK(!TestNandContains(shadow[0], 200));
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("log.txt", shadow[0], 20000));
+}
+
+int main(void)
+{
+    TEST_RUN(LogRoundTrip);
+    TEST_RUN(RandomAccess);
+    TEST_RUN(UnencryptedFrames);
+    return TestReport();
+}
@@ -0,0 +1,148 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_crc.h"
+#include "esFile_test.h"
+
+static const char marker[] = "CORRUPT-ME-MARKER";
+static uint8_t data[10000];
+static uint8_t buff[10000];
+
+static void KnownAnswer(void)
+{
+    uint32_t whole = 0, split = 0;
+
+    TEST_CHECK(esFile_Crc32c(0, (const uint8_t *)"123456789", 9) == 0xE3069283);
+
+    TestFill(data, 4096, 1);
+    whole = esFile_Crc32c(0, data, 4096);
+    split = esFile_Crc32c(esFile_Crc32c(0, data, 1001), data + 1001, 3095);
+    TEST_CHECK(whole == split);
+}
+
+/*
+ * @brief Write a file in small pieces with a second writer interleaved.
+ *  The interleaving keeps both files switching between their last sectors,
+    which is the case the deferred sealing has to get right.
+ */
+static void WriteInterleaved(const char *pathA, const char *pathB)
+{
+    esFile_FileDescriptor fa, fb;
+    uint32_t bw = 0, br = 0;
+
+    TEST_CHECK(esFile_Open(&fa, pathA, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_PLAIN) == 0);
+    TEST_CHECK(esFile_Open(&fb, pathB, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_READ) == 0);
+    for (uint32_t ofs = 0; ofs < sizeof(data); ofs += 10)
+    {
+        TEST_CHECK(esFile_Write(&fa, data + ofs, 10, &bw) == 0 && bw == 10);
+        TEST_CHECK(esFile_Write(&fb, data + ofs, 10, &bw) == 0 && bw == 10);
+    }
+
+    // Unsealed sectors read back while the writer is still open
+    TEST_CHECK(esFile_Seek(&fb, 0) == 0);
+    TEST_CHECK(esFile_Read(&fb, buff, sizeof(buff), &br) == 0 && br == sizeof(buff));
+    TEST_CHECK(memcmp(buff, data, sizeof(data)) == 0);
+
+    esFile_Close(&fa);
+    esFile_Close(&fb);
+}
+
+static void SealedRoundTrip(void)
+{
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    TestFill(data, sizeof(data), 2);
+    memcpy(data + 3000, marker, sizeof(marker));
+
+    WriteInterleaved("a.bin", "b.bin");
+    WriteInterleaved("e:a.bin", "e:b.bin");
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("b.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:b.bin", data, sizeof(data)));
+
+    // The sectors filled piecewise were sealed as the writer moved on
+    TEST_CHECK(TestNandCorrupt(marker, sizeof(marker)));
+    TEST_CHECK(esFile_Init(0) == 0);
+    TEST_CHECK(!TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("b.bin", data, sizeof(data)));
+}
+
+static void CorruptionDetected(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t br = 0;
+
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    TestFill(data, sizeof(data), 3);
+    memcpy(data + 3000, marker, sizeof(marker));
+
+    TEST_CHECK(TestWriteFile("a.bin", ESFILE_MODE_PLAIN, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("e:a.bin", ESFILE_MODE_PLAIN, data, 5000) == 0);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(TestNandCorrupt(marker, sizeof(marker)));
+    TEST_CHECK(TestEepromCorrupt(marker, sizeof(marker)));
+    TEST_CHECK(esFile_Init(0) == 0);
+
+    TEST_CHECK(esFile_Open(&fp, "a.bin", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, sizeof(buff), &br) == -5);
+    esFile_Close(&fp);
+
+    TEST_CHECK(esFile_Open(&fp, "e:a.bin", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 5000, &br) == -5);
+    esFile_Close(&fp);
+
+    // The data before the damaged sector is still readable
+    TEST_CHECK(esFile_Open(&fp, "a.bin", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 1000, &br) == 0 && br == 1000);
+    TEST_CHECK(memcmp(buff, data, 1000) == 0);
+    esFile_Close(&fp);
+}
+
+static void UncheckedWhenDisabled(void)
+{
+    TestMount(1);
+    TestFill(data, sizeof(data), 4);
+    memcpy(data + 3000, marker, sizeof(marker));
+
+    TEST_CHECK(TestWriteFile("a.bin", ESFILE_MODE_PLAIN, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Sync() == 0);
+
+    // Sectors written with the option off are left unsealed and not checked
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+
+    TEST_CHECK(TestNandCorrupt(marker, sizeof(marker)));
+    TEST_CHECK(esFile_Init(0) == 0);
+    data[3000] ^= 1;
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+}
+
+int main(void)
+{
+    TEST_RUN(KnownAnswer);
+    TEST_RUN(SealedRoundTrip);
+    TEST_RUN(CorruptionDetected);
+    TEST_RUN(UncheckedWhenDisabled);
+    return TestReport();
+}
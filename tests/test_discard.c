@@ -0,0 +1,151 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFtl.h"
+#include "esFile.h"
+#include "esFile_test.h"
+
+#define FILE_SIZE                           200000
+
+static uint8_t data[2 * FILE_SIZE];
+
+/*
+ * @brief Check that the FTL holds a page for each used sector and nothing else.
+ */
+static int PagesMatchSectors(void)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+
+    return esFtl_CalcUsedPages() == TestUsedSectors(0) + dInfos[0].fiSectorCount;
+}
+
+static void ReleasesAreBatched(void)
+{
+    long releases = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    TEST_CHECK(TestWriteFile("small", 0, data, 5 * ESFTL_NANDPAGEDATASIZE) == 0);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(PagesMatchSectors());
+
+    // A few released sectors wait in the queue until the drive is flushed
+    releases = testCounters.nandReleases;
+    TEST_CHECK(esFile_Remove("small") == 0);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(testCounters.nandReleases == releases);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(testCounters.nandReleases - releases >= 5);
+    TEST_CHECK(PagesMatchSectors());
+
+    // Many of them are given to the disk without waiting for the flush
+    TEST_CHECK(TestWriteFile("big", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Sync() == 0);
+    releases = testCounters.nandReleases;
+    TEST_CHECK(esFile_Remove("big") == 0);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(testCounters.nandReleases - releases >= ESFILE_DISCARD_BATCH);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(PagesMatchSectors());
+}
+
+/*
+ * @brief Write the sectors of a removed file again before their releases are flushed.
+ *  The allocation cursor is moved back so the new file lands on them.
+ */
+static void ReusedSectorsKept(void)
+{
+    esFile_FileDescriptor fp;
+    int first = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    TEST_CHECK(TestWriteFile("a", 0, data, 5 * ESFTL_NANDPAGEDATASIZE) == 0);
+    TEST_CHECK(esFile_Open(&fp, "a", ESFILE_MODE_READ) == 0);
+    first = fp.sector;
+    esFile_Close(&fp);
+
+    TEST_CHECK(esFile_Remove("a") == 0);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    esFile_GetVolumes()[0].allocCursor = first;
+
+    TEST_CHECK(TestWriteFile("b", 0, data + 1, 5 * ESFTL_NANDPAGEDATASIZE) == 0);
+    TEST_CHECK(esFile_Open(&fp, "b", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(fp.sector == first);
+    esFile_Close(&fp);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(PagesMatchSectors());
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("b", data + 1, 5 * ESFTL_NANDPAGEDATASIZE));
+}
+
+/*
+ * @brief Recreate a compressed file, which takes its start sector back at once.
+ */
+static void RewriteReusesStart(void)
+{
+    const char *line = "hello world log line\n";
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+
+    TestMount(1);
+    for (int i = 0; i < 3000; i++)
+    {
+        data[i] = line[i % 21];
+    }
+
+    TEST_CHECK(esFile_Open(&fp, "log", ESFILE_MODE_CREATE_NEW | ESFILE_MODE_WRITE | ESFILE_MODE_COMPRESSED) == 0);
+    TEST_CHECK(esFile_Write(&fp, data, 3000, &bw) == 0 && bw == 3000);
+    esFile_Close(&fp);
+    TEST_CHECK(esFile_Open(&fp, "log", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_COMPRESSED) == 0);
+    TEST_CHECK(esFile_Write(&fp, data, 3000, &bw) == 0 && bw == 3000);
+    esFile_Close(&fp);
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("log", data, 3000));
+    TEST_CHECK(PagesMatchSectors());
+}
+
+static void EepromReleases(void)
+{
+    TestMount(1);
+    TestFill(data, sizeof(data), 3);
+    TEST_CHECK(TestWriteFile("e:a", 0, data, 3000) == 0);
+    TEST_CHECK(TestUsedSectors(1) > 0);
+    TEST_CHECK(esFile_Remove("e:a") == 0);
+    TEST_CHECK(TestWriteFile("e:b", 0, data + 1, 3000) == 0);
+
+    TestRemount();
+    TEST_CHECK(esFile_Stat("e:a", NULL) != 0);
+    TEST_CHECK(TestCheckFile("e:b", data + 1, 3000));
+}
+
+int main(void)
+{
+    TEST_RUN(ReleasesAreBatched);
+    TEST_RUN(ReusedSectorsKept);
+    TEST_RUN(RewriteReusesStart);
+    TEST_RUN(EepromReleases);
+    return TestReport();
+}
@@ -0,0 +1,176 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_inline.h"
+#include "esFile_test.h"
+
+#if ESFILE_INLINE_FILES
+static uint8_t data[1500];
+static uint8_t buff[1500];
+
+/*
+ * @brief Run a test case on both drives, with and without encryption.
+ * @param fn
+ */
+static void ForEachSetup(void (*fn)(const char *prefix, uint8_t did))
+{
+    const char *prefixes[2] = {"", "e:"};
+
+    for (int encrypted = 0; encrypted < 2; encrypted++)
+    {
+        for (uint8_t did = 0; did < 2; did++)
+        {
+            TestMount(1);
+            esFile_SetDefaultEncryption(did, encrypted);
+            fn(prefixes[did], did);
+        }
+    }
+}
+
+static void SmallFile(const char *prefix, uint8_t did)
+{
+    esFile_FileDescriptor fp;
+    char path[16];
+    uint32_t bw = 0, br = 0;
+    int used = TestUsedSectors(did);
+
+    sprintf(path, "%sflag", prefix);
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Write(&fp, "ON", 2, &bw) == 0 && bw == 2);
+    TEST_CHECK(fp.sector == 0);
+    TEST_CHECK(esFile_Seek(&fp, 0) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, 8, &br) == 0 && br == 2 && memcmp(buff, "ON", 2) == 0);
+    TEST_CHECK(esFile_Seek(&fp, 1) == 0);
+    TEST_CHECK(esFile_Write(&fp, "FF", 2, &bw) == 0 && bw == 2);
+    esFile_Close(&fp);
+    TEST_CHECK(TestUsedSectors(did) == used);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(did) == used);
+    TEST_CHECK(TestCheckFile(path, (const uint8_t *)"OFF", 3));
+}
+
+static void Promote(const char *prefix, uint8_t did)
+{
+    esFile_FileDescriptor fp;
+    char path[16];
+    uint32_t bw = 0, br = 0;
+    int used = TestUsedSectors(did);
+
+    sprintf(path, "%sgrow", prefix);
+    TestFill(data, sizeof(data), did);
+
+    // Fill the slot exactly, the next byte moves the data out of it
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Write(&fp, data, ESFILE_INLINE_SIZE, &bw) == 0 && bw == ESFILE_INLINE_SIZE);
+    TEST_CHECK(fp.sector == 0);
+    TEST_CHECK(esFile_Write(&fp, data + ESFILE_INLINE_SIZE, sizeof(data) - ESFILE_INLINE_SIZE, &bw) == 0);
+    TEST_CHECK(fp.sector != 0);
+    TEST_CHECK(esFile_Seek(&fp, 0) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, sizeof(buff), &br) == 0 && br == sizeof(data));
+    TEST_CHECK(memcmp(buff, data, sizeof(data)) == 0);
+    esFile_Close(&fp);
+
+    // Promote from the middle of the slot
+    sprintf(path, "%smid", prefix);
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Write(&fp, data, 10, &bw) == 0);
+    TEST_CHECK(esFile_Seek(&fp, 5) == 0);
+    TEST_CHECK(esFile_Write(&fp, data + 5, 600, &bw) == 0 && bw == 600);
+    esFile_Close(&fp);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(did) > used);
+    sprintf(path, "%sgrow", prefix);
+    TEST_CHECK(TestCheckFile(path, data, sizeof(data)));
+    sprintf(path, "%smid", prefix);
+    TEST_CHECK(TestCheckFile(path, data, 605));
+}
+
+static void TruncateReleases(const char *prefix, uint8_t did)
+{
+    esFile_FileDescriptor fp;
+    char path[16];
+    int used = TestUsedSectors(did);
+
+    sprintf(path, "%sgrow", prefix);
+    TestFill(data, sizeof(data), 10 + did);
+    TEST_CHECK(TestWriteFile(path, 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestUsedSectors(did) > used);
+
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE) == 0);
+    TEST_CHECK(fp.sector == 0);
+    esFile_Close(&fp);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(TestUsedSectors(did) == used);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(did) == used);
+    TEST_CHECK(TestCheckFile(path, data, 0));
+}
+
+static void SmallFiles(void)
+{
+    ForEachSetup(SmallFile);
+}
+
+static void Promotion(void)
+{
+    ForEachSetup(Promote);
+}
+
+static void Truncation(void)
+{
+    ForEachSetup(TruncateReleases);
+}
+
+static void StaleReaderAfterPromote(void)
+{
+    esFile_FileDescriptor writer, reader;
+    uint32_t bw = 0, br = 0;
+
+    TestMount(1);
+    memset(data, 'A', 110);
+
+    TEST_CHECK(esFile_Open(&writer, "a", ESFILE_MODE_CREATE_NEW | ESFILE_MODE_WRITE | ESFILE_MODE_PLAIN) == 0);
+    TEST_CHECK(esFile_Write(&writer, data, 10, &bw) == 0);
+    TEST_CHECK(esFile_Open(&reader, "a", ESFILE_MODE_READ) == 0);
+
+    // The reader was opened on the inline slot, the data moves under it
+    TEST_CHECK(esFile_Write(&writer, data + 10, 100, &bw) == 0 && bw == 100);
+    TEST_CHECK(esFile_Read(&reader, buff, sizeof(buff), &br) == 0 && br == 110);
+    TEST_CHECK(memcmp(buff, data, 110) == 0);
+
+    esFile_Close(&reader);
+    esFile_Close(&writer);
+}
+
+#endif
+
+int main(void)
+{
+#if ESFILE_INLINE_FILES
+    TEST_RUN(SmallFiles);
+    TEST_RUN(Promotion);
+    TEST_RUN(Truncation);
+    TEST_RUN(StaleReaderAfterPromote);
+#endif
+    return TestReport();
+}
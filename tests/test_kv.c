@@ -0,0 +1,191 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+#define KEY_COUNT                           100
+
+static esFile_Kv kv;
+static uint8_t values[KEY_COUNT][ESFILE_KV_MAXVALUE];
+static int lengths[KEY_COUNT];
+static uint8_t present[KEY_COUNT];
+
+static void KeyName(int i, char *key)
+{
+    sprintf(key, "cfg/%s/%d", i % 3 ? "net" : "sensor.calibration.offset", i);
+}
+
+static void CheckAll(void)
+{
+    uint8_t value[ESFILE_KV_MAXVALUE];
+    char key[64];
+    int rv = 0;
+
+    for (int i = 0; i < KEY_COUNT; i++)
+    {
+        KeyName(i, key);
+        rv = esFile_KvGet(&kv, key, value, sizeof(value));
+        if (!present[i])
+        {
+            TEST_CHECK(rv == -1);
+        }
+        else
+        {
+            TEST_CHECK(rv == lengths[i] && memcmp(value, values[i], rv) == 0);
+        }
+    }
+}
+
+static void PutGetDelete(void)
+{
+    char value[16];
+
+    TestMount(1);
+    TEST_CHECK(esFile_KvOpen(&kv, "kv.db") == 0);
+    TEST_CHECK(esFile_KvPut(&kv, "name", "esFile", 6) == 0);
+    TEST_CHECK(esFile_KvPut(&kv, "empty", NULL, 0) == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "name", value, sizeof(value)) == 6 && memcmp(value, "esFile", 6) == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "name", value, 3) == 6 && memcmp(value, "esF", 3) == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "empty", value, sizeof(value)) == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "missing", value, sizeof(value)) == -1);
+
+    TEST_CHECK(esFile_KvDelete(&kv, "empty") == 0);
+    TEST_CHECK(esFile_KvDelete(&kv, "empty") == -1);
+    TEST_CHECK(esFile_KvClose(&kv) == 0);
+
+    TestRemount();
+    TEST_CHECK(esFile_KvOpen(&kv, "kv.db") == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "name", value, sizeof(value)) == 6 && memcmp(value, "esFile", 6) == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "empty", value, sizeof(value)) == -1);
+    TEST_CHECK(esFile_KvClose(&kv) == 0);
+}
+
+static void UncommittedLost(void)
+{
+    char value[16];
+
+    TestMount(1);
+    TEST_CHECK(esFile_KvOpen(&kv, "kv.db") == 0);
+    TEST_CHECK(esFile_KvPut(&kv, "kept", "1", 1) == 0);
+    TEST_CHECK(esFile_KvCommit(&kv) == 0);
+    TEST_CHECK(esFile_KvPut(&kv, "lost", "2", 1) == 0);
+
+    // A reset before the commit drops the batch as a whole
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(esFile_Init(0) == 0);
+    TEST_CHECK(esFile_KvOpen(&kv, "kv.db") == 0);
+    TEST_CHECK(esFile_KvGet(&kv, "kept", value, sizeof(value)) == 1);
+    TEST_CHECK(esFile_KvGet(&kv, "lost", value, sizeof(value)) == -1);
+    TEST_CHECK(esFile_KvClose(&kv) == 0);
+}
+
+/*
+ * @brief Put, delete, compact and reopen at random against a shadow table.
+ *  The store is reopened both after a close and after a bare commit, and the
+    compaction is stepped with a small budget so the reopen often lands in the
+    middle of one.
+ */
+static void RandomOperations(const char *path)
+{
+    char key[64];
+    int op = 0, i = 0, compactions = 0;
+    uint8_t compacting = 0;
+
+    srand(1);
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    memset(present, 0, sizeof(present));
+
+    TEST_CHECK(esFile_KvOpen(&kv, path) == 0);
+    for (int it = 0; it < 10000; it++)
+    {
+        op = rand() % 20;
+        i = rand() % KEY_COUNT;
+        KeyName(i, key);
+        if (op < 10)
+        {
+            lengths[i] = rand() % (op == 0 ? ESFILE_KV_MAXVALUE : 24);
+            TestFill(values[i], lengths[i], it);
+            TEST_CHECK(esFile_KvPut(&kv, key, values[i], lengths[i]) == 0);
+            present[i] = 1;
+        }
+        else if (op < 13)
+        {
+            TEST_CHECK(esFile_KvDelete(&kv, key) == (present[i] ? 0 : -1));
+            present[i] = 0;
+        }
+        else if (op < 15)
+        {
+            TEST_CHECK(esFile_KvCommit(&kv) == 0);
+        }
+        else if (op < 19)
+        {
+            TEST_CHECK(esFile_KvCompactStep(&kv, 300) >= 0);
+        }
+        else if (rand() % 10 == 0)
+        {
+            if (rand() % 2)
+            {
+                TEST_CHECK(esFile_KvClose(&kv) == 0);
+            }
+            else
+            {
+                TEST_CHECK(esFile_KvCommit(&kv) == 0);
+            }
+            TestRemount();
+            TEST_CHECK(esFile_KvOpen(&kv, path) == 0);
+        }
+
+        if (compacting && !kv.compacting)
+        {
+            compactions++;
+        }
+        compacting = kv.compacting;
+
+        if (it % 500 == 0)
+        {
+            CheckAll();
+        }
+    }
+
+    CheckAll();
+    TEST_CHECK(compactions > 0);
+    TEST_CHECK(esFile_KvClose(&kv) == 0);
+}
+
+static void RandomOnNand(void)
+{
+    RandomOperations("kv.db");
+}
+
+static void RandomOnEeprom(void)
+{
+    RandomOperations("e:kv.db");
+}
+
+int main(void)
+{
+    TEST_RUN(PutGetDelete);
+    TEST_RUN(UncommittedLost);
+    TEST_RUN(RandomOnNand);
+    TEST_RUN(RandomOnEeprom);
+    return TestReport();
+}
@@ -0,0 +1,497 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_lock.h"
+#include "esFile_test.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define RAM_SECTORS                         200
+#define RAM_SECTORSIZE                      1024
+#define FILE_MAXSIZE                        5000
+#define VERSION_SIZE                        3000
+
+static uint8_t ramSectors[RAM_SECTORS][RAM_SECTORSIZE];
+static uint32_t ramSectorTable[(RAM_SECTORS + 31) / 32];
+static uint16_t ramChainTable[RAM_SECTORS];
+static uint8_t ramMetaCache[4 * RAM_SECTORSIZE];
+static volatile int workerDone = 0;
+
+static int RamInit(uint8_t format)
+{
+    if (format)
+    {
+        memset(ramSectors, 0xFF, sizeof(ramSectors));
+    }
+    return 0;
+}
+
+static int RamRead(int sector, uint8_t *buff, int idx, int count)
+{
+    memcpy(buff, &ramSectors[sector][idx], count);
+    return 0;
+}
+
+static int RamWrite(int sector, uint8_t *buff, int idx, int count)
+{
+    memcpy(&ramSectors[sector][idx], buff, count);
+    return 0;
+}
+
+static int RamRelease(int sector)
+{
+    (void)sector;
+    return 0;
+}
+
+/*
+ * @brief Add a third drive 'r:' kept in RAM, with a write-through meta cache.
+ */
+static void RegisterRamDrive(void)
+{
+    esFile_DriveInfo info = {
+        .fiSectorCount = 4,
+        .dataSectorStart = 4,
+        .dataSectorEnd = RAM_SECTORS,
+        .sectorCapacity = RAM_SECTORSIZE,
+        .diskInit = RamInit,
+        .diskRead = RamRead,
+        .diskWrite = RamWrite,
+        .diskRelease = RamRelease,
+        .metaPolicy = ESFILE_META_WRITETHROUGH,
+        .metaCache = ramMetaCache,
+        .chainTable = ramChainTable,
+        .sectorTable = ramSectorTable,
+        .prefix = 'r'};
+
+    TEST_CHECK(esFile_RegisterDrive(&info) == 2);
+    TEST_CHECK(esFile_RegisterDrive(&info) < 0);
+}
+
+/*
+ * @brief Create, read back and remove files on one drive.
+ *  Several of these run at once, two of them on the same drive.
+ * @param arg path prefix
+ * @return NULL
+ */
+static void *DriveWorker(void *arg)
+{
+    const char *prefix = (const char *)arg;
+    esFile_FileDescriptor fp;
+    uint8_t data[FILE_MAXSIZE], buff[FILE_MAXSIZE + 1];
+    char path[16];
+    uint32_t bw = 0, br = 0;
+    uint16_t mode = 0;
+    int len = 0, rounds = prefix[0] ? 20 : 60;
+
+    for (int it = 0; it < rounds; it++)
+    {
+        len = (it * 397) % (prefix[0] == 'e' ? 1500 : FILE_MAXSIZE) + 1;
+        mode = ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE;
+        mode |= (it % 5 == 0 ? ESFILE_MODE_COMPRESSED : 0) | (it & 1 ? ESFILE_MODE_PLAIN : 0);
+        sprintf(path, "%sf%d", prefix, it % 4);
+        TestFill(data, len, it + prefix[0]);
+
+        TEST_CHECK(esFile_Open(&fp, path, mode) == 0);
+        TEST_CHECK(esFile_Write(&fp, data, len, &bw) == 0 && bw == (uint32_t)len);
+        esFile_Close(&fp);
+
+        TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_READ) == 0);
+        TEST_CHECK(esFile_Read(&fp, buff, sizeof(buff), &br) == 0 && br == (uint32_t)len);
+        TEST_CHECK(memcmp(buff, data, len) == 0);
+        esFile_Close(&fp);
+
+        if (it % 7 == 3)
+        {
+            TEST_CHECK(esFile_Remove(path) == 0);
+        }
+        if (it % 11 == 0)
+        {
+            TEST_CHECK(esFile_Sync() == 0);
+        }
+    }
+
+    return NULL;
+}
+
+static void ConcurrentDrives(void)
+{
+    const char *prefixes[4] = {"", "e:", "r:", "r:x"};
+    pthread_t threads[4];
+    uint8_t data[FILE_MAXSIZE];
+
+    TestMount(1);
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_CHECK(pthread_create(&threads[i], NULL, DriveWorker, (void *)prefixes[i]) == 0);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The last kept file of every worker is still there after a remount
+    TestRemount();
+    for (int i = 0; i < 4; i++)
+    {
+        int it = prefixes[i][0] ? 19 : 58;
+        int len = (it * 397) % (prefixes[i][0] == 'e' ? 1500 : FILE_MAXSIZE) + 1;
+        char path[16];
+
+        sprintf(path, "%sf%d", prefixes[i], it % 4);
+        TestFill(data, len, it + prefixes[i][0]);
+        TEST_CHECK(TestCheckFile(path, data, len));
+    }
+}
+
+static void *EepromWorker(void *arg)
+{
+    uint8_t data[600];
+
+    (void)arg;
+    TestFill(data, sizeof(data), 5);
+    TEST_CHECK(TestWriteFile("e:free", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestCheckFile("e:free", data, sizeof(data)));
+    workerDone = 1;
+    return NULL;
+}
+
+/*
+ * @brief Work on the EEPROM drive while the NAND drive is held.
+ *  The worker has to finish without waiting for the NAND lock.
+ */
+static void OtherDriveNotBlocked(void)
+{
+    pthread_t thread;
+
+    TestMount(1);
+    workerDone = 0;
+
+    esFile_Lock(0);
+    TEST_CHECK(pthread_create(&thread, NULL, EepromWorker, NULL) == 0);
+    for (int i = 0; i < 200 && !workerDone; i++)
+    {
+        usleep(10000);
+    }
+    TEST_CHECK(workerDone);
+    esFile_Unlock(0);
+
+    pthread_join(thread, NULL);
+}
+
+/*
+ * @brief Wait for the worker thread to set its flag, for at most a second.
+ * @return the flag
+ */
+static int WaitWorker(void)
+{
+    for (int i = 0; i < 100 && !workerDone; i++)
+    {
+        usleep(10000);
+    }
+    return workerDone;
+}
+
+#if ESFILE_CACHE_SETS > 1 || ESFILE_CACHE_ENTRIES > 1
+static void *BlockedWriter(void *arg)
+{
+    uint8_t data[3000];
+
+    TestFill(data, sizeof(data), 9);
+    TEST_CHECK(TestWriteFile((const char *)arg, 0, data, sizeof(data)) == 0);
+    return NULL;
+}
+#endif
+
+#if ESFILE_CACHE_SETS > 1
+/*
+ * @brief Work on the EEPROM drive while a NAND write is held in the device.
+ *  The NAND writer keeps the device busy, the worker has to read and write
+    the EEPROM all the same.
+ */
+static void OtherDeviceNotBlocked(void)
+{
+    pthread_t writer, worker;
+    uint8_t data[3000];
+
+    TestMount(1);
+    workerDone = 0;
+
+    TestNandBlockWrites(1);
+    TEST_CHECK(pthread_create(&writer, NULL, BlockedWriter, (void *)"held") == 0);
+    TEST_CHECK(TestNandWaitBlocked());
+    TEST_CHECK(pthread_create(&worker, NULL, EepromWorker, NULL) == 0);
+    TEST_CHECK(WaitWorker());
+    TestNandBlockWrites(0);
+
+    pthread_join(writer, NULL);
+    pthread_join(worker, NULL);
+
+    TestFill(data, sizeof(data), 9);
+    TEST_CHECK(TestCheckFile("held", data, sizeof(data)));
+}
+#endif
+
+#if ESFILE_CACHE_ENTRIES > 1
+static void *OpenReader(void *arg)
+{
+    esFile_FileDescriptor *fp = (esFile_FileDescriptor *)arg;
+    uint8_t data[300], buff[300];
+    uint32_t br = 0;
+
+    TestFill(data, sizeof(data), 4);
+    TEST_CHECK(esFile_Read(fp, buff, sizeof(buff), &br) == 0 && br == sizeof(buff));
+    TEST_CHECK(memcmp(buff, data, sizeof(data)) == 0);
+    workerDone = 1;
+    return NULL;
+}
+
+/*
+ * @brief Read a cached file while a writer of the same drive is held in the device.
+ *  The reader only takes the lock of its file and finds its sectors in the
+    cache, so it must not wait for the write. The file is opened up front,
+    opening takes the lock of the drive which the writer holds.
+ */
+static void ReaderNotBlockedByDevice(void)
+{
+    esFile_FileDescriptor fp;
+    pthread_t writer, reader;
+    uint8_t data[300];
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 4);
+    TEST_CHECK(TestWriteFile("b", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestCheckFile("b", data, sizeof(data)));
+    TEST_CHECK(esFile_Open(&fp, "b", ESFILE_MODE_READ) == 0);
+    workerDone = 0;
+
+    TestNandBlockWrites(1);
+    TEST_CHECK(pthread_create(&writer, NULL, BlockedWriter, (void *)"held") == 0);
+    TEST_CHECK(TestNandWaitBlocked());
+    TEST_CHECK(pthread_create(&reader, NULL, OpenReader, &fp) == 0);
+    TEST_CHECK(WaitWorker());
+    TestNandBlockWrites(0);
+
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    esFile_Close(&fp);
+}
+#endif
+
+#if ESFILE_CACHE_SETS > 1 && ESFILE_COMPRESS_SETS > 1
+static void *CompressedWriter(void *arg)
+{
+    uint8_t data[3000];
+    uint32_t bw = 0;
+
+    memset(data, 'n', sizeof(data));
+    TEST_CHECK(esFile_Write((esFile_FileDescriptor *)arg, data, sizeof(data), &bw) == 0 && bw == sizeof(data));
+    return NULL;
+}
+
+static void *CompressedWorker(void *arg)
+{
+    uint8_t data[1200];
+
+    (void)arg;
+    memset(data, 'e', sizeof(data));
+    TEST_CHECK(TestWriteFile("e:z", ESFILE_MODE_COMPRESSED, data, sizeof(data)) == 0);
+    TEST_CHECK(TestCheckFile("e:z", data, sizeof(data)));
+    workerDone = 1;
+    return NULL;
+}
+
+/*
+ * @brief Compress on the EEPROM drive while a compressed NAND write is held in the device.
+ *  The drives have their own compression buffers and locks, so the held
+    writer does not stop the compression of the other drive. The file is
+    created up front, the write of its file info is not the one to hold.
+ */
+static void CompressionPerDrive(void)
+{
+    esFile_FileDescriptor fp;
+    pthread_t writer, worker;
+    uint8_t data[3000];
+
+    TestMount(1);
+    workerDone = 0;
+    TEST_CHECK(esFile_Open(&fp, "held", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_COMPRESSED) == 0);
+
+    TestNandBlockWrites(1);
+    TEST_CHECK(pthread_create(&writer, NULL, CompressedWriter, &fp) == 0);
+    TEST_CHECK(TestNandWaitBlocked());
+    TEST_CHECK(pthread_create(&worker, NULL, CompressedWorker, NULL) == 0);
+    TEST_CHECK(WaitWorker());
+    TestNandBlockWrites(0);
+
+    pthread_join(writer, NULL);
+    pthread_join(worker, NULL);
+    esFile_Close(&fp);
+
+    memset(data, 'n', sizeof(data));
+    TEST_CHECK(TestCheckFile("held", data, sizeof(data)));
+}
+#endif
+
+static void *ReadWorker(void *arg)
+{
+    esFile_FileDescriptor fp;
+    uint8_t buff[16];
+    uint32_t br = 0;
+
+    if (esFile_Open(&fp, (const char *)arg, ESFILE_MODE_READ) == 0)
+    {
+        TEST_CHECK(esFile_Read(&fp, buff, sizeof(buff), &br) == 0 && br > 0);
+        esFile_Close(&fp);
+    }
+
+    workerDone = 1;
+    return NULL;
+}
+
+/*
+ * @brief Run a reader while a file lock is held on one of two files.
+ * @param path file that is read
+ * @param exclusive lock mode taken on the file "a"
+ * @return 1 if the reader finished before the lock was released
+ */
+static int ReadWhileLocked(const char *path, uint8_t exclusive)
+{
+    esFile_FileDescriptor fp;
+    pthread_t thread;
+    int done = 0;
+
+    TEST_CHECK(esFile_Open(&fp, "a", ESFILE_MODE_READ) == 0);
+    workerDone = 0;
+
+    esFile_FileLock(fp.did, fp.uid, exclusive);
+    TEST_CHECK(pthread_create(&thread, NULL, ReadWorker, (void *)path) == 0);
+    done = WaitWorker();
+    esFile_FileUnlock(fp.did, fp.uid, exclusive);
+
+    pthread_join(thread, NULL);
+    TEST_CHECK(workerDone);
+    esFile_Close(&fp);
+    return done;
+}
+
+static void WriterExcludesItsFileOnly(void)
+{
+    TestMount(1);
+    TEST_CHECK(TestWriteFile("a", 0, (const uint8_t *)"first", 5) == 0);
+    TEST_CHECK(TestWriteFile("b", 0, (const uint8_t *)"second", 6) == 0);
+
+    TEST_CHECK(ReadWhileLocked("b", 1) == 1);
+    TEST_CHECK(ReadWhileLocked("a", 0) == 1);
+    TEST_CHECK(ReadWhileLocked("a", 1) == 0);
+}
+
+static void *VersionWriter(void *arg)
+{
+    esFile_FileDescriptor fp;
+    uint8_t data[VERSION_SIZE];
+    uint32_t bw = 0;
+
+    TEST_CHECK(esFile_Open(&fp, (const char *)arg, ESFILE_MODE_READ | ESFILE_MODE_WRITE) == 0);
+    for (int version = 1; version <= 100; version++)
+    {
+        memset(data, version, sizeof(data));
+        TEST_CHECK(esFile_Seek(&fp, 0) == 0);
+        TEST_CHECK(esFile_Write(&fp, data, sizeof(data), &bw) == 0 && bw == sizeof(data));
+    }
+    esFile_Close(&fp);
+
+    workerDone = 1;
+    return NULL;
+}
+
+static void *VersionReader(void *arg)
+{
+    esFile_FileDescriptor fp;
+    uint8_t buff[VERSION_SIZE];
+    uint32_t br = 0;
+    int reads = 0, torn = 0;
+
+    while (!workerDone || reads == 0)
+    {
+        TEST_CHECK(esFile_Open(&fp, (const char *)arg, ESFILE_MODE_READ) == 0);
+        TEST_CHECK(esFile_Read(&fp, buff, sizeof(buff), &br) == 0 && br == sizeof(buff));
+        esFile_Close(&fp);
+
+        for (uint32_t i = 1; i < br; i++)
+        {
+            torn += buff[i] != buff[0];
+        }
+        reads++;
+    }
+
+    TEST_CHECK(torn == 0);
+    return NULL;
+}
+
+/*
+ * @brief Overwrite a file while other descriptors read it.
+ *  Every write replaces the whole content with a single version byte, so a
+    read that overlaps a write would see two versions.
+ */
+static void ReadersSeeWholeWrites(void)
+{
+    const char *paths[2] = {"v", "e:v"};
+    pthread_t threads[3];
+    uint8_t data[VERSION_SIZE];
+
+    TestMount(1);
+    for (int i = 0; i < 2; i++)
+    {
+        memset(data, 0, sizeof(data));
+        TEST_CHECK(TestWriteFile(paths[i], 0, data, sizeof(data)) == 0);
+        workerDone = 0;
+
+        TEST_CHECK(pthread_create(&threads[0], NULL, VersionWriter, (void *)paths[i]) == 0);
+        TEST_CHECK(pthread_create(&threads[1], NULL, VersionReader, (void *)paths[i]) == 0);
+        TEST_CHECK(pthread_create(&threads[2], NULL, VersionReader, (void *)paths[i]) == 0);
+        for (int j = 0; j < 3; j++)
+        {
+            pthread_join(threads[j], NULL);
+        }
+
+        memset(data, 100, sizeof(data));
+        TestRemount();
+        TEST_CHECK(TestCheckFile(paths[i], data, sizeof(data)));
+    }
+}
+
+int main(void)
+{
+    RegisterRamDrive();
+    TEST_RUN(ConcurrentDrives);
+    TEST_RUN(OtherDriveNotBlocked);
+#if ESFILE_CACHE_SETS > 1
+    TEST_RUN(OtherDeviceNotBlocked);
+#endif
+#if ESFILE_CACHE_ENTRIES > 1
+    TEST_RUN(ReaderNotBlockedByDevice);
+#endif
+#if ESFILE_CACHE_SETS > 1 && ESFILE_COMPRESS_SETS > 1
+    TEST_RUN(CompressionPerDrive);
+#endif
+    TEST_RUN(WriterExcludesItsFileOnly);
+    TEST_RUN(ReadersSeeWholeWrites);
+    return TestReport();
+}
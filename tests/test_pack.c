@@ -0,0 +1,219 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+#define FILE_COUNT                          40
+
+static uint8_t data[FILE_COUNT][ESFILE_PACK_MAX + 100];
+static int lengths[FILE_COUNT];
+static uint8_t buff[ESFILE_PACK_MAX + 100];
+
+static void FilePath(const char *prefix, int i, char *path)
+{
+    sprintf(path, "%sf%d", prefix, i);
+}
+
+static void CheckFiles(const char *prefix, int count)
+{
+    char path[16];
+
+    for (int i = 0; i < count; i++)
+    {
+        FilePath(prefix, i, path);
+        if (lengths[i] == 0)
+        {
+            TEST_CHECK(esFile_Stat(path, NULL) != 0);
+        }
+        else
+        {
+            TEST_CHECK(TestCheckFile(path, data[i], lengths[i]));
+        }
+    }
+}
+
+static void SetOptions(uint8_t encrypted)
+{
+    for (uint8_t did = 0; did < 2; did++)
+    {
+        esFile_SetDefaultEncryption(did, encrypted);
+        esFile_SetChecksumVerification(did, 1);
+    }
+}
+
+/*
+ * @brief Pack files written in small pieces and edit them.
+ *  The pieces move each file from its inline slot to a pack region and on to
+    bigger regions. The edits overwrite in place, grow past the pack limit,
+    truncate and remove, with remounts in between.
+ */
+static void SharedSectors(const char *prefix, uint8_t did, uint8_t encrypted)
+{
+    esFile_FileDescriptor fp;
+    char path[16];
+    uint32_t bw = 0, chunk = 0;
+    int count = did ? 12 : FILE_COUNT, used = 0;
+
+    TestMount(1);
+    SetOptions(encrypted);
+    used = TestUsedSectors(did);
+    srand(encrypted * 2 + did + 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        lengths[i] = did ? 30 + rand() % 200 : 200 + rand() % 300;
+        TestFill(data[i], lengths[i], rand());
+
+        FilePath(prefix, i, path);
+        TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE) == 0);
+        for (int ofs = 0; ofs < lengths[i]; ofs += chunk)
+        {
+            chunk = 1 + rand() % 50;
+            if (chunk > (uint32_t)(lengths[i] - ofs))
+            {
+                chunk = lengths[i] - ofs;
+            }
+            TEST_CHECK(esFile_Write(&fp, data[i] + ofs, chunk, &bw) == 0 && bw == chunk);
+        }
+        esFile_Close(&fp);
+    }
+
+    used = TestUsedSectors(did) - used;
+#if ESFILE_INLINE_FILES
+    TEST_CHECK(used < count / 2);
+#else
+    // Without inline files every file starts in a data sector of its own
+    TEST_CHECK(used == count);
+#endif
+    CheckFiles(prefix, count);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(did) == used);
+    CheckFiles(prefix, count);
+
+    FilePath(prefix, 0, path);
+    memset(data[0] + 5, 0xAB, 10);
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_READ | ESFILE_MODE_WRITE) == 0);
+    TEST_CHECK(esFile_Seek(&fp, 5) == 0);
+    TEST_CHECK(esFile_Write(&fp, data[0] + 5, 10, &bw) == 0 && bw == 10);
+    esFile_Close(&fp);
+
+    FilePath(prefix, 1, path);
+    TestFill(data[1] + lengths[1], sizeof(data[1]) - lengths[1], 99);
+    TEST_CHECK(esFile_Open(&fp, path, ESFILE_MODE_OPEN_APPEND | ESFILE_MODE_WRITE) == 0);
+    TEST_CHECK(esFile_Write(&fp, data[1] + lengths[1], sizeof(data[1]) - lengths[1], &bw) == 0);
+    lengths[1] = sizeof(data[1]);
+    esFile_Close(&fp);
+
+    FilePath(prefix, 2, path);
+    memcpy(data[2], "tiny", 4);
+    lengths[2] = 4;
+    TEST_CHECK(TestWriteFile(path, 0, data[2], 4) == 0);
+
+    FilePath(prefix, 3, path);
+    TEST_CHECK(esFile_Remove(path) == 0);
+    lengths[3] = 0;
+    CheckFiles(prefix, count);
+
+    TestRemount();
+    CheckFiles(prefix, count);
+
+    // Removing every file frees the pack sectors again
+    for (int i = 0; i < count; i++)
+    {
+        FilePath(prefix, i, path);
+        esFile_Remove(path);
+    }
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(did) == 0);
+}
+
+static void PlainOnNand(void)
+{
+    SharedSectors("", 0, 0);
+}
+
+static void EncryptedOnNand(void)
+{
+    SharedSectors("", 0, 1);
+}
+
+static void PlainOnEeprom(void)
+{
+    SharedSectors("e:", 1, 0);
+}
+
+static void EncryptedOnEeprom(void)
+{
+    SharedSectors("e:", 1, 1);
+}
+
+static void StaleDescriptorAfterMove(void)
+{
+    esFile_FileDescriptor fp, writer, reader;
+    uint32_t bw = 0, br = 0;
+    char path[16];
+
+    TestMount(1);
+
+    // Three neighbours leave just enough room for x to grow once in place
+    memset(buff, 'F', sizeof(buff));
+    for (int i = 0; i < 3; i++)
+    {
+        sprintf(path, "f%d", i);
+        TEST_CHECK(TestWriteFile(path, ESFILE_MODE_PLAIN, buff, 500) == 0);
+    }
+
+    memset(buff, 'X', sizeof(buff));
+    TEST_CHECK(esFile_Open(&writer, "x", ESFILE_MODE_CREATE_NEW | ESFILE_MODE_WRITE | ESFILE_MODE_PLAIN) == 0);
+    TEST_CHECK(esFile_Write(&writer, buff, 200, &bw) == 0);
+    TEST_CHECK(esFile_Open(&reader, "x", ESFILE_MODE_READ) == 0);
+    TEST_CHECK(esFile_Write(&writer, buff, 200, &bw) == 0);
+    TEST_CHECK(esFile_Write(&writer, buff, 100, &bw) == 0);
+    esFile_Close(&writer);
+
+    // Another file takes the region x has left
+    memset(buff, 'S', sizeof(buff));
+    TEST_CHECK(TestWriteFile("y", ESFILE_MODE_PLAIN, buff, 300) == 0);
+
+    memset(buff, 0, sizeof(buff));
+    TEST_CHECK(esFile_Read(&reader, buff, 200, &br) == 0 && br == 200);
+    memset(data[0], 'X', 200);
+    TEST_CHECK(memcmp(buff, data[0], 200) == 0);
+    esFile_Close(&reader);
+
+    memset(data[0], 'S', 300);
+    TEST_CHECK(TestCheckFile("y", data[0], 300));
+    TEST_CHECK(esFile_Open(&fp, "x", ESFILE_MODE_READ) == 0 && esFile_Size(&fp) == 500);
+    esFile_Close(&fp);
+}
+
+int main(void)
+{
+    TEST_RUN(PlainOnNand);
+    TEST_RUN(EncryptedOnNand);
+    TEST_RUN(PlainOnEeprom);
+    TEST_RUN(EncryptedOnEeprom);
+    TEST_RUN(StaleDescriptorAfterMove);
+    return TestReport();
+}
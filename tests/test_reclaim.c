@@ -0,0 +1,148 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFtl.h"
+#include "esFile.h"
+#include "esFile_reclaim.h"
+#include "esFile_test.h"
+
+#define LEAKED_PAGES                        3000
+#define FILE_SIZE                           200000
+
+static uint8_t data[FILE_SIZE];
+
+/*
+ * @brief Write FTL pages for sectors the file system considers free.
+ *  This is what a session interrupted between a write and its release leaves
+    on the NAND.
+ */
+static void LeakPages(void)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+    int first = dInfos[0].dataSectorEnd - LEAKED_PAGES;
+
+    for (int i = first; i < dInfos[0].dataSectorEnd; i++)
+    {
+        TEST_CHECK(esFile_GetSectorFlag(0, i) == 0);
+        TEST_CHECK(esFtl_FtlDriverWrite(i, data, 0, 16) == 0);
+    }
+}
+
+/*
+ * @brief Run the reclamation to its end.
+ * @param budget
+ * @return the number of steps that left it in progress
+ */
+static int ReclaimAll(uint32_t budget)
+{
+    esFile_ReclaimProgress progress;
+    uint32_t done = 0;
+    int steps = 0;
+
+    while (esFile_ReclaimStep(budget) == 1)
+    {
+        esFile_GetReclaimProgress(&progress);
+        TEST_CHECK(progress.phase != ESFILE_RECLAIM_IDLE && progress.done >= done && progress.done <= progress.total);
+        done = progress.done;
+        steps++;
+    }
+
+    esFile_GetReclaimProgress(&progress);
+    TEST_CHECK(progress.phase == ESFILE_RECLAIM_IDLE && progress.done == 0);
+    return steps;
+}
+
+static void IdleWhenClean(void)
+{
+    long releases = 0, defrags = testCounters.nandDefrags;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    TEST_CHECK(TestWriteFile("a", 0, data, sizeof(data)) == 0);
+
+    TestRemount();
+    releases = testCounters.nandReleases;
+    TEST_CHECK(ReclaimAll(64) == 0);
+    TEST_CHECK(testCounters.nandReleases == releases && testCounters.nandDefrags == defrags);
+}
+
+static void LeakedPagesDiscarded(void)
+{
+    long releases = 0, defrags = testCounters.nandDefrags;
+    int pages = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    LeakPages();
+    TEST_CHECK(TestWriteFile("a", 0, data, sizeof(data)) == 0);
+    pages = esFtl_CalcUsedPages();
+
+    // The mount only asks for an evaluation, the pages go in later steps
+    TestRemount();
+    TEST_CHECK(esFtl_CalcUsedPages() == pages);
+    releases = testCounters.nandReleases;
+    TEST_CHECK(ReclaimAll(64) > 1);
+    TEST_CHECK(testCounters.nandReleases - releases >= LEAKED_PAGES);
+    TEST_CHECK(esFtl_CalcUsedPages() <= pages - LEAKED_PAGES);
+    TEST_CHECK(testCounters.nandDefrags == defrags);
+    TEST_CHECK(TestCheckFile("a", data, sizeof(data)));
+
+    TestRemount();
+    TEST_CHECK(ReclaimAll(64) == 0);
+    TEST_CHECK(TestCheckFile("a", data, sizeof(data)));
+}
+
+/*
+ * @brief Removing files evaluates the NAND once enough sectors were released.
+ */
+static void WatermarkTriggers(void)
+{
+    char path[16];
+    int files = ESFILE_RECLAIM_WATERMARK * ESFTL_NANDPAGEDATASIZE / FILE_SIZE + 1;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 3);
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(path, "f%d", i);
+        TEST_CHECK(TestWriteFile(path, 0, data, sizeof(data)) == 0);
+    }
+    TestRemount();
+    TEST_CHECK(ReclaimAll(64) == 0);
+
+    LeakPages();
+    TEST_CHECK(esFile_ReclaimStep(64) == 0);
+
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(path, "f%d", i);
+        TEST_CHECK(esFile_Remove(path) == 0);
+    }
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(ReclaimAll(64) > 1);
+    TEST_CHECK(esFtl_CalcUsedPages() < LEAKED_PAGES);
+}
+
+int main(void)
+{
+    TEST_RUN(IdleWhenClean);
+    TEST_RUN(LeakedPagesDiscarded);
+    TEST_RUN(WatermarkTriggers);
+    return TestReport();
+}
@@ -0,0 +1,159 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+#define RECORD_SIZE                         200
+
+static uint8_t shadow[2][3000][RECORD_SIZE];
+static int count[2];
+
+static void RoundTrip(void)
+{
+    esFile_FileDescriptor fp;
+    uint8_t record[RECORD_SIZE];
+
+    TestMount(1);
+    TEST_CHECK(esFile_OpenRecords(&fp, "ev.db", RECORD_SIZE) == 0);
+    for (int n = 0; n < 100; n++)
+    {
+        TestFill(shadow[0][n], RECORD_SIZE, n);
+        TEST_CHECK(esFile_WriteRecord(&fp, n, shadow[0][n]) == 0);
+    }
+    TEST_CHECK(esFile_RecordCount(&fp) == 100);
+
+    // Overwrite in place
+    TestFill(shadow[0][42], RECORD_SIZE, 1000);
+    TEST_CHECK(esFile_WriteRecord(&fp, 42, shadow[0][42]) == 0);
+    TEST_CHECK(esFile_RecordCount(&fp) == 100);
+    esFile_Close(&fp);
+
+    TestRemount();
+    TEST_CHECK(esFile_OpenRecords(&fp, "ev.db", RECORD_SIZE) == 0);
+    TEST_CHECK(esFile_RecordCount(&fp) == 100);
+    for (int n = 0; n < 100; n++)
+    {
+        TEST_CHECK(esFile_ReadRecord(&fp, n, record) == 0);
+        TEST_CHECK(memcmp(record, shadow[0][n], RECORD_SIZE) == 0);
+    }
+    TEST_CHECK(esFile_ReadRecord(&fp, 100, record) == -1);
+    esFile_Close(&fp);
+}
+
+static void Misuse(void)
+{
+    esFile_FileDescriptor fp;
+    uint8_t record[RECORD_SIZE];
+    uint32_t br = 0;
+
+    TestMount(1);
+    TestFill(record, RECORD_SIZE, 1);
+    TEST_CHECK(esFile_OpenRecords(&fp, "ev.db", RECORD_SIZE) == 0);
+    TEST_CHECK(esFile_WriteRecord(&fp, 0, record) == 0);
+    esFile_Close(&fp);
+
+    // The record size is fixed when the file is created
+    TEST_CHECK(esFile_OpenRecords(&fp, "ev.db", RECORD_SIZE + 1) != 0);
+
+    // Records are not accessed through the byte stream calls
+    TEST_CHECK(esFile_OpenRecords(&fp, "ev.db", RECORD_SIZE) == 0);
+    TEST_CHECK(esFile_Read(&fp, record, 10, &br) != 0);
+    TEST_CHECK(esFile_Seek(&fp, 0) != 0);
+    esFile_Close(&fp);
+}
+
+/*
+ * @brief Write, read and remount at random against a shadow table.
+ *  Writes past the end extend the file, the records skipped over read back
+    as zeros.
+ */
+static void RandomAccess(void)
+{
+    const char *paths[2] = {"ev.db", "e:ev.db"};
+    const int limits[2] = {3000, 150};
+    esFile_FileDescriptor fp[2];
+    uint8_t record[RECORD_SIZE];
+    int k = 0, op = 0, n = 0, rv = 0;
+
+    srand(1);
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    memset(shadow, 0, sizeof(shadow));
+    memset(count, 0, sizeof(count));
+
+    for (k = 0; k < 2; k++)
+    {
+        TEST_CHECK(esFile_OpenRecords(&fp[k], paths[k], RECORD_SIZE) == 0);
+    }
+
+    for (int i = 0; i < 4000; i++)
+    {
+        k = rand() % 2;
+        op = rand() % 10;
+        if (op < 4)
+        {
+            n = rand() % (count[k] + 3);
+            if (n >= limits[k])
+            {
+                continue;
+            }
+
+            TestFill(record, RECORD_SIZE, i);
+            TEST_CHECK(esFile_WriteRecord(&fp[k], n, record) == 0);
+            memcpy(shadow[k][n], record, RECORD_SIZE);
+            if (n >= count[k])
+            {
+                count[k] = n + 1;
+            }
+            TEST_CHECK(esFile_RecordCount(&fp[k]) == count[k]);
+        }
+        else if (op < 9)
+        {
+            n = rand() % (count[k] + 2);
+            rv = esFile_ReadRecord(&fp[k], n, record);
+            if (n >= count[k])
+            {
+                TEST_CHECK(rv == -1);
+            }
+            else
+            {
+                TEST_CHECK(rv == 0 && memcmp(record, shadow[k][n], RECORD_SIZE) == 0);
+            }
+        }
+        else
+        {
+            TestRemount();
+            for (int j = 0; j < 2; j++)
+            {
+                TEST_CHECK(esFile_OpenRecords(&fp[j], paths[j], RECORD_SIZE) == 0);
+                TEST_CHECK(esFile_RecordCount(&fp[j]) == count[j]);
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(RoundTrip);
+    TEST_RUN(Misuse);
+    TEST_RUN(RandomAccess);
+    return TestReport();
+}
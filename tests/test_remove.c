@@ -0,0 +1,131 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#define FILE_SIZE                           (1 << 20)
+
+static uint8_t data[FILE_SIZE];
+
+static void Drain(void)
+{
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+}
+
+static void RemoveIsDeferred(void)
+{
+    long releases = 0;
+    int used = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    used = TestUsedSectors(0);
+    TEST_CHECK(TestWriteFile("a", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("e:a", 0, data, 4000) == 0);
+
+    releases = testCounters.nandReleases;
+    TEST_CHECK(esFile_Remove("a") == 0);
+    TEST_CHECK(esFile_Remove("e:a") == 0);
+    TEST_CHECK(esFile_Stat("a", NULL) != 0 && esFile_Stat("e:a", NULL) != 0);
+    TEST_CHECK(testCounters.nandReleases == releases);
+    TEST_CHECK(TestUsedSectors(0) > used && TestUsedSectors(1) > 0);
+
+    // The name can be used again while the old chain waits, the new file takes two sectors
+    TEST_CHECK(TestWriteFile("a", 0, data + 1, 3000) == 0);
+
+    TEST_CHECK(esFile_RemoveService(16) == 1);
+    Drain();
+    TEST_CHECK(esFile_RemoveService(16) == 0);
+    TEST_CHECK(testCounters.nandReleases > releases);
+    TEST_CHECK(TestUsedSectors(0) == used + 2 && TestUsedSectors(1) == 0);
+    TEST_CHECK(TestCheckFile("a", data + 1, 3000));
+}
+
+/*
+ * @brief Remount with chains still waiting to be freed.
+ *  The mount rebuilds the usage from the remaining files, so the waiting
+    sectors are free afterwards.
+ */
+static void RemountWhilePending(void)
+{
+    int used = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    TEST_CHECK(TestWriteFile("keep", 0, data, 5000) == 0);
+    used = TestUsedSectors(0);
+    TEST_CHECK(TestWriteFile("gone", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Remove("gone") == 0);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(0) == used);
+    TEST_CHECK(esFile_RemoveService(16) == 0);
+    TEST_CHECK(TestCheckFile("keep", data, 5000));
+}
+
+/*
+ * @brief Fill the NAND, remove everything and fill it again without idle time.
+ *  The allocation frees the waiting chains itself, and more files are removed
+    than the queue holds.
+ */
+static void FullDriveFreesQueue(void)
+{
+    char path[16];
+    int files = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 3);
+    for (files = 0; files < 100; files++)
+    {
+        sprintf(path, "f%d", files);
+        if (TestWriteFile(path, 0, data, sizeof(data)) != 0)
+        {
+            break;
+        }
+    }
+    TEST_CHECK(files > ESFILE_REMOVE_QUEUE && files < 100);
+
+    for (int i = 0; i <= files; i++)
+    {
+        sprintf(path, "f%d", i);
+        esFile_Remove(path);
+    }
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(path, "g%d", i);
+        TEST_CHECK(TestWriteFile(path, 0, data + i, sizeof(data) - i) == 0);
+    }
+    TEST_CHECK(esFile_RemoveService(16) == 0);
+
+    TestRemount();
+    for (int i = 0; i < files; i += 7)
+    {
+        sprintf(path, "g%d", i);
+        TEST_CHECK(TestCheckFile(path, data + i, sizeof(data) - i));
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(RemoveIsDeferred);
+    TEST_RUN(RemountWhilePending);
+    TEST_RUN(FullDriveFreesQueue);
+    return TestReport();
+}
@@ -0,0 +1,162 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdlib.h>
+
+static uint8_t stream[2][600000];
+static uint32_t total[2];
+static uint8_t buff[30000];
+
+static uint32_t RingSize(int k, uint32_t capacity)
+{
+    return total[k] < capacity ? total[k] : capacity;
+}
+
+static void KeepsTheTail(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0, br = 0, capacity = 0;
+
+    TestMount(1);
+    TestFill(stream[0], 50000, 1);
+
+    TEST_CHECK(esFile_OpenRing(&fp, "ring.log", 10000) == 0);
+    capacity = fp.capacity;
+    TEST_CHECK(capacity >= 10000);
+    for (uint32_t ofs = 0; ofs < 50000; ofs += 1000)
+    {
+        TEST_CHECK(esFile_Write(&fp, stream[0] + ofs, 1000, &bw) == 0 && bw == 1000);
+    }
+    TEST_CHECK(esFile_Size(&fp) == (int)capacity);
+
+    TEST_CHECK(esFile_Seek(&fp, 0) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, capacity, &br) == 0 && br == capacity);
+    TEST_CHECK(memcmp(buff, stream[0] + 50000 - capacity, capacity) == 0);
+    esFile_Close(&fp);
+
+    TestRemount();
+
+    // The capacity is taken from the existing file
+    TEST_CHECK(esFile_OpenRing(&fp, "ring.log", 1) == 0);
+    TEST_CHECK(fp.capacity == capacity);
+    TEST_CHECK(esFile_Seek(&fp, 0) == 0);
+    TEST_CHECK(esFile_Read(&fp, buff, capacity, &br) == 0 && br == capacity);
+    TEST_CHECK(memcmp(buff, stream[0] + 50000 - capacity, capacity) == 0);
+    esFile_Close(&fp);
+}
+
+/*
+ * @brief Append, read and remount at random against the whole stream.
+ *  The ring holds the last min(capacity, total) bytes of the stream.
+ */
+static void RandomAccess(void)
+{
+    const char *paths[2] = {"ring.log", "e:ring.log"};
+    uint32_t capacities[2] = {20000, 5000};
+    esFile_FileDescriptor fp[2];
+    uint32_t bw = 0, br = 0, ofs = 0, len = 0, size = 0, expected = 0;
+    int k = 0, op = 0;
+
+    srand(1);
+    TestMount(1);
+    TEST_CHECK(esFile_SetChecksumVerification(0, 1) == 0);
+    TEST_CHECK(esFile_SetChecksumVerification(1, 1) == 0);
+    memset(total, 0, sizeof(total));
+
+    for (k = 0; k < 2; k++)
+    {
+        TEST_CHECK(esFile_OpenRing(&fp[k], paths[k], capacities[k]) == 0);
+        capacities[k] = fp[k].capacity;
+    }
+
+    for (int i = 0; i < 2000; i++)
+    {
+        k = rand() % 2;
+        op = rand() % 10;
+        if (op < 5)
+        {
+            len = 1 + rand() % (op == 0 ? 25000 : 700);
+            if (total[k] + len > sizeof(stream[k]))
+            {
+                continue;
+            }
+
+            TestFill(stream[k] + total[k], len, i);
+            TEST_CHECK(esFile_Seek(&fp[k], esFile_Size(&fp[k])) == 0);
+            TEST_CHECK(esFile_Write(&fp[k], stream[k] + total[k], len, &bw) == 0 && bw == len);
+            total[k] += len;
+            TEST_CHECK(esFile_Size(&fp[k]) == (int)RingSize(k, capacities[k]));
+        }
+        else if (op < 9)
+        {
+            size = RingSize(k, capacities[k]);
+            ofs = size ? rand() % (size + 1) : 0;
+            len = rand() % (op == 5 ? sizeof(buff) : 900);
+            expected = size - ofs < len ? size - ofs : len;
+
+            TEST_CHECK(esFile_Seek(&fp[k], ofs) == 0);
+            TEST_CHECK(esFile_Read(&fp[k], buff, len, &br) == 0 && br == expected);
+            TEST_CHECK(memcmp(buff, stream[k] + total[k] - size + ofs, br) == 0);
+        }
+        else
+        {
+            TestRemount();
+            for (int j = 0; j < 2; j++)
+            {
+                TEST_CHECK(esFile_OpenRing(&fp[j], paths[j], 1) == 0);
+                TEST_CHECK(fp[j].capacity == capacities[j]);
+                TEST_CHECK(esFile_Size(&fp[j]) == (int)RingSize(j, capacities[j]));
+            }
+        }
+    }
+}
+
+static void RemoveReleases(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+    int used = 0;
+
+    TestMount(1);
+    used = TestUsedSectors(0);
+    TestFill(stream[0], 30000, 2);
+
+    TEST_CHECK(esFile_OpenRing(&fp, "ring.log", 20000) == 0);
+    TEST_CHECK(esFile_Write(&fp, stream[0], 30000, &bw) == 0 && bw == 30000);
+    esFile_Close(&fp);
+    TEST_CHECK(TestUsedSectors(0) > used);
+
+    TEST_CHECK(esFile_Remove("ring.log") == 0);
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+    TEST_CHECK(TestUsedSectors(0) == used);
+
+    TestRemount();
+    TEST_CHECK(TestUsedSectors(0) == used);
+}
+
+int main(void)
+{
+    TEST_RUN(KeepsTheTail);
+    TEST_RUN(RandomAccess);
+    TEST_RUN(RemoveReleases);
+    return TestReport();
+}
@@ -0,0 +1,119 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_init.h"
+#include "esFile_remove.h"
+#include "esFile_test.h"
+
+#define FILE_COUNT                          20
+
+static uint8_t data[100000];
+
+/*
+ * @brief Run a stepped initialization to its end.
+ * @param format
+ * @param budget
+ * @return the number of steps, negative if it failed
+ */
+static int InitInSteps(uint8_t format, uint32_t budget)
+{
+    int rv = esFile_InitStart(format), steps = 0;
+
+    while (rv == 1)
+    {
+        rv = esFile_InitStep(budget);
+        steps++;
+    }
+
+    return rv == 0 ? steps : rv;
+}
+
+static void FilePath(int i, char *path)
+{
+    sprintf(path, "%sf%d", i % 2 ? "e:" : "", i);
+}
+
+static int FileSize(int i)
+{
+    return i % 2 ? 500 + i * 50 : 5000 + i * 100;
+}
+
+static void FormatAndMount(void)
+{
+    char path[16];
+    int used[2] = {0};
+
+    TestMount(1);
+    TEST_CHECK(InitInSteps(1, 3) > 10);
+    TestFill(data, sizeof(data), 1);
+    for (int i = 0; i < FILE_COUNT; i++)
+    {
+        FilePath(i, path);
+        TEST_CHECK(TestWriteFile(path, 0, data + i, FileSize(i)) == 0);
+    }
+    TEST_CHECK(esFile_Sync() == 0);
+    used[0] = TestUsedSectors(0);
+    used[1] = TestUsedSectors(1);
+
+    TEST_CHECK(InitInSteps(0, 2) > 10);
+    TEST_CHECK(TestUsedSectors(0) == used[0] && TestUsedSectors(1) == used[1]);
+    for (int i = 0; i < FILE_COUNT; i++)
+    {
+        FilePath(i, path);
+        TEST_CHECK(TestCheckFile(path, data + i, FileSize(i)));
+    }
+}
+
+static void RemoveInSteps(void)
+{
+    const char *paths[2] = {"big", "e:big"};
+    esFile_ReleaseJob job;
+    int used = 0, steps = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    for (uint8_t did = 0; did < 2; did++)
+    {
+        used = TestUsedSectors(did);
+        TEST_CHECK(TestWriteFile(paths[did], 0, data, did ? 20000 : sizeof(data)) == 0);
+
+        TEST_CHECK(esFile_RemoveStart(paths[did], &job) == 1);
+        TEST_CHECK(esFile_Stat(paths[did], NULL) != 0);
+        TEST_CHECK(TestUsedSectors(did) > used);
+
+        steps = 0;
+        while (esFile_RemoveStep(&job, 5) == 1)
+        {
+            steps++;
+        }
+        TEST_CHECK(steps > 1);
+        TEST_CHECK(TestUsedSectors(did) == used);
+
+        TEST_CHECK(esFile_RemoveStart(paths[did], &job) == 0);
+    }
+
+    TestRemount();
+    TEST_CHECK(esFile_Stat("big", NULL) != 0 && esFile_Stat("e:big", NULL) != 0);
+}
+
+int main(void)
+{
+    TEST_RUN(FormatAndMount);
+    TEST_RUN(RemoveInSteps);
+    return TestReport();
+}
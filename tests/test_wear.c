@@ -0,0 +1,128 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#define WEAR_SECTORS                        256
+
+static uint8_t data[2000];
+static uint16_t saved[WEAR_SECTORS];
+
+static int WearCount(void)
+{
+    esFile_DriveInfo *dInfos = esFile_GetDriveInfos();
+
+    return dInfos[1].dataSectorEnd - dInfos[1].dataSectorStart;
+}
+
+static uint16_t *WearTable(void)
+{
+    return esFile_GetDriveInfos()[1].wearTable;
+}
+
+/*
+ * @brief Rewrite and remove a small file on the EEPROM drive.
+ * @param rounds
+ */
+static void Churn(int rounds)
+{
+    for (int i = 0; i < rounds; i++)
+    {
+        TEST_CHECK(TestWriteFile("e:churn", 0, data, 1000) == 0);
+        TEST_CHECK(esFile_Remove("e:churn") == 0);
+    }
+    while (esFile_RemoveService(64) == 1)
+    {
+    }
+}
+
+static void ChurnIsSpread(void)
+{
+    uint16_t *table = NULL;
+    int low = 0xFFFF, high = 0;
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 1);
+    TEST_CHECK(WearCount() <= WEAR_SECTORS);
+    table = WearTable();
+    memset(table, 0, WearCount() * sizeof(uint16_t));
+
+    Churn(400);
+    TEST_CHECK(TestUsedSectors(1) == 0);
+    for (int i = 0; i < WearCount(); i++)
+    {
+        low = table[i] < low ? table[i] : low;
+        high = table[i] > high ? table[i] : high;
+    }
+    TEST_CHECK(low > 0 && high - low <= 4);
+}
+
+/*
+ * @brief The counters are kept across a mount and a format, and stored in batches.
+ */
+static void CountersPersist(void)
+{
+    TestMount(1);
+    TestFill(data, sizeof(data), 2);
+    Churn(100);
+    TEST_CHECK(TestWriteFile("e:keep", 0, data, sizeof(data)) == 0);
+    memcpy(saved, WearTable(), WearCount() * sizeof(uint16_t));
+
+    TestRemount();
+    TEST_CHECK(memcmp(saved, WearTable(), WearCount() * sizeof(uint16_t)) == 0);
+    TEST_CHECK(TestCheckFile("e:keep", data, sizeof(data)));
+
+    TestMount(1);
+    TEST_CHECK(memcmp(saved, WearTable(), WearCount() * sizeof(uint16_t)) == 0);
+    TestRemount();
+    TEST_CHECK(memcmp(saved, WearTable(), WearCount() * sizeof(uint16_t)) == 0);
+
+    // A few writes are not worth a store of the table, they are lost at the reset
+    TEST_CHECK(TestWriteFile("e:keep", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(memcmp(saved, WearTable(), WearCount() * sizeof(uint16_t)) != 0);
+    TestRemount();
+    TEST_CHECK(memcmp(saved, WearTable(), WearCount() * sizeof(uint16_t)) == 0);
+    TEST_CHECK(TestCheckFile("e:keep", data, sizeof(data)));
+}
+
+static void UnknownTableIgnored(void)
+{
+    const uint8_t magic[4] = {'W', 'E', 'A', 'R'};
+
+    TestMount(1);
+    TestFill(data, sizeof(data), 3);
+    Churn(100);
+    TEST_CHECK(TestWriteFile("e:keep", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(esFile_Sync() == 0);
+
+    TEST_CHECK(TestEepromCorrupt(magic, sizeof(magic)));
+    TEST_CHECK(esFile_Init(0) == 0);
+    for (int i = 0; i < WearCount(); i++)
+    {
+        TEST_CHECK(WearTable()[i] == 0);
+    }
+    TEST_CHECK(TestCheckFile("e:keep", data, sizeof(data)));
+}
+
+int main(void)
+{
+    TEST_RUN(ChurnIsSpread);
+    TEST_RUN(CountersPersist);
+    TEST_RUN(UnknownTableIgnored);
+    return TestReport();
+}
@@ -0,0 +1,162 @@
+/*
+ *   Copyright (c) 2023 thearistotlemethod@gmail.com
+ *   All rights reserved.
+
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+
+ *   http://www.apache.org/licenses/LICENSE-2.0
+
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "esFile.h"
+#include "esFile_test.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static uint8_t data[20000];
+
+static void RoundTrip(void)
+{
+    TestMount(1);
+    esFile_CacheSetWriteBack(1);
+    TestFill(data, sizeof(data), 1);
+
+    TEST_CHECK(TestWriteFile("a.bin", 0, data, sizeof(data)) == 0);
+    TEST_CHECK(TestWriteFile("e:b.bin", 0, data, 5000) == 0);
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:b.bin", data, 5000));
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("a.bin", data, sizeof(data)));
+    TEST_CHECK(TestCheckFile("e:b.bin", data, 5000));
+}
+
+static void WritesAreDeferred(void)
+{
+    esFile_FileDescriptor fp;
+    uint32_t bw = 0;
+    long writes = 0;
+
+    TestMount(1);
+    esFile_CacheSetWriteBack(1);
+    TestFill(data, 100, 2);
+
+    TEST_CHECK(esFile_Open(&fp, "log.txt", ESFILE_MODE_CREATE_ALWAYS | ESFILE_MODE_WRITE | ESFILE_MODE_PLAIN) == 0);
+    writes = testCounters.nandWrites;
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_CHECK(esFile_Write(&fp, data + i * 10, 10, &bw) == 0 && bw == 10);
+    }
+#if ESFILE_CACHE_ENTRIES > 1
+    // A single entry is shared by the data sector and the file info sector
+    TEST_CHECK(testCounters.nandWrites == writes);
+    TEST_CHECK(!TestNandContains(data, 100));
+#else
+    (void)writes;
+#endif
+
+    esFile_Close(&fp);
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(TestNandContains(data, 100));
+}
+
+static void DisableFlushes(void)
+{
+    TestMount(1);
+    esFile_CacheSetWriteBack(1);
+    TestFill(data, 3000, 3);
+
+    TEST_CHECK(TestWriteFile("a.txt", ESFILE_MODE_PLAIN, data, 3000) == 0);
+    esFile_CacheSetWriteBack(0);
+    TEST_CHECK(TestNandContains(data, 2000));
+
+    // Mount again without a sync, the disk alone must hold the file
+    TEST_CHECK(esFile_Init(0) == 0);
+    TEST_CHECK(TestCheckFile("a.txt", data, 3000));
+}
+
+static void ServiceAgesOut(void)
+{
+    esFile_CacheStats stats;
+    uint32_t writeBacks = 0;
+
+    TestMount(1);
+    esFile_CacheSetWriteBack(1);
+    TestFill(data, 1500, 4);
+    TEST_CHECK(TestWriteFile("a.txt", ESFILE_MODE_PLAIN, data, 1500) == 0);
+
+    esFile_GetCacheStats(&stats);
+    writeBacks = stats.writeBacks;
+    for (int i = 0; i < 100; i++)
+    {
+        TEST_CHECK(esFile_CacheService() == 0);
+    }
+    esFile_GetCacheStats(&stats);
+    TEST_CHECK(stats.writeBacks == writeBacks);
+
+    usleep((ESFILE_CACHE_DIRTY_MS + 100) * 1000);
+    TEST_CHECK(esFile_CacheService() == 0);
+    esFile_GetCacheStats(&stats);
+    TEST_CHECK(stats.writeBacks > writeBacks);
+    TEST_CHECK(TestNandContains(data, 1500));
+
+    TestRemount();
+    TEST_CHECK(TestCheckFile("a.txt", data, 1500));
+}
+
+static void MetadataIsPinned(void)
+{
+    esFile_FileInfo fi;
+    char from[16], to[16];
+    long writes = 0;
+
+    TestMount(1);
+    TestFill(data, 300, 5);
+    TEST_CHECK(TestWriteFile("e:n0", ESFILE_MODE_PLAIN, data, 300) == 0);
+    esFile_CacheSetWriteBack(1);
+
+    // The file info sectors stay in the meta cache, however many sectors go through the entries
+    writes = testCounters.eepromWrites;
+    for (int i = 0; i < ESFILE_CACHE_ENTRIES * 4; i++)
+    {
+        snprintf(from, sizeof(from), "e:n%d", i);
+        snprintf(to, sizeof(to), "e:n%d", i + 1);
+        TEST_CHECK(esFile_Rename(from, to) == 0);
+    }
+    TEST_CHECK(testCounters.eepromWrites == writes);
+
+    TEST_CHECK(esFile_CacheService() == 0);
+    TEST_CHECK(testCounters.eepromWrites == writes);
+    usleep((ESFILE_CACHE_DIRTY_MS + 100) * 1000);
+    TEST_CHECK(esFile_CacheService() == 0);
+    TEST_CHECK(testCounters.eepromWrites > writes);
+
+    snprintf(to, sizeof(to), "e:n%d", ESFILE_CACHE_ENTRIES * 4);
+    TEST_CHECK(esFile_Rename(to, "e:last") == 0);
+    writes = testCounters.eepromWrites;
+    TEST_CHECK(esFile_Sync() == 0);
+    TEST_CHECK(testCounters.eepromWrites > writes);
+
+    esFile_CacheSetWriteBack(0);
+    TEST_CHECK(esFile_Init(0) == 0);
+    TEST_CHECK(esFile_Stat("e:last", &fi) == 0);
+    TEST_CHECK(TestCheckFile("e:last", data, 300));
+}
+
+int main(void)
+{
+    TEST_RUN(RoundTrip);
+    TEST_RUN(WritesAreDeferred);
+    TEST_RUN(DisableFlushes);
+    TEST_RUN(ServiceAgesOut);
+    TEST_RUN(MetadataIsPinned);
+    return TestReport();
+}